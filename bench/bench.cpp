@@ -0,0 +1,57 @@
+/* Standalone benchmarks that are too slow or too memory hungry to run
+on every start of the demo program, after the behaviour checks. Built and
+run with make bench; make check runs only the checks. */
+#include <iostream>
+#include <string>
+#include "BufferPool.h"
+#include "bPlusTree.h"
+#include "tests.h"
+using namespace std;
+
+// every check runs even after one fails, false if any did
+static bool runChecks() {
+    bool ok = TestTreeAgainstMap();
+    ok &= TestMmapTruncate();
+    ok &= TestReplacementPolicies();
+    ok &= TestConcurrentFetches();
+    ok &= TestLeafReadAhead();
+    ok &= TestScanOneShot();
+    ok &= TestBackgroundWriter();
+    ok &= TestFrameArena();
+    ok &= TestPageTable();
+    ok &= TestCSVLoad();
+    ok &= TestNodeLayout();
+    ok &= TestSlottedLeaf();
+    ok &= TestKeySearch();
+    ok &= TestConcurrentTree();
+    ok &= TestInsertBatch();
+    ok &= TestRangeCursor();
+    ok &= TestLetterRange();
+    ok &= TestOrderStatistics();
+    ok &= TestNameKeys();
+    ok &= TestPrefixCompression();
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    // a tree that gives wrong answers makes every number below meaningless
+    if (!runChecks())
+        return 1;
+    if (argc > 1 && string(argv[1]) == "--check")
+        return 0;
+    BenchBufferPoolMisses();
+    BenchConcurrentFetches();
+    BenchLeafScanReadAhead();
+    BenchScanResistance();
+    BenchSearchTailLatency();
+    BenchFrameArena();
+    BenchPageTableLookup();
+    BenchBulkLoad();
+    BenchInsertBatch();
+    BenchKeySearch();
+    BenchRangeCursor();
+    BenchOrderStatistics();
+    BenchConcurrentTree();
+    BenchKeyCompression();
+    return 0;
+}
@@ -3,10 +3,9 @@
 
 #include <cstdint>
 #include <cstring>
-#include <functional>
 
 // Bloom filter parameters
-static const int BLOOM_BITS = 256;
+static const int BLOOM_BITS = 4096;
 static const int BLOOM_BYTES = BLOOM_BITS / 8;
 
 class BloomFilter {
@@ -22,19 +21,21 @@ public:
         std::memset(bits, 0, BLOOM_BYTES);
     }
 
-    // Insert an integer key into the filter
-    void add(int key) {
-        std::size_t h1 = hash1(key) % BLOOM_BITS;
-        std::size_t h2 = hash2(key) % BLOOM_BITS;
+    // Insert a key into the filter
+    void add(const char* key, int len) {
+        uint64_t h = hash(key, len);
+        std::size_t h1 = hash1(h) % BLOOM_BITS;
+        std::size_t h2 = hash2(h) % BLOOM_BITS;
 
         bits[h1 / 8] |= uint8_t(1u << (h1 % 8));
         bits[h2 / 8] |= uint8_t(1u << (h2 % 8));
     }
 
     // Check if key is possibly present (may have false positives, never false negatives)
-    bool possiblyContains(int key) const {
-        std::size_t h1 = hash1(key) % BLOOM_BITS;
-        std::size_t h2 = hash2(key) % BLOOM_BITS;
+    bool possiblyContains(const char* key, int len) const {
+        uint64_t h = hash(key, len);
+        std::size_t h1 = hash1(h) % BLOOM_BITS;
+        std::size_t h2 = hash2(h) % BLOOM_BITS;
 
         bool b1 = (bits[h1 / 8] & uint8_t(1u << (h1 % 8))) != 0;
         bool b2 = (bits[h2 / 8] & uint8_t(1u << (h2 % 8))) != 0;
@@ -43,12 +44,22 @@ public:
     }
 
 private:
-    static inline std::size_t hash1(int key) {
-        return std::hash<int>()(key);
+    /* 64 bit FNV-1a of the key bytes: the filter is stored in leaf pages, so the
+       hash has to be the same in every build (std::hash makes no such promise) */
+    static inline uint64_t hash(const char* key, int len) {
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (int i = 0; i < len; ++i) {
+            h ^= static_cast<unsigned char>(key[i]);
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+    static inline std::size_t hash1(uint64_t h) {
+        return static_cast<std::size_t>(h ^ (h >> 32));
     }
     //hash 2 uses the golden ratio constant
-    static inline std::size_t hash2(int key) {
-        return static_cast<std::size_t>(key) * 0x9e3779b97f4a7c15ULL;
+    static inline std::size_t hash2(uint64_t h) {
+        return static_cast<std::size_t>((h * 0x9e3779b97f4a7c15ULL) >> 32);
     }
 };
 
@@ -1,5 +1,19 @@
 /* Buffer that holds recent pages that have been accessed or created
-operates on FIFO and is implemented using a doubly linked list
+frames are kept in a doubly linked list and the page to evict is chosen
+by a pluggable replacement policy (FIFO by default)
+The pool is safe to use from several threads. Page ids are spread over
+shards (pageId % shard count), each with its own latch, page table,
+free frames and replacement state, so threads working on different pages
+rarely wait for each other. Page reads happen outside the shard latch.
+With read-ahead enabled the pool watches each thread for fetches that follow
+a page chain (the link is decoded by a callback, e.g. the B+ tree's nextLeaf)
+and a background I/O thread loads the next pages of the chain while the
+caller is still working on the current one.
+Pages fetched by a scan are one-shot: once unpinned they are evicted before
+anything the replacement policy would pick, so a full scan only cycles
+through its own frames and leaves the root and inner nodes resident.
+An optional background writer thread writes dirty, unpinned frames out
+ahead of eviction so that a fetch rarely has to write a victim itself.
 */
 #ifndef BUFFER_POOL_H
 #define BUFFER_POOL_H
@@ -7,56 +21,191 @@ operates on FIFO and is implemented using a doubly linked list
 #include <iostream>
 #include <unordered_map>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <deque>
+#include <condition_variable>
 #include "FileDiskManager.h"
 #include "pageFrameList.h"
+#include "ReplacementPolicy.h"
+#include "PageTable.h"
 
 using namespace std;
 
+// default number of chain pages kept loaded ahead of a sequential reader
+static const int READ_AHEAD_PAGES = 8;
+// default number of upcoming victims per shard the background writer keeps clean (free frames count)
+static const int BG_CLEAN_FRAMES = 4;
+// how often the background writer looks at the pool when nothing wakes it
+static const int BG_WRITER_INTERVAL_MS = 50;
+// next page of a chain given a loaded page, -1 if the page is not part of one
+typedef int (*ChainLinkFn)(int pageId, const char* data);
+
+enum class AccessHint {
+    Normal, // the page is handed to the replacement policy as usual
+    Scan    // page is read once by a scan, evict it first unless someone else uses it
+};
+
+// totals over all shards
+struct BufferStats
+{
+    long fetches;
+    long hits;
+    long misses;
+    long evictions;
+    long writes; // number of disk writes (dirty flushes) done by callers of the pool
+    long bgWrites; // dirty frames written ahead of eviction by the background writer
+    long prefetches; // pages loaded by the read-ahead thread
+};
+
+/* one partition of the pool, aligned so the latches and counters of
+different shards do not share a cache line */
+struct alignas(64) PoolShard
+{
+    mutex latch;
+    // Maps pageId to frame pointer
+    PageTable pageTable;
+    // frames owned by this shard, PageFrame::frameId indexes this vector
+    vector<PageFrame*> frames;
+    // frames that hold no page, popped before anything is evicted
+    vector<PageFrame*> freeFrames;
+    // decides which unpinned frame is evicted
+    ReplacementPolicy* policy = nullptr;
+    // unpinned one-shot frames, oldest first, evicted before asking the policy
+    FrameIdList oneShotFrames{ 0 };
+    atomic<long> fetches{ 0 };
+    atomic<long> hits{ 0 };
+    atomic<long> misses{ 0 };
+    atomic<long> evictions{ 0 };
+    atomic<long> writes{ 0 };
+    atomic<long> bgWrites{ 0 };
+    atomic<long> prefetches{ 0 };
+};
+
 class BufferPool
 {
 public:
-    //constructor
-    BufferPool(int poolSize, FileDiskManager* disk);
+    //constructor, every shard needs room for the pages a thread keeps pinned at once
+    BufferPool(int poolSize, FileDiskManager* disk,
+        ReplacementType policyType = ReplacementType::FIFO, int numShards = 1,
+        bool hugePages = false);
     //destructor
     ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
     // Load page into memory or return existing one
-    PageFrame* FetchPage(int pageId);
+    PageFrame* FetchPage(int pageId, AccessHint hint = AccessHint::Normal);
     /* frame is no longer being currently used
        Decrement pin count & mark dirty if needed */
     void UnpinPage(int pageId, bool dirty);
+    // one more pin on a frame the caller already has pinned, released with UnpinPage
+    void PinPage(PageFrame* f);
+    /* a pinned page fetched with AccessHint::Scan is not read just once after
+       all (an inner node on a scan's way down): make it an ordinary page */
+    void KeepPage(PageFrame* f);
+    /* call before changing a fetched page: mapped frames are the file itself,
+       so in mmap mode the page's checkpoint image is journaled first */
+    void PrepareWrite(int pageId);
     // Create brand new page
     PageFrame* NewPage(int& newPageId);
+    // Drop a page from the pool without writing it (page was freed)
+    void DiscardPage(int pageId);
     // Write page back manually
     void WritePage(int pageId);
     // Write back all dirty pages
     void FlushAllPages();
+    /* start the read-ahead thread, pages is clamped to a quarter of a shard
+    so prefetched pages do not push each other out before they are used */
+    void EnableReadAhead(ChainLinkFn link, int pages = READ_AHEAD_PAGES);
+    // stop the read-ahead thread, pending requests are dropped
+    void DisableReadAhead();
+    int GetReadAheadPages() const { return readAheadPages; }
+    /* start the background writer, which writes out dirty pages among the next
+    cleanFrames victims of every shard (clamped to the shard size) so the
+    eviction finds them clean; mapped files are written back by the OS */
+    void EnableBackgroundWriter(int cleanFrames = BG_CLEAN_FRAMES,
+        int intervalMs = BG_WRITER_INTERVAL_MS);
+    void DisableBackgroundWriter();
+    /* hold the background writer between rounds, a checkpoint must not have
+    page writes (and their journal entries) land while it resets the log */
+    void SuspendBackgroundWriter() { writerRound.lock(); }
+    void ResumeBackgroundWriter() { writerRound.unlock(); }
     FrameList* GetFrameList() { return &frameList; }
+    const char* GetPolicyName() const { return shards[0].policy->Name(); }
+    int GetShardCount() const { return numShards; }
+    // frame data sits on reserved huge pages (MAP_HUGETLB)
+    bool UsesHugePages() const { return hugeFrames; }
     // Buffer statistics
-    long fetches = 0;
-    long hits = 0;
-    long misses = 0;
-    long evictions = 0;
-    long writes = 0; // number of disk writes (dirty flushes)
+    BufferStats GetStats() const;
+    void ResetStats();
     void PrintStats(const std::string& label)
     {
-        cout << "---- Buffer Stats (" << label << ") ----\n";
-        cout << "Fetches:   " << fetches << "\n";
-        cout << "Hits:      " << hits << "\n";
-        cout << "Misses:    " << misses << "\n";
-        cout << "Evictions: " << evictions << "\n";
-        cout << "Writes:    " << writes << "\n";
+        BufferStats s = GetStats();
+        cout << "---- Buffer Stats (" << label << ", " << GetPolicyName() << ") ----\n";
+        cout << "Fetches:   " << s.fetches << "\n";
+        cout << "Hits:      " << s.hits << "\n";
+        cout << "Misses:    " << s.misses << "\n";
+        cout << "Evictions: " << s.evictions << "\n";
+        cout << "Writes:    " << s.writes << "\n";
+        cout << "BG writes: " << s.bgWrites << "\n";
+        cout << "Read-ahead: " << s.prefetches << "\n";
         cout << "----------------------------------------\n";
     }
 
 private:
 public:
     void ClearAllFrames();
+    PoolShard& ShardFor(int pageId) { return shards[pageId % numShards]; }
+    // unused frame or an evicted victim (written back if dirty), shard latch held
+    PageFrame* GetFreeFrame(PoolShard& s);
+    // point the frame at the page (mmap mode) or copy the page into it
+    void ReadIntoFrame(PageFrame* f, int pageId);
+    // pin a resident frame, taking it out of the eviction candidates (shard latch held)
+    void Pin(PoolShard& s, PageFrame* f);
+    // block until a frame another thread is reading from disk is filled
+    void WaitForLoad(PageFrame* f);
     int poolSize;
+    int numShards;
     FileDiskManager* disk;
     //doubly linked list frame buffer implementation
     FrameList frameList;
-    // Maps pageId to frame pointer
-    unordered_map<int, PageFrame*> pageTable;
+    // frame metadata, one dense array, each shard owns a contiguous run of it
+    PageFrame* frameArray;
+    // page data of every frame in one aligned block (nullptr in mmap mode)
+    char* arena;
+    long long arenaBytes;
+    bool hugeFrames;
+    PoolShard* shards;
+    // read-ahead: the chain decoder, window size and requests for the I/O thread
+    ChainLinkFn chainLink;
+    atomic<int> readAheadPages;
+    thread ioThread;
+    mutex ioLatch;
+    condition_variable ioWake;
+    deque<pair<int, int>> ioQueue; // (first page, page count)
+    atomic<bool> ioStop;
+    void ReadAheadLoop();
+    // check whether this thread is walking a chain and queue the pages after f
+    void DetectSequential(PageFrame* f);
+    // bring a page in without counting a fetch, returns its chain link
+    int LoadAhead(int pageId);
+    // background writer: target, wake-up and the latch held for each round
+    atomic<int> cleanTarget;
+    int writerIntervalMs;
+    thread writerThread;
+    mutex writerLatch;
+    condition_variable writerWake;
+    atomic<bool> writerStop;
+    mutex writerRound;
+    // aligned copies of the pages a round writes
+    vector<char*> writerPages;
+    void WriterLoop();
+    // write the dirty frames among the next cleanTarget victims of one shard
+    void CleanShard(PoolShard& s);
+    // a frame the background writer is saving must not be reused or rewritten until it is done
+    void WaitForWriteBack(PageFrame* f);
 };
 
 #endif
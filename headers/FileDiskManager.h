@@ -3,29 +3,97 @@
 #define FILE_DISK_MANAGER_H
 
 #include <string>
-#include <fstream>
+#include <mutex>
 using namespace std;
 //page size can be changed depending on how much
 // data is being stored
 static const int PAGE_SIZE = 16384;
+// alignment required for O_DIRECT transfers (covers 512b and 4k sector disks)
+static const int IO_ALIGNMENT = 4096;
+// file space (and the mapping in mmap mode) is reserved in chunks of this many bytes
+static const long long EXTENT_BYTES = 8LL * 1024 * 1024;
+static const int EXTENT_PAGES = static_cast<int>(EXTENT_BYTES / PAGE_SIZE);
+
+class LogManager;
+// address space reserved up front so the mapping never moves while it grows
+static const long long MMAP_RESERVE = 64LL * 1024 * 1024 * 1024;
+// huge page size assumed when the buffer pool asks for a huge page backed frame arena
+static const long long HUGE_PAGE_BYTES = 2LL * 1024 * 1024;
+
+/* how pages move between the file and memory
+   Buffered: positional pread/pwrite through the OS page cache
+   Direct:   same calls but the file is opened with O_DIRECT so
+             the page cache is bypassed (falls back to Buffered
+             when the filesystem does not support it)
+   Mmap:     the file is mapped into memory and pages are handed out
+             as pointers into the mapping, no copy on read */
+enum class DiskMode {
+    Buffered,
+    Direct,
+    Mmap
+};
 
 class FileDiskManager {
 private:
     std::string filename;
-    std::fstream file;
+    int fd;
     int nextPageId;
-    //makes sure file is open and if it isnt create the file and reopen
+    // pages covered by preallocated file space, ids below this need no allocation
+    int allocatedPages;
+    DiskMode mode;
+    // aligned scratch page used when a write's buffer is not aligned for O_DIRECT
+    char* bounce;
+    // start of the reserved mapping and how much of it is backed by the file
+    char* mapBase;
+    long long mappedBytes;
+    /* length of the file in Mmap mode: whole extents while pages are added,
+    cut to the pages in use by Truncate, so the mapping can run past it */
+    long long fileLength;
+    // write-ahead log that saves checkpoint images before pages are overwritten
+    LogManager* journal;
+    /* serializes page writes, allocation and truncation, which share the
+    journal, the bounce page and the page count with the pool's background writer */
+    std::mutex latch;
+    //makes sure file is open and if it isnt create the file
     void EnsureOpen();
+    // reserve address space and map the existing file (Mmap mode)
+    bool OpenMapping(long long fileBytes);
+    // extend file and mapping by whole extents until bytes are covered by the file
+    bool GrowMapping(long long bytes);
 
 public:
-    FileDiskManager(const std::string& filename);
+    FileDiskManager(const std::string& filename, DiskMode mode = DiskMode::Buffered);
+    ~FileDiskManager();
+    FileDiskManager(const FileDiskManager&) = delete;
+    FileDiskManager& operator=(const FileDiskManager&) = delete;
     //read page into dst give pageId
     void ReadPage(int pageId, char* dst);
-    //write a page into disk given pageId
+    //write a page into disk given pageId (not durable until Sync)
     void WritePage(int pageId, const char* src);
-    //create a new page and fill it with 0's
+    //force every written page down to stable storage
+    void Sync();
+    //hand out the next page id, the page reads as zeroes until it is written
     int NewPageId();
+    //shrink the file to numPages pages, later NewPageId calls reuse the ids
+    void Truncate(int numPages);
     int GetNumPages() const { return nextPageId; }
+    DiskMode GetMode() const { return mode; }
+    bool IsMapped() const { return mode == DiskMode::Mmap; }
+    void SetJournal(LogManager* j) { journal = j; }
+    LogManager* GetJournal() const { return journal; }
+    // pointer to the page inside the mapping (Mmap mode only)
+    char* GetMappedPage(int pageId) const {
+        return mapBase + static_cast<long long>(pageId) * PAGE_SIZE;
+    }
+    // page sized buffer aligned for direct I/O, release with FreeAlignedPage
+    static char* AllocAlignedPage();
+    static void FreeAlignedPage(char* p);
+    /* one aligned block for all frames of a buffer pool; bytes is rounded up
+    to whole huge pages when they are asked for. hugePages tries reserved huge
+    pages (MAP_HUGETLB) and falls back to transparent huge pages, it is left
+    true only if reserved ones were mapped. Release with FreeFrameArena */
+    static char* AllocFrameArena(long long& bytes, bool& hugePages);
+    static void FreeFrameArena(char* p, long long bytes);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,17 @@
+/* Key search inside a B+ tree node. Internal nodes hold up to a couple of
+thousand sorted keys, so the child to follow is found with a branch-free
+binary search that narrows the range to a small window and then counts the
+keys in that window with SIMD compares. The vector width (AVX2, SSE2 or none)
+is picked once at startup from what the CPU supports. */
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+// index of the first of keys[0, n) that is greater than key (the child to descend into)
+int keyUpperBound(const int* keys, int n, int key);
+// the variants behind keyUpperBound, exposed for benchmarks
+int keyUpperBoundScalar(const int* keys, int n, int key);
+int keyUpperBoundBinary(const int* keys, int n, int key);
+// name of the variant keyUpperBound uses on this CPU
+const char* keySearchName();
+
+#endif
@@ -0,0 +1,123 @@
+/* Write-ahead log for the B+ tree.
+Inserts and removes are appended as redo records to <base>.wal and made
+durable with group commit, so data pages can be written back lazily.
+A checkpoint flushes every dirty page and empties the log. To make sure
+recovery replays on top of exactly the checkpointed tree, the first time
+a page from the checkpoint is overwritten its old image is saved to
+<base>.jnl; after a crash those images are copied back before replay. */
+#ifndef LOG_MANAGER_H
+#define LOG_MANAGER_H
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <cstdint>
+#include "FileDiskManager.h"
+#include "bPlusTree.h"
+using namespace std;
+
+/* when log records reach stable storage
+   Off:   records are written when the buffer fills, never fsynced (the
+          checkpoint journal still is, so a crash only loses operations)
+   Batch: group commit, one fsync per WAL_GROUP_SIZE records or Commit()
+   PerOp: every record is fsynced before the operation returns */
+enum class WalSyncMode {
+    Off,
+    Batch,
+    PerOp
+};
+
+// records per group commit in Batch mode
+static const int WAL_GROUP_SIZE = 256;
+// log size that triggers a checkpoint
+static const long long WAL_CHECKPOINT_BYTES = 32LL * 1024 * 1024;
+
+enum class LogType : uint8_t {
+    Insert = 1,
+    Remove = 2
+};
+
+// on-disk record: header followed by the payload
+struct LogRecordHeader {
+    uint32_t size;      // payload bytes
+    uint32_t checksum;  // covers lsn, type, size and payload
+    uint64_t lsn;
+    uint8_t  type;
+    uint8_t  pad[7];
+};
+
+// decoded record handed to Replay
+struct LogRecord {
+    uint64_t lsn;
+    LogType  type;
+    string   key;
+    foodItem item;     // only set for Insert
+};
+
+class LogManager {
+public:
+    LogManager(const string& basePath, FileDiskManager* disk,
+        WalSyncMode mode = WalSyncMode::Batch);
+    ~LogManager();
+    LogManager(const LogManager&) = delete;
+    LogManager& operator=(const LogManager&) = delete;
+
+    // append redo records, returns the record's lsn
+    uint64_t LogInsert(const string& key, const foodItem& item);
+    uint64_t LogRemove(const string& key);
+    // group commit: write and fsync everything appended so far
+    void Commit();
+    bool NeedsCheckpoint() const { return logBytes >= WAL_CHECKPOINT_BYTES; }
+    /* called after all dirty pages were flushed and synced: the data file
+       is the new checkpoint so the journal and the log start over */
+    void CheckpointComplete();
+
+    /* save the checkpoint image of a page before it is overwritten (called by
+       the disk manager, and by the pool before a write in mmap mode), safe to
+       call from several threads */
+    void SaveBeforeImage(int pageId);
+    // same for every page a truncate would cut off
+    void SaveBeforeTruncate(int numPages);
+
+    /* crash recovery, step 1 (before the tree is opened): copy journaled
+       images back so the data file is the last checkpoint again */
+    bool RestoreCheckpoint();
+    // step 2: feed every intact log record to apply, returns the count
+    long long Replay(const function<void(const LogRecord&)>& apply);
+
+    WalSyncMode GetSyncMode() const { return mode; }
+    void SetSyncMode(WalSyncMode m) { mode = m; }
+    long long GetSyncCount() const { return syncs; }
+
+private:
+    string walPath;
+    string journalPath;
+    FileDiskManager* disk;
+    WalSyncMode mode;
+    int walFd;
+    int journalFd;
+    // records not yet handed to the OS
+    vector<char> buffer;
+    int pendingRecords;
+    uint64_t nextLsn;
+    long long logBytes;
+    long long syncs;
+    // page count at the checkpoint, newer pages are simply truncated away
+    int checkpointPages;
+    // pages whose checkpoint image is already in the journal
+    unordered_set<int> journaled;
+    // serializes journal appends and resets, they share journaled, scratch and the file offset
+    mutex journalLatch;
+    // aligned page buffer for journal reads and writes
+    char* scratch;
+    // set while journal images are copied back, those writes are not journaled
+    bool restoring;
+
+    uint64_t Append(LogType type, const string& key, const foodItem* item);
+    void WriteBuffer();
+    void ResetJournal();
+};
+
+#endif
@@ -0,0 +1,96 @@
+/* Maps resident page ids to their frames for one buffer pool shard.
+Open addressing with linear probing in a flat array sized once for the
+shard (at least twice its frame count, rounded to a power of two), so the
+table never fills past half, never grows and a hit or a miss never
+allocates. The home slot is the id (divided by the shard stride) scrambled
+by a Fibonacci multiply: taking the id modulo the capacity would lay a
+window of sequential pages out as one unbroken run, and every erase would
+then walk the whole run. Erase shifts the following entries back instead
+of leaving tombstones, so probe runs stay short however often pages come and go. */
+#ifndef PAGE_TABLE_H
+#define PAGE_TABLE_H
+
+#include <vector>
+#include <cstdint>
+#include "pageFrameList.h"
+
+class PageTable
+{
+public:
+    explicit PageTable(int maxEntries = 0, int stride = 1) { Reset(maxEntries, stride); }
+    /* empty the table and size it for up to maxEntries pages; a shard of
+    n shards only sees ids with the same remainder, stride n skips the gaps */
+    void Reset(int maxEntries, int stride = 1)
+    {
+        int cap = 8;
+        while (cap < 2 * maxEntries) cap *= 2;
+        slots.assign(cap, Slot{ EMPTY, nullptr });
+        mask = static_cast<uint32_t>(cap - 1);
+        shift = 32;
+        for (int c = cap; c > 1; c /= 2) shift--;
+        this->stride = stride > 0 ? stride : 1;
+        count = 0;
+    }
+    // frame holding pageId, nullptr if it is not resident
+    PageFrame* Find(int pageId) const
+    {
+        for (uint32_t i = Home(pageId);; i = (i + 1) & mask) {
+            if (slots[i].pageId == pageId) return slots[i].frame;
+            if (slots[i].pageId == EMPTY) return nullptr;
+        }
+    }
+    // pageId must not be in the table yet
+    void Insert(int pageId, PageFrame* f)
+    {
+        uint32_t i = Home(pageId);
+        while (slots[i].pageId != EMPTY) i = (i + 1) & mask;
+        slots[i] = Slot{ pageId, f };
+        count++;
+    }
+    void Erase(int pageId)
+    {
+        uint32_t i = Home(pageId);
+        while (slots[i].pageId != pageId) {
+            if (slots[i].pageId == EMPTY) return;
+            i = (i + 1) & mask;
+        }
+        // pull later entries of the run back so no lookup stops early at the hole
+        for (uint32_t j = (i + 1) & mask; slots[j].pageId != EMPTY; j = (j + 1) & mask) {
+            uint32_t home = Home(slots[j].pageId);
+            // entry j may move to i only if its home is not in (i, j]
+            bool between = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+            if (between) continue;
+            slots[i] = slots[j];
+            i = j;
+        }
+        slots[i] = Slot{ EMPTY, nullptr };
+        count--;
+    }
+    void Clear()
+    {
+        slots.assign(slots.size(), Slot{ EMPTY, nullptr });
+        count = 0;
+    }
+    int Size() const { return count; }
+
+private:
+    // page ids are never negative
+    static constexpr int EMPTY = -1;
+    // key and value side by side, a probe touches one cache line
+    struct Slot {
+        int pageId;
+        PageFrame* frame;
+    };
+    std::vector<Slot> slots;
+    uint32_t mask;
+    int shift;
+    int stride;
+    int count;
+    uint32_t Home(int pageId) const
+    {
+        // 2^32 / golden ratio; the top bits of the product pick the slot
+        return (static_cast<uint32_t>(pageId / stride) * 2654435769u) >> shift;
+    }
+};
+
+#endif
@@ -0,0 +1,202 @@
+/* Page replacement policies for the buffer pool.
+The pool reports every access to a frame and asks the policy for a victim
+when it needs a frame and none is unused. Frames enter the policy's set of
+eviction candidates when their pin count drops to zero (UnpinPage) and
+leave it when they are pinned again, so a policy only ever returns a frame
+that is not pinned and never has to look at the rest of the pool. */
+#ifndef REPLACEMENT_POLICY_H
+#define REPLACEMENT_POLICY_H
+
+#include <vector>
+#include <list>
+#include <utility>
+#include <unordered_map>
+#include "pageFrameList.h"
+using namespace std;
+
+enum class ReplacementType {
+    FIFO,   // evict the page that was loaded first
+    LRU,    // evict the least recently used page
+    CLOCK,  // second chance approximation of LRU
+    LRUK,   // evict pages seen fewer than K times first, then the least recently used
+    TwoQ    // new pages wait in a FIFO queue, re-referenced pages move to an LRU queue
+};
+
+// K for LRU-K
+static const int LRU_K = 2;
+/* LRU-K correlated reference period, in fetches: a page fetched again this
+soon (e.g. a leaf found by findLeafPage and then loaded) counts as one access */
+static const long long LRU_K_CRP = 2;
+
+/* doubly linked list of frame ids, links live in arrays indexed by frameId
+so insert, unlink and membership are O(1) and never allocate */
+class FrameIdList
+{
+public:
+    explicit FrameIdList(int n) : prev(n, -1), next(n, -1), linked(n, 0), head(-1), tail(-1), count(0) {}
+    int Front() const { return head; }
+    int Back() const { return tail; }
+    int Next(int id) const { return next[id]; }
+    int Prev(int id) const { return prev[id]; }
+    bool Contains(int id) const { return linked[id] != 0; }
+    int Size() const { return count; }
+    void PushBack(int id)
+    {
+        prev[id] = tail;
+        next[id] = -1;
+        if (tail != -1) next[tail] = id;
+        else head = id;
+        tail = id;
+        linked[id] = 1;
+        count++;
+    }
+    void PushFront(int id)
+    {
+        prev[id] = -1;
+        next[id] = head;
+        if (head != -1) prev[head] = id;
+        else tail = id;
+        head = id;
+        linked[id] = 1;
+        count++;
+    }
+    void Remove(int id)
+    {
+        if (!linked[id]) return;
+        if (prev[id] != -1) next[prev[id]] = next[id];
+        else head = next[id];
+        if (next[id] != -1) prev[next[id]] = prev[id];
+        else tail = prev[id];
+        prev[id] = next[id] = -1;
+        linked[id] = 0;
+        count--;
+    }
+
+private:
+    vector<int> prev;
+    vector<int> next;
+    vector<char> linked;
+    int head;
+    int tail;
+    int count;
+};
+
+class ReplacementPolicy {
+public:
+    virtual ~ReplacementPolicy() {}
+    // page in f was accessed (f is pinned), newlyLoaded is true right after a miss
+    virtual void RecordAccess(PageFrame* f, bool newlyLoaded) = 0;
+    // pin count of f dropped to zero (true) or left zero (false)
+    virtual void SetEvictable(PageFrame* f, bool evictable) = 0;
+    // unpinned frame to evict, nullptr if every frame is pinned
+    virtual PageFrame* Victim() = 0;
+    // frame was emptied without being evicted (page discarded)
+    virtual void Remove(PageFrame* f) = 0;
+    // up to n unpinned frames in the order Victim would pick them, nothing is changed
+    virtual void NextVictims(int n, vector<PageFrame*>& out) const = 0;
+    virtual const char* Name() const = 0;
+
+    // frames are indexed by PageFrame::frameId
+    static ReplacementPolicy* Create(ReplacementType type, const vector<PageFrame*>& frames);
+};
+
+class FIFOPolicy : public ReplacementPolicy {
+public:
+    explicit FIFOPolicy(const vector<PageFrame*>& frames);
+    void RecordAccess(PageFrame* f, bool newlyLoaded) override;
+    void SetEvictable(PageFrame* f, bool evictable) override;
+    PageFrame* Victim() override;
+    void Remove(PageFrame* f) override;
+    void NextVictims(int n, vector<PageFrame*>& out) const override;
+    const char* Name() const override { return "FIFO"; }
+private:
+    vector<PageFrame*> frames;
+    /* resident frames in load order; pinned frames stay in place and are
+    skipped, which costs at most the handful of pages a tree operation
+    holds pinned, never a walk over the pool */
+    FrameIdList loadOrder;
+};
+
+class LRUPolicy : public ReplacementPolicy {
+public:
+    explicit LRUPolicy(const vector<PageFrame*>& frames);
+    void RecordAccess(PageFrame* f, bool newlyLoaded) override;
+    void SetEvictable(PageFrame* f, bool evictable) override;
+    PageFrame* Victim() override;
+    void Remove(PageFrame* f) override;
+    void NextVictims(int n, vector<PageFrame*>& out) const override;
+    const char* Name() const override { return "LRU"; }
+private:
+    vector<PageFrame*> frames;
+    // unpinned frames, least recently released first
+    FrameIdList candidates;
+};
+
+class ClockPolicy : public ReplacementPolicy {
+public:
+    explicit ClockPolicy(const vector<PageFrame*>& frames);
+    void RecordAccess(PageFrame* f, bool newlyLoaded) override;
+    void SetEvictable(PageFrame* f, bool evictable) override;
+    PageFrame* Victim() override;
+    void Remove(PageFrame* f) override;
+    void NextVictims(int n, vector<PageFrame*>& out) const override;
+    const char* Name() const override { return "CLOCK"; }
+private:
+    vector<PageFrame*> frames;
+    // the ring only holds unpinned frames, the hand is the front
+    FrameIdList ring;
+    vector<char> referenced;
+};
+
+class LRUKPolicy : public ReplacementPolicy {
+public:
+    explicit LRUKPolicy(const vector<PageFrame*>& frames);
+    void RecordAccess(PageFrame* f, bool newlyLoaded) override;
+    void SetEvictable(PageFrame* f, bool evictable) override;
+    PageFrame* Victim() override;
+    void Remove(PageFrame* f) override;
+    void NextVictims(int n, vector<PageFrame*>& out) const override;
+    const char* Name() const override { return "LRU-K"; }
+private:
+    vector<PageFrame*> frames;
+    // accesses since the frame got its page, counted up to K
+    vector<int> accesses;
+    // time of the latest access, for the correlated reference period
+    vector<long long> lastAccess;
+    long long clock;
+    /* unpinned frames split by history as 2Q splits A1in and Am, each list
+    least recently used first: pages seen fewer than K times are evicted
+    before any page seen K times. Within the K list pages are ordered by
+    their latest access rather than their K-th latest, which keeps every
+    update O(1) without a sorted structure */
+    FrameIdList cold;
+    FrameIdList hot;
+    void Link(int frameId);
+};
+
+class TwoQPolicy : public ReplacementPolicy {
+public:
+    explicit TwoQPolicy(const vector<PageFrame*>& frames);
+    void RecordAccess(PageFrame* f, bool newlyLoaded) override;
+    void SetEvictable(PageFrame* f, bool evictable) override;
+    PageFrame* Victim() override;
+    void Remove(PageFrame* f) override;
+    void NextVictims(int n, vector<PageFrame*>& out) const override;
+    const char* Name() const override { return "2Q"; }
+private:
+    vector<PageFrame*> frames;
+    // A1in: FIFO of pages seen once, pinned frames are skipped as in FIFOPolicy
+    FrameIdList a1in;
+    // Am: LRU of re-referenced pages, only unpinned frames are linked
+    FrameIdList amCandidates;
+    // where each frame currently sits (0 = none, 1 = A1in, 2 = Am)
+    vector<int> queueOf;
+    // A1out: ghost entries (page ids only) recently evicted from A1in
+    list<int> a1out;
+    unordered_map<int, list<int>::iterator> a1outIndex;
+    int kin;
+    size_t kout;
+    void Unlink(PageFrame* f);
+};
+
+#endif
@@ -1,20 +1,81 @@
 /*Page based B+ tree implementation that stores page information in bytes in given file.
-Maximum children and keys are determined by order and certain parameters are only present
-when the page is internal or external. The leaf nodes hold object data, pointers the new leaf
-over, and a bloom filter*/
+Leaf and internal nodes have page formats of their own, each sized from PAGE_SIZE.
+A leaf is a slotted page: a sorted slot directory over variable length records packed
+down from the end of the page, the key prefix its whole range shares kept once, the
+next leaf over and a bloom filter. An internal page keeps separator heads, child ids and
+the record count under each child in arrays, and the rest of each separator packed at
+the end of the page, so one node has room for about a thousand children*/
 #ifndef BPLUSTREE_PAGED_H
 #define BPLUSTREE_PAGED_H
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include <utility>
 #include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
 #include "FileDiskManager.h"
 #include "BufferPool.h"
 #include "BloomFilter.h"
 using namespace std;
 
-// alphabetical key method to turn a string into a 32 bit int
-int alphabeticalKey32(const std::string& s);
+class LogManager;
+
+/* keys are byte strings in memcmp order, at most MAX_KEY_BYTES long: longer
+   ones are refused by insert and never found. Nodes keep the first
+   KEY_HEAD_BYTES of every key as an int head that compares in the same order,
+   so most comparisons are a single int compare and only keys with equal heads
+   compare the bytes after them */
+static const int MAX_NAME_BYTES = 128;
+// room for the key of a name of MAX_NAME_BYTES, see foodKey
+static const int MAX_KEY_BYTES = MAX_NAME_BYTES + 1 + (MAX_NAME_BYTES + 7) / 8;
+static const int KEY_HEAD_BYTES = 4;
+// head of a key: its first bytes big-endian, zero padded, with the sign bit flipped
+int keyHead(const char* key, int len);
+/* order-preserving key of a food name: the name upper-cased, a zero byte, then
+   one bit per byte of the name (first byte highest) set where it was a
+   lower-case letter. Names sort and match prefixes regardless of case, while
+   the key still holds the exact bytes of the name, so names that only differ
+   in case get keys of their own. A name is never cut: one longer than
+   MAX_NAME_BYTES gets a key longer than MAX_KEY_BYTES, which the tree refuses */
+std::string foodKey(const std::string& name);
+// the start shared by the keys of every name that begins with namePrefix, in any case
+std::string foodKeyPrefix(const std::string& namePrefix);
+// order-preserving key of an int: 4 bytes whose head is the int itself
+std::string intKey(int value);
+// the largest key, the inclusive end of a scan over everything
+const std::string& maxKey();
+// inclusive end of the keys that start with prefix
+std::string prefixEnd(const std::string& prefix);
+// number of bytes a and b start with in common
+int commonPrefix(const std::string& a, const std::string& b);
+/* the shortest key above left and not above right (left < right): right cut
+   just past the first byte where the two differ, used as a separator */
+std::string shortestSeparator(const std::string& left, const std::string& right);
+
+// a key handed to a node: its bytes (which the caller keeps alive) and its head
+struct KeyRef {
+    const char* data;
+    int len;
+    int head;
+    explicit KeyRef(const std::string& key)
+        : data(key.data()),
+        len(key.size() < static_cast<size_t>(MAX_KEY_BYTES) ? static_cast<int>(key.size()) : MAX_KEY_BYTES),
+        head(keyHead(key.data(), len)) {
+    }
+    KeyRef(const char* bytes, int n)
+        : data(bytes), len(n < MAX_KEY_BYTES ? n : MAX_KEY_BYTES), head(keyHead(bytes, len)) {
+    }
+};
+/* three-way comparison of a stored key, given as its head, the bytes after the
+   head and its length, with key */
+int compareKey(int head, const char* tail, int len, const KeyRef& key);
+// bytes of a key kept after its head
+inline int keyTailBytes(int len) {
+    return len > KEY_HEAD_BYTES ? len - KEY_HEAD_BYTES : 0;
+}
 
 // food Item object to be stored in the page
 struct foodItem {
@@ -53,59 +114,341 @@ struct foodItem {
     }
 };
 
-// B+ TREE ORDER for determining Keys/children
-//The actual order value is max children. order is just a alias for t/min children
-static const int ORDER = 15;
-static const int MAX_KEYS = 2 * ORDER;
-static const int MAX_CHILDREN = 2 * ORDER + 1;
+/* B+ TREE node capacity for determining Keys/children
+Leaves and internal nodes have their own page layouts, each sized from PAGE_SIZE.
+Keys differ in length, so both are filled by bytes: a node takes entries while
+they fit and keeps at least about half of its bytes (the root excepted) */
+// share of a node bulkLoad fills, the rest is left for later inserts
+static const double DEFAULT_FILL_FACTOR = 0.9;
+
+// identifies the CSV a tree file was built from so a stale file can be detected
+struct DataSource {
+    long long bytes;
+    long long mtime;
+    char      name[128];
+};
+
+// header page format, bump TREE_FORMAT_VERSION whenever a page layout or the key encoding changes
+static const unsigned TREE_MAGIC = 0x31424446u; // "FDB1"
+static const int TREE_FORMAT_VERSION = 7;
 
 // stores bp header information for persistence information
 struct BPTreeHeader {
     int rootPageId;
     int hasRoot;
+    int freeListHead;   // first page of the free-page list (-1 if empty)
+    int freePageCount;  // number of pages on the free-page list
+    // validation: the file has to match this build's page layout
+    unsigned magic;
+    int version;
+    int pageSize;
+    int leafBytes;
+    int internalBytes;
+    int cleanShutdown;  // 0 while the file is open, 1 after close()
+    DataSource source;
 };
 
-/* page holds information to distinguish leaf from internal
-   and also Bloom filter data */
-struct NodePage {
+/* pages released by merges are chained into a doubly linked free list
+   so they can be reused (or trimmed off the end of the file) */
+static const unsigned FREE_PAGE_MAGIC = 0x45455246u; // "FREE"
+struct FreePageHeader {
+    unsigned magic;
+    int prevFree;
+    int nextFree;
+};
+
+/* every node page starts with this, so a page can be told leaf from internal
+   before it is cast to its layout; size counts keys in both */
+struct NodeHeader {
     bool isLeaf;
     int  size;
-    int keys[MAX_KEYS];
-    foodItem items[MAX_KEYS];
+};
+/* leaf page: a slot directory sorted by key grows up from the fixed fields and
+   the records it points to are packed down from the end of the page, so keeping
+   keys in order only moves 8 byte slots and a record takes only the bytes its
+   name needs. Removed records leave dead bytes until the page is compacted.
+   The bytes that every key in the leaf's range starts with (the common prefix
+   of the separators around it) are kept once in the page, and records and
+   slots hold only the rest of each key. The prefix follows from the range, so
+   a key inserted later always has it and it never has to shrink */
+struct LeafSlot {
+    int      head;     // keyHead() of the key after the page prefix
+    uint16_t offset;   // record position in the page
+    uint16_t length;   // record bytes
+};
+/* record on a leaf page: these fields, a byte with the length of the key after
+   the page prefix, those key bytes after the head, then the name without its
+   terminator */
+struct LeafRecord {
+    int    proteinAmt;
+    int    calorieAmt;
+    double cost;
+};
+struct LeafPage : NodeHeader {
     int nextLeaf;
-    int children[MAX_CHILDREN];
+    int heapStart;       // records fill [heapStart, PAGE_SIZE)
+    int deadBytes;       // record bytes freed in the heap but not reclaimed yet
+    int prefixLen;       // bytes of prefix every key on the page starts with
+    char prefix[MAX_KEY_BYTES];
     BloomFilter bloom;   // embedded Bloom filter
+
+    // empty leaf with no next leaf and no prefix
+    void init();
+    // set the prefix of an empty leaf
+    void setPrefix(const char* bytes, int len);
+    // prefixLen, kept inside the prefix buffer for readers that race a writer
+    int prefixBytes() const;
+    std::string key(int i) const;
+    // copy key i into out (MAX_KEY_BYTES), returns its length
+    int keyBytes(int i, char* out) const;
+    foodItem item(int i) const;
+    // three-way comparison of key i with key
+    int compareAt(int i, const KeyRef& key) const;
+    /* size, but never more slots than the page holds: a reader that races a
+       writer may see a torn page and must not step outside it */
+    int slotCount() const;
+    // first slot whose key is >= key
+    int lowerBound(const KeyRef& key) const;
+    // bytes taken by slots and live records
+    int usedBytes() const;
+    /* put a record in at slot i, false if the page does not have room for it
+       (or key does not start with the prefix) */
+    bool insertAt(int i, const KeyRef& key, const foodItem& item);
+    // overwrite the record at slot i, false if the page does not have room for it
+    bool replaceAt(int i, const foodItem& item);
+    void eraseAt(int i);
+    // append every entry in key order
+    void collect(vector<pair<string, foodItem>>& out) const;
+    // page bytes an entry with keyLen key bytes after the prefix takes, slot included
+    static int entryBytes(int keyLen, const foodItem& item);
+    // the slot directory starts right after the fixed fields
+    LeafSlot* slots() { return reinterpret_cast<LeafSlot*>(this + 1); }
+    const LeafSlot* slots() const { return reinterpret_cast<const LeafSlot*>(this + 1); }
+private:
+    // -1 or 1 if key sorts below or above every key that starts with the prefix, else 0
+    int comparePrefix(const KeyRef& key) const;
+    // three-way comparison of key i with rest, a key with the prefix taken off
+    int compareSuffix(int i, const KeyRef& rest) const;
+    void writeRecord(int offset, const char* tail, int keyLen, const foodItem& item, int length);
+    // move the live records together at the end of the page
+    void compact();
+};
+// a child of an internal node with the separator left of it (empty for the first child)
+struct InternalEntry {
+    std::string key;
+    int child;
+    int count;
+};
+// where an internal page keeps the bytes of a separator after its head
+struct InternalTail {
+    uint16_t offset;
+    uint16_t length;   // the whole key length
+};
+/* internal page: separator keys, child page ids and the number of records
+   under each child, so counts and positions are found on the way down. The
+   arrays follow the fixed fields, sized by capacity: the key heads first, so
+   the child search runs over one int array, then children, counts and where
+   the rest of each separator is; those bytes are packed down from the end of
+   the page. Separator i is above every key under child i and at most the
+   smallest under child i + 1, cut to the fewest bytes that tell the two apart */
+struct InternalPage : NodeHeader {
+    int capacity;    // keys the arrays have room for
+    int heapStart;   // separator bytes fill [heapStart, PAGE_SIZE)
+    int deadBytes;   // separator bytes freed but not reclaimed yet
+
+    // no keys, capacity for as many as the page can hold
+    void init();
+    int* heads() { return reinterpret_cast<int*>(this + 1); }
+    const int* heads() const { return reinterpret_cast<const int*>(this + 1); }
+    int* children() { return heads() + capacity; }
+    const int* children() const { return heads() + arrayCapacity(); }
+    int* counts() { return children() + capacity + 1; }
+    const int* counts() const { return children() + arrayCapacity() + 1; }
+    InternalTail* tails() { return reinterpret_cast<InternalTail*>(counts() + capacity + 1); }
+    const InternalTail* tails() const { return reinterpret_cast<const InternalTail*>(counts() + arrayCapacity() + 1); }
+    /* size and capacity, but never more than the page holds: a reader that
+       races a writer may see a torn page and must not step outside it */
+    int keyCount() const;
+    int arrayCapacity() const;
+    std::string key(int i) const;
+    // three-way comparison of separator i with key
+    int compareAt(int i, const KeyRef& key) const;
+    // the child to descend into for key: the first separator greater than key
+    int upperBound(const KeyRef& key) const;
+    // the first separator >= key: its child is the last that can hold keys below key
+    int lowerBound(const KeyRef& key) const;
+    // bytes taken by the keys, children and counts
+    int usedBytes() const;
+    // put separator i in with child i + 1 right of it, false if the page does not have room
+    bool insertAt(int i, const KeyRef& key, int child, int count);
+    // take separator i and child i + 1 out
+    void eraseAt(int i);
+    // change separator i, false if the page does not have room for it
+    bool replaceKeyAt(int i, const KeyRef& key);
+    // append every child with the separator left of it
+    void collect(vector<InternalEntry>& out) const;
+    // replace the node's children with entries [from, to), the first entry's key is dropped
+    void fill(const vector<InternalEntry>& entries, int from, int to);
+    // page bytes a separator and the child right of it take
+    static int entryBytes(int keyLen);
+    // records under the whole node
+    long long total() const;
+};
+// bytes a leaf has for slots and records, and the most one entry can take
+static const int LEAF_CAPACITY = PAGE_SIZE - static_cast<int>(sizeof(LeafPage));
+static const int LEAF_MAX_ENTRY_BYTES = static_cast<int>(sizeof(LeafSlot) + sizeof(LeafRecord) + 1
+    + (MAX_KEY_BYTES - KEY_HEAD_BYTES) + sizeof(foodItem::foodName) - 1);
+/* a leaf under this many bytes is merged or rebalanced with a sibling;
+   two leaves that cannot share records always fit in one page */
+static const int LEAF_MIN_BYTES = (LEAF_CAPACITY - LEAF_MAX_ENTRY_BYTES) / 2;
+/* bytes an internal node has for its separators: a separator with the child
+   right of it takes a head, a child id, a count and a tail entry, plus its
+   bytes after the head; the first child and its count are set aside */
+static const int INTERNAL_SLOT_BYTES = static_cast<int>(3 * sizeof(int) + sizeof(InternalTail));
+static const int INTERNAL_CAPACITY = PAGE_SIZE - static_cast<int>(sizeof(InternalPage) + 2 * sizeof(int));
+// most separators one internal node can hold (keys of at most KEY_HEAD_BYTES)
+static const int INTERNAL_MAX_KEYS = INTERNAL_CAPACITY / INTERNAL_SLOT_BYTES;
+static const int INTERNAL_MAX_ENTRY_BYTES = INTERNAL_SLOT_BYTES + MAX_KEY_BYTES - KEY_HEAD_BYTES;
+// as LEAF_MIN_BYTES, for internal nodes
+static const int INTERNAL_MIN_BYTES = (INTERNAL_CAPACITY - INTERNAL_MAX_ENTRY_BYTES) / 2;
+static_assert(PAGE_SIZE <= 65536, "ERROR: leaf slot offsets are 16 bit");
+static_assert(MAX_KEY_BYTES <= 255, "ERROR: leaf records keep the key length in a byte");
+static_assert(LEAF_CAPACITY >= 2 * LEAF_MAX_ENTRY_BYTES && INTERNAL_CAPACITY >= 4 * INTERNAL_MAX_ENTRY_BYTES,
+    "ERROR: node page too small for the largest keys  increase PAGE_SIZE!");
+
+class BPlusTreePaged;
+
+enum class ScanOrder {
+    Ascending,  // lowest key first
+    Descending  // highest key first
+};
+
+/* cursor over the records with keys in a range, in key order either way. It
+   pins only the leaf it is on and copies that leaf's records of the range out,
+   so it never holds writers up; if the leaf changed by the time the cursor moves
+   on, it finds its place again from the root. No leaf is read once the limit is
+   reached. Stop at any point, the pin goes with the cursor */
+class RangeCursor {
+public:
+    RangeCursor(RangeCursor&& other) noexcept;
+    RangeCursor(const RangeCursor&) = delete;
+    RangeCursor& operator=(const RangeCursor&) = delete;
+    RangeCursor& operator=(RangeCursor&&) = delete;
+    ~RangeCursor() { close(); }
+    // false once every record of the range has been returned
+    bool valid() const { return pos < entries.size(); }
+    const std::string& key() const { return entries[pos].first; }
+    const foodItem& item() const { return entries[pos].second; }
+    void next();
+    // let go of the leaf before the cursor goes out of scope
+    void close();
+private:
+    friend class BPlusTreePaged;
+    RangeCursor(const BPlusTreePaged* tree, const std::string& k1, const std::string& k2,
+        size_t limit, ScanOrder order);
+    const BPlusTreePaged* tree;
+    /* keys not returned yet, the range shrinks from the end the cursor reads
+       from: that end becomes the last key returned, made exclusive */
+    std::string from;
+    std::string to;
+    bool fromOpen;     // from itself is not in the range
+    bool toOpen;       // to itself is not in the range
+    bool reverse;
+    size_t remaining;  // records the limit still allows
+    bool done;         // no leaf left to read
+    // pinned leaf and the version its records were copied at
+    int  pageId;
+    PageFrame* frame;
+    uint64_t version;
+    vector<pair<string, foodItem>> entries;
+    size_t pos;
 };
-static_assert(sizeof(NodePage) <= PAGE_SIZE,
-    "ERROR: NodePage too large for PAGE_SIZE  increase PAGE_SIZE!");
 
 /* B+ paged based implementation
-   page/B+ tree node information is serialized into bytes and stored in a file */
+   page/B+ tree node information is serialized into bytes and stored in a file.
+   Safe to use from many threads: searches take no latches, they read a page
+   between two reads of its frame version and start over if it moved. Writers
+   that only change one leaf share the structure latch and lock that leaf;
+   splits, merges and whole-tree operations hold the latch exclusively and
+   lock (and keep pinned) every page they touch until they are done */
 class BPlusTreePaged {
 public:
     BPlusTreePaged(BufferPool* buffer, FileDiskManager* disk);
     // B+ tree  management methods
-    void insert(int key, const std::string& name, int protein, int calories, double cost);
-    bool remove(int key);
+    // false (and nothing stored) if key is longer than MAX_KEY_BYTES
+    bool insert(const std::string& key, const std::string& name, int protein, int calories, double cost);
+    bool remove(const std::string& key);
+    /* builds an empty tree bottom-up from records: they are sorted by key (the
+       last of equal keys wins, as with insert), leaves are packed to fillFactor
+       and written in chain order, then each internal level is built over the
+       one below. A tree that already has items gets the records one by one.
+       Records with keys over MAX_KEY_BYTES are dropped, as insert refuses them.
+       Returns the number of distinct keys loaded */
+    size_t bulkLoad(vector<pair<string, foodItem>>& records, double fillFactor = DEFAULT_FILL_FACTOR);
+    /* inserts many records at once: they are sorted by key (the last of equal
+       keys wins), each leaf takes all of its records under one lock and one
+       Bloom filter rebuild, and the path to it is reused by the next leaf.
+       An empty tree is bulk loaded. Keys over MAX_KEY_BYTES are dropped as
+       with bulkLoad. Returns the number of distinct keys */
+    size_t insertBatch(vector<pair<string, foodItem>>& records);
+    /* write-ahead log: replay the log onto the checkpointed tree, then
+       log every insert/remove from here on */
+    long long recoverFromLog(LogManager* wal);
+    // make every logged operation durable (group commit point)
+    void commit();
+    // flush all pages and start a new, empty log
+    void checkpoint();
+    /* warm start: an existing file is only used if its header matches this
+       build; the clean flag tells whether the last run called close() */
+    bool isValid() const { return valid; }
+    bool wasCleanShutdown() const { return openedClean; }
+    bool matchesSource(const DataSource& src) const;
+    void setSource(const DataSource& src);
+    // checkpoint and mark the file cleanly shut down
+    void close();
     //returns tree depth
     int computeTreeDepth() const;
     // search methods
     //returns true if key is present
-    bool search(int key, foodItem& out) const;
+    bool search(const std::string& key, foodItem& out) const;
     //returns all food items by key range
-    unordered_map<int, foodItem> rangeSearch(int k1, int k2) const;
+    unordered_map<string, foodItem> rangeSearch(const std::string& k1, const std::string& k2) const;
     //returns all items by character range
-    unordered_map<int, foodItem> rangeSearchByChar(char c1, char c2) const;
-    //search for all items with given prefix
-    vector<foodItem> prefixSearch(const std::string& prefix) const;
-    bool search_noBloom(int key, foodItem& out) const;
-    int findLeafPage(int key) const;
+    unordered_map<string, foodItem> rangeSearchByChar(char c1, char c2) const;
+    /* cursor over the items with keys in [k1, k2] / first letter in [c1, c2]:
+       offset items are passed over, then at most limit are returned. The
+       offset is found from the record counts without reading the rows before it */
+    RangeCursor scan(const std::string& k1, const std::string& k2, size_t limit = SIZE_MAX, size_t offset = 0,
+        ScanOrder order = ScanOrder::Ascending) const;
+    RangeCursor scanByChar(char c1, char c2, size_t limit = SIZE_MAX, size_t offset = 0,
+        ScanOrder order = ScanOrder::Ascending) const;
+    /* search for items with given prefix, in key order with an offset and a limit
+       as scan(); the keys of the prefix are one range, so only their leaves are read */
+    vector<foodItem> prefixSearch(const std::string& prefix, size_t limit = SIZE_MAX, size_t offset = 0,
+        ScanOrder order = ScanOrder::Ascending) const;
+    // number of items with given prefix, from the record counts
+    size_t prefixCount(const std::string& prefix) const;
+    /* order statistics off the record counts in internal nodes, a few page reads
+       each; while writers run they may be off by the changes still in flight */
+    // number of items in the tree (read from the root)
+    size_t count() const;
+    // number of items with keys in [k1, k2] / first letter in [c1, c2]
+    size_t countRange(const std::string& k1, const std::string& k2) const;
+    size_t countByChar(char c1, char c2) const;
+    // position key has or would have in key order: the number of smaller keys
+    size_t rank(const std::string& key) const;
+    // the item at position i in key order (from 0), false if there are not that many
+    bool select(size_t i, std::string& key, foodItem& out) const;
+    bool search_noBloom(const std::string& key, foodItem& out) const;
+    int findLeafPage(const std::string& key) const;
     int getFirstLeafPageId() const;
+    // leaf chain decoder for BufferPool read-ahead: nextLeaf of a leaf page, otherwise -1
+    static int leafChainLink(int pageId, const char* data);
 
     //display methods
     void printTree() const;
     //  testing methods
-    NodePage* loadNodeForTest(int pageId, PageFrame*& frame) const {
+    NodeHeader* loadNodeForTest(int pageId, PageFrame*& frame) const {
         return loadNode(pageId, frame);
     }
     void unpinForTest(int pageId, bool isDirty) const {
@@ -114,41 +457,165 @@ public:
     int getRootPageId() const {
         return rootPageId;
     }
+    int getFreePageCount() const {
+        return freePageCount;
+    }
 private:
     // page access/management
     BufferPool* buffer;
     FileDiskManager* disk;
-    // root information
-    int  rootPageId;
-    bool hasRoot;
+    // root information, read by searches without the structure latch
+    std::atomic<int>  rootPageId;
+    std::atomic<bool> hasRoot;
+    // free-page list information (mirrors the header page)
+    int  freeListHead;
+    int  freePageCount;
+    // redo log, nullptr when logging is off
+    LogManager* log;
+    // header validation and shutdown state
+    bool valid;
+    bool openedClean;
+    bool cleanShutdown;
+    DataSource source;
+    /* writers hold it shared to change the records of one leaf and exclusively
+       to change the shape of the tree; searches never take it */
+    mutable std::shared_mutex structureLatch;
+    // set under the exclusive latch: every page fetched is locked and pinned until unlatchTree()
+    mutable bool latchPages;
+    mutable vector<PageFrame*> latchedFrames;
+    /* set while a writer holds the exclusive latch: any page it fetches may
+       be changed, so each one goes through BufferPool::PrepareWrite */
+    bool writingPages;
+    // the log is appended to by writers that share the structure latch
+    mutable std::mutex logLatch;
     // header management
     void writeHeader(); // creates root page and adds header to root
     void loadHeader();  // loads existing header information for persistence
     //holds information for recursive operations
     struct InsertResult {
         bool split;
-        int  newKey;
+        string newKey;
         int  newRight;
-        InsertResult(bool s = false, int k = 0, int r = -1)
-            : split(s), newKey(k), newRight(r) {
+        bool added;       // a new key went in, not an overwrite
+        int  rightCount;  // records under newRight
+        InsertResult(bool s = false, const string& k = string(), int r = -1, bool a = false, int rc = 0)
+            : split(s), newKey(k), newRight(r), added(a), rightCount(rc) {
         }
     };
+    /* internal node on the way to a leaf, kept pinned: the child taken, the end
+       of its key range (if it has one) and whether its counts were changed */
+    struct PathNode {
+        int pageId;
+        PageFrame* frame;
+        int childIdx;
+        string upper;
+        bool bounded;
+        bool dirty;
+    };
     /* given a pageId return the Page Frame/Node Page from the file/buffer and
        cast that data back to the node page */
-    NodePage* loadNode(int pageId, PageFrame*& frame) const;
+    NodeHeader* loadNode(int pageId, PageFrame*& frame, AccessHint hint = AccessHint::Normal) const;
+    // the same for a page that is known to be a leaf or an internal node
+    LeafPage* loadLeaf(int pageId, PageFrame*& frame, AccessHint hint = AccessHint::Normal) const;
+    InternalPage* loadInternal(int pageId, PageFrame*& frame) const;
+    // every page access of a writer goes through here so it can be locked
+    PageFrame* fetchPage(int pageId, AccessHint hint = AccessHint::Normal) const;
+    // lock a frame's version for the rest of the exclusive operation
+    void latchFrame(PageFrame* frame) const;
+    // take the structure latch exclusively / release it and every locked page
+    void latchTree();
+    void unlatchTree();
+    /* latch free descent: the leaf for key comes back pinned with the version
+       it had, -1 if the tree is empty. With before set it is the leaf that
+       holds the keys just below key instead. lowerFence gets the separator
+       below which the leaf holds no keys, fenced whether there is one. The
+       leaf is fetched with hint, the internal nodes always as ordinary pages */
+    int optimisticLeaf(const std::string& key, PageFrame*& frame, uint64_t& version,
+        bool before = false, string* lowerFence = nullptr, bool* fenced = nullptr,
+        AccessHint hint = AccessHint::Normal) const;
+    /* descent under the shared structure latch, the leaf comes back pinned and
+       so do the internal nodes above it, in path */
+    int descendToLeaf(const KeyRef& key, PageFrame*& frame, vector<PathNode>& path) const;
+    /* add delta to the count of the child taken at every node of path: leaf
+       writers share the latch, so the adds are atomic */
+    void countOnPath(vector<PathNode>& path, int delta) const;
+    void unpinPath(vector<PathNode>& path) const;
+    // records under a page known to the caller
+    static long long nodeCount(const NodeHeader* node);
+    // number of keys below key (or not above it), latch free
+    size_t countBelow(const std::string& key, bool orEqual = false) const;
+    /* change a single leaf under the shared latch; false if the change needs a
+       split or a merge and has to be made under the exclusive latch */
+    bool tryLeafInsert(const std::string& key, const foodItem& item);
+    bool tryLeafRemove(const std::string& key, bool& removed);
+    bool searchLeaf(const std::string& key, foodItem& out, bool useBloom) const;
+    // checkpoint body, the caller holds the structure latch exclusively
+    void writeCheckpoint();
+    // checkpoint once the log has grown past its limit
+    void maybeCheckpoint();
+    // page allocation: reuse a page from the free list or grow the file
+    PageFrame* allocatePage(int& pid);
+    // put a page on the free list, or truncate the file if it is the last page
+    void freePage(int pid);
+    // true if pid is linked into the free list
+    bool isFreePage(int pid);
+    // take pid out of the free list given its links
+    void unlinkFreePage(int pid, int prevFree, int nextFree);
+    /* fetchPage for a page on the free list: searches never reach one, so it
+       is not locked, and a merge that trims the file end can walk any number */
+    PageFrame* fetchFreePage(int pid);
     // create leaf node with leaf only parameters
     int createLeafNode();
     //create leaf node with internal only parameters
     int createInternalNode();
     // Tree management Helpers
-    InsertResult insertRecursive(int pageId, int key, const foodItem& item);
-    bool deleteRecursive(int pageId, int key, bool& removed);
-    // Bloom filter helper (rebuild from node->keys[])
-    void rebuildBloom(NodePage* node);
+    // insert/remove without logging (used directly by log replay)
+    void applyInsert(const std::string& key, const foodItem& item);
+    bool applyRemove(const std::string& key);
+    /* both take the key range of pageId, [low, high], from the separators
+       above it so a leaf split or merge can give each leaf its prefix */
+    InsertResult insertRecursive(int pageId, const KeyRef& key, const foodItem& item,
+        const string& low, const string& high);
+    bool deleteRecursive(int pageId, const KeyRef& key, bool& removed, const string& low, const string& high);
+    /* rebalance the underfull child childIdx of parent with a sibling: merge the
+       two if they fit in one page, otherwise share their entries out evenly.
+       Returns true if the parent underflows in turn */
+    bool rebalanceChild(int pageId, InternalPage* parent, int childIdx, const string& low, const string& high);
+    // drop records with keys over MAX_KEY_BYTES, sort the rest and keep the last of equal keys, returns how many are left
+    static size_t sortRecords(vector<pair<string, foodItem>>& records);
+    // insertBatch body for sorted records with distinct keys
+    size_t insertSorted(const vector<pair<string, foodItem>>& records);
+    /* bulkLoad helper: split entries of the given weights into nodes of up to
+       per, none under minPer, and return the entry count of each node */
+    static vector<int> bulkGroups(const vector<int>& weights, int per, int minPer, int maxPer);
+    // entries of [from, from + count) that go to the first part of an even split
+    static int splitPoint(const vector<int>& weights, int from, int count);
+    // bulkLoad helper: the record count of each leaf, as bulkGroups
+    static vector<int> leafGroups(const vector<pair<string, foodItem>>& records, int per);
+    // page bytes of a leaf for the range [low, high] that holds entries [from, to)
+    static int leafBytes(const vector<pair<string, foodItem>>& entries, int from, int to,
+        const string& low, const string& high);
+    /* first entry of the right leaf when entries [from, to) of the range
+       [low, high] are split evenly by bytes, each leaf with its own prefix */
+    static int splitByBytes(const vector<pair<string, foodItem>>& entries, int from, int to,
+        const string& low, const string& high);
+    // entries that stay in the left node when entries are split by bytes
+    static int splitByBytes(const vector<InternalEntry>& entries);
+    /* replace a leaf's records with entries [from, to), keeping its nextLeaf;
+       the prefix comes from the leaf's range [low, high] */
+    void fillLeaf(LeafPage* leaf, const vector<pair<string, foodItem>>& entries, int from, int to,
+        const string& low, const string& high);
+    // Bloom filter helper (rebuild from the leaf's keys)
+    void rebuildBloom(LeafPage* node);
     // print helper
     void printNodeWithItems(int pageId, int depth) const;
-    // Helper for prefix search
-    static bool matchesPrefix(const std::string& prefix, const char* foodName);
+    // key range of the names whose first letter is in [c1, c2], in either case and either order
+    static void charKeyRange(char c1, char c2, string& k1, string& k2);
+    // key range of the names that start with prefix
+    static void prefixKeyRange(const std::string& prefix, string& k1, string& k2);
+    // RangeCursor helper: copy out the records of the next leaf that has any
+    friend class RangeCursor;
+    void advanceCursor(RangeCursor& c) const;
 
 };
 
@@ -19,8 +19,17 @@ bool parseCSVLine(const std::string& rawLine,
 // - trim spaces
 std::string normalizeName(std::string name);
 
-// Loads a CSV file into a B+ Tree.
-// Returns the number of successfully inserted rows.
-std::size_t loadCSVIntoTree(const std::string& path, BPlusTreePaged& tree);
+// Fills out the size/modification time/name of a CSV file so a tree
+// built from it can tell whether it is stale.
+// Returns false if the file does not exist.
+bool describeCSV(const std::string& path, DataSource& out);
+
+// Loads a CSV file into a B+ Tree: the rows are parsed first, then the
+// tree is bulk loaded with leaves packed to fillFactor.
+// Returns the number of items in the tree afterwards: rows with the same
+// name are stored once (the last one wins), so it can be less than the rows.
+// Rows with names longer than MAX_NAME_BYTES are skipped with a warning.
+std::size_t loadCSVIntoTree(const std::string& path, BPlusTreePaged& tree,
+    double fillFactor = DEFAULT_FILL_FACTOR);
 
 #endif
@@ -1,19 +1,44 @@
 #ifndef PAGE_FRAME_LIST_H
 #define PAGE_FRAME_LIST_H
 
+#include <atomic>
+#include <shared_mutex>
+#include <cstdint>
+
 struct PageFrame
 {
     int pageId;
-    int refCount;
+    // fixed position of the frame in its shard, used by the replacement policy
+    int frameId;
+    std::atomic<int> refCount;
     bool dirty;
+    // only fetched by scans so far, evicted ahead of the replacement policy
+    bool oneShot;
     char* data;
+    /* reader/writer latch on the page contents; the pool holds it exclusively
+    while the page is read from disk, callers may use it to guard the data */
+    std::shared_mutex latch;
+    /* set while the page is being read in or copied out by the background
+    writer, hits wait on the latch */
+    std::atomic<bool> loading;
+    // set while the background writer writes a copy of the page out
+    std::atomic<bool> writingBack;
+    /* optimistic version of the contents for the tree: bumped each time a tree
+    writer lets go of the page and each time the frame is given another page,
+    bit 0 is set while a writer holds it (the page stays pinned meanwhile) */
+    std::atomic<uint64_t> version;
     PageFrame* prev;
     PageFrame* next;
     PageFrame() {
         pageId = -1;
+        frameId = -1;
         refCount = 0;
         dirty = false;
+        oneShot = false;
         data = nullptr;
+        loading = false;
+        writingBack = false;
+        version = 0;
         prev = next = nullptr;
     }
 };
@@ -3,5 +3,56 @@
 #define TESTS_H
 void testBloomAllLeaves(BPlusTreePaged& tree, int trials);
 void TestElementAccessTime(BPlusTreePaged& tree);
+// Inserts, removes, batches and queries checked against a std::map, false on any mismatch (make bench)
+bool TestTreeAgainstMap();
+/* Behaviour checks, each prints PASS or FAIL and returns false on a failure
+   (make check, and make bench before the benchmarks) */
+bool TestMmapTruncate();
+bool TestReplacementPolicies();
+bool TestConcurrentFetches();
+bool TestLeafReadAhead();
+bool TestScanOneShot();
+bool TestBackgroundWriter();
+bool TestFrameArena();
+bool TestPageTable();
+bool TestCSVLoad();
+bool TestNodeLayout();
+bool TestSlottedLeaf();
+bool TestKeySearch();
+bool TestConcurrentTree();
+bool TestInsertBatch();
+bool TestRangeCursor();
+bool TestLetterRange();
+bool TestOrderStatistics();
+bool TestNameKeys();
+bool TestPrefixCompression();
+// Miss cost of the buffer pool for pool sizes from 10 to 100k frames (make bench)
+void BenchBufferPoolMisses();
+// Hit throughput of a shared buffer pool from 1 thread up to the core count (make bench)
+void BenchConcurrentFetches();
+// Cold full scan of a 200k item tree with read-ahead off and on (make bench)
+void BenchLeafScanReadAhead();
+// Hit rate of lookups of a few hot keys after a leaf walk with ordinary fetches and after forward, reverse and short scans (make bench)
+void BenchScanResistance();
+// search() tail latency while inserts dirty the pool, background writer off and on (make bench)
+void BenchSearchTailLatency();
+// Hit cost over a 256 MB frame arena with and without huge pages (make bench)
+void BenchFrameArena();
+// Hit lookup cost of unordered_map against the buffer pool's PageTable (make bench)
+void BenchPageTableLookup();
+// Build time, page count and fetches per lookup of a tree from insert() and from bulkLoad() (make bench)
+void BenchBulkLoad();
+// Time and fetches per row to add rows to a loaded tree with insert() and insertBatch() (make bench)
+void BenchInsertBatch();
+// Child lookup cost in a node for the linear loop, binary search and SIMD search (make bench)
+void BenchKeySearch();
+// Full count, first and last 50 rows and a page at an offset of a 1M item tree via rangeSearch() and RangeCursor (make bench)
+void BenchRangeCursor();
+// Time and page fetches of count(), countRange(), rank() and select() against a cursor count (make bench)
+void BenchOrderStatistics();
+// search() throughput of reader threads alone and next to a thread that inserts (make bench)
+void BenchConcurrentTree();
+// Pages, records per leaf, prefix and separator bytes of a tree of shared-prefix names, and a cold scan of it (make bench)
+void BenchKeyCompression();
 
 #endif
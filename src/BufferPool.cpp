@@ -1,155 +1,620 @@
 #include "BufferPool.h"
+#include "LogManager.h"
 #include <cstring>
+#include <chrono>
 
-BufferPool::BufferPool(int poolSize, FileDiskManager* dm)
+BufferPool::BufferPool(int poolSize, FileDiskManager* dm, ReplacementType policyType, int numShards,
+    bool hugePages)
 {
+    if (numShards < 1) numShards = 1;
+    if (numShards > poolSize) numShards = poolSize;
     this->poolSize = poolSize;
+    this->numShards = numShards;
     this->disk = dm;
+    chainLink = nullptr;
+    readAheadPages = 0;
+    ioStop = false;
+    cleanTarget = 0;
+    writerIntervalMs = BG_WRITER_INTERVAL_MS;
+    writerStop = false;
+    shards = new PoolShard[numShards];
 
-    // Create frames dynamically and link them
-    for (int i = 0; i < poolSize; i++)
+    /* in mmap mode frames point into the mapping and own no memory, otherwise
+    all frame data is one aligned block so direct I/O can read straight into
+    a frame and a large pool needs few TLB entries */
+    arena = nullptr;
+    arenaBytes = 0;
+    hugeFrames = false;
+    if (!disk->IsMapped())
     {
-        auto* f = new PageFrame();
-        f->data = new char[PAGE_SIZE];
-        frameList.PushBack(f);
+        arenaBytes = static_cast<long long>(poolSize) * PAGE_SIZE;
+        hugeFrames = hugePages;
+        arena = FileDiskManager::AllocFrameArena(arenaBytes, hugeFrames);
+    }
+
+    // frames are split into one contiguous run per shard
+    frameArray = new PageFrame[poolSize];
+    int next = 0;
+    for (int i = 0; i < numShards; i++)
+    {
+        PoolShard& s = shards[i];
+        int count = poolSize / numShards + (i < poolSize % numShards ? 1 : 0);
+        for (int j = 0; j < count; j++, next++)
+        {
+            PageFrame* f = &frameArray[next];
+            f->frameId = j;
+            if (arena)
+                f->data = arena + static_cast<long long>(next) * PAGE_SIZE;
+            frameList.PushBack(f);
+            s.frames.push_back(f);
+        }
+        s.policy = ReplacementPolicy::Create(policyType, s.frames);
+        s.oneShotFrames = FrameIdList(static_cast<int>(s.frames.size()));
+        // a shard never holds more pages than it has frames
+        s.pageTable.Reset(static_cast<int>(s.frames.size()), numShards);
+        // popped from the back, so frame 0 is handed out first
+        s.freeFrames.assign(s.frames.rbegin(), s.frames.rend());
     }
 }
 
 BufferPool::~BufferPool()
 {
+    DisableReadAhead();
+    DisableBackgroundWriter();
     FlushAllPages();
+    disk->Sync();
+    for (int i = 0; i < numShards; i++)
+        delete shards[i].policy;
+    delete[] shards;
 
     // Delete frames
-    PageFrame* cur = frameList.Front();
-    while (cur)
-    {
-        PageFrame* nxt = cur->next;
-        delete[] cur->data;
-        delete cur;
-        cur = nxt;
-    }
+    delete[] frameArray;
+    FileDiskManager::FreeFrameArena(arena, arenaBytes);
 }
 
-PageFrame* BufferPool::FetchPage(int pageId)
+void BufferPool::ReadIntoFrame(PageFrame* f, int pageId)
 {
-    fetches++;
+    if (disk->IsMapped())
+        f->data = disk->GetMappedPage(pageId);
+    else
+        disk->ReadPage(pageId, f->data);
+}
 
-    // BUFFER HIT
-    auto it = pageTable.find(pageId);
-    if (it != pageTable.end())
+void BufferPool::WaitForLoad(PageFrame* f)
+{
+    // the loading thread holds the frame latch exclusively until the data is in
+    f->latch.lock_shared();
+    f->latch.unlock_shared();
+}
+
+PageFrame* BufferPool::GetFreeFrame(PoolShard& s)
+{
+    // unused frame
+    if (!s.freeFrames.empty())
     {
-        hits++;
-        it->second->refCount++;
-        return it->second;
+        PageFrame* f = s.freeFrames.back();
+        s.freeFrames.pop_back();
+        return f;
     }
 
-    misses++;
-
-    // BUFFER MISS
-    for (PageFrame* f = frameList.Front(); f != nullptr; f = f->next)
+    // frame has to be evicted, pages only a scan wanted go first
+    PageFrame* victim;
+    int oneShot = s.oneShotFrames.Front();
+    if (oneShot != -1)
     {
-        if (f->pageId == -1)
-        {
-            disk->ReadPage(pageId, f->data);
-            f->pageId = pageId;
-            f->refCount = 1;
-            f->dirty = false;
-            pageTable[pageId] = f;
-            return f;
-        }
+        victim = s.frames[oneShot];
+        s.policy->Remove(victim);
     }
+    else
+    {
+        victim = s.policy->Victim();
+        if (!victim)
+            return nullptr;
+    }
+    s.oneShotFrames.Remove(victim->frameId);
+    s.evictions++;
+    WaitForWriteBack(victim);
 
-    // frame has to be evicted
-    for (PageFrame* victim = frameList.Front(); victim != nullptr; victim = victim->next)
+    // mapped pages are already in the file, the OS writes them back
+    if (victim->dirty && !disk->IsMapped())
     {
-        if (victim->refCount == 0)
-        {
-            evictions++;
+        disk->WritePage(victim->pageId, victim->data);
+        s.writes++;
+        // the background writer fell behind, let it catch up now
+        if (cleanTarget > 0)
+            writerWake.notify_one();
+    }
 
-            if (victim->dirty)
-            {
-                disk->WritePage(victim->pageId, victim->data);
-                writes++;
-            }
+    s.pageTable.Erase(victim->pageId);
+    victim->pageId = -1;
+    victim->dirty = false;
+    // the frame gets another page, a reader that still holds its version must fail validation
+    victim->version.fetch_add(2, memory_order_release);
+    return victim;
+}
+
+PageFrame* BufferPool::FetchPage(int pageId, AccessHint hint)
+{
+    PoolShard& s = ShardFor(pageId);
+    s.fetches++;
+    unique_lock<mutex> guard(s.latch);
 
-            pageTable.erase(victim->pageId);
+    // BUFFER HIT
+    PageFrame* f = s.pageTable.Find(pageId);
+    if (f)
+    {
+        s.hits++;
+        Pin(s, f);
+        s.policy->RecordAccess(f, false);
+        // a normal access makes a scanned page an ordinary one
+        if (hint == AccessHint::Normal)
+            f->oneShot = false;
+        guard.unlock();
+        if (f->loading)
+            WaitForLoad(f);
+        if (readAheadPages > 0)
+            DetectSequential(f);
+        return f;
+    }
 
-            disk->ReadPage(pageId, victim->data);
-            victim->pageId = pageId;
-            victim->refCount = 1;
-            victim->dirty = false;
-            pageTable[pageId] = victim;
+    s.misses++;
 
-            return victim;
-        }
+    // BUFFER MISS
+    f = GetFreeFrame(s);
+    if (!f)
+    {
+        std::cerr << "ERROR: No available frame for eviction!\n";
+        return nullptr;
     }
+    f->pageId = pageId;
+    f->refCount = 1;
+    f->dirty = false;
+    f->oneShot = hint == AccessHint::Scan;
+    // publish the frame before reading so other fetches of the page wait instead of reading it twice
+    f->loading = true;
+    f->latch.lock();
+    s.pageTable.Insert(pageId, f);
+    s.policy->RecordAccess(f, true);
+    guard.unlock();
+
+    ReadIntoFrame(f, pageId);
+    f->loading = false;
+    f->latch.unlock();
+    if (readAheadPages > 0)
+        DetectSequential(f);
+    return f;
+}
 
-    std::cerr << "ERROR: No available frame for eviction!\n";
-    return nullptr;
+void BufferPool::Pin(PoolShard& s, PageFrame* f)
+{
+    if (f->refCount++ == 0)
+    {
+        s.policy->SetEvictable(f, false);
+        s.oneShotFrames.Remove(f->frameId);
+    }
 }
 
 void BufferPool::UnpinPage(int pageId, bool dirty)
 {
-    auto it = pageTable.find(pageId);
-    if (it == pageTable.end()) return;
+    PoolShard& s = ShardFor(pageId);
+    lock_guard<mutex> guard(s.latch);
+    PageFrame* f = s.pageTable.Find(pageId);
+    if (!f) return;
 
-    PageFrame* f = it->second;
     if (f->refCount > 0)
-        f->refCount--;
+    {
+        // released frames become eviction candidates
+        if (--f->refCount == 0)
+        {
+            s.policy->SetEvictable(f, true);
+            if (f->oneShot)
+                s.oneShotFrames.PushBack(f->frameId);
+        }
+    }
 
     if (dirty)
         f->dirty = true;
 }
 
+void BufferPool::PinPage(PageFrame* f)
+{
+    PoolShard& s = ShardFor(f->pageId);
+    lock_guard<mutex> guard(s.latch);
+    Pin(s, f);
+}
+
+void BufferPool::KeepPage(PageFrame* f)
+{
+    PoolShard& s = ShardFor(f->pageId);
+    lock_guard<mutex> guard(s.latch);
+    f->oneShot = false;
+}
+
+void BufferPool::PrepareWrite(int pageId)
+{
+    /* mapped frames are modified in place and can reach the file at any time,
+    so the checkpoint image has to be saved before the first change */
+    if (disk->IsMapped() && disk->GetJournal())
+        disk->GetJournal()->SaveBeforeImage(pageId);
+}
+
 PageFrame* BufferPool::NewPage(int& newPageId)
 {
     newPageId = disk->NewPageId();
-    PageFrame* f = FetchPage(newPageId);
+    PoolShard& s = ShardFor(newPageId);
+    lock_guard<mutex> guard(s.latch);
+    // a frame can still hold a discarded page that had this id before a truncate
+    PageFrame* f = s.pageTable.Find(newPageId);
+    if (f)
+    {
+        Pin(s, f);
+        s.policy->RecordAccess(f, false);
+        f->oneShot = false;
+        // the read-ahead thread may still be filling it
+        if (f->loading)
+            WaitForLoad(f);
+    }
+    else
+    {
+        // the page is brand new, build it in memory instead of reading it
+        f = GetFreeFrame(s);
+        if (!f)
+        {
+            std::cerr << "ERROR: No available frame for eviction!\n";
+            return nullptr;
+        }
+        if (disk->IsMapped())
+            f->data = disk->GetMappedPage(newPageId);
+        f->pageId = newPageId;
+        f->refCount = 1;
+        f->oneShot = false;
+        s.pageTable.Insert(newPageId, f);
+        s.policy->RecordAccess(f, true);
+    }
+    // an id below the checkpoint's page count was cut off by a truncate since
+    PrepareWrite(newPageId);
     std::memset(f->data, 0, PAGE_SIZE);
     f->dirty = true;
     return f;
 }
 
+void BufferPool::DiscardPage(int pageId)
+{
+    PoolShard& s = ShardFor(pageId);
+    lock_guard<mutex> guard(s.latch);
+    PageFrame* f = s.pageTable.Find(pageId);
+    if (!f) return;
+
+    // the contents are garbage now, never write them back
+    f->dirty = false;
+    if (f->refCount > 0) return;
+    // a late write could grow the file again after it is truncated
+    WaitForWriteBack(f);
+    s.policy->Remove(f);
+    s.oneShotFrames.Remove(f->frameId);
+    f->pageId = -1;
+    f->version.fetch_add(2, memory_order_release);
+    s.pageTable.Erase(pageId);
+    s.freeFrames.push_back(f);
+}
+
 void BufferPool::WritePage(int pageId)
 {
-    auto it = pageTable.find(pageId);
-    if (it == pageTable.end()) return;
+    PoolShard& s = ShardFor(pageId);
+    lock_guard<mutex> guard(s.latch);
+    PageFrame* f = s.pageTable.Find(pageId);
+    if (!f) return;
 
-    PageFrame* f = it->second;
+    // an older image still being written must not land after this one
+    WaitForWriteBack(f);
 
     if (f->dirty)
     {
         disk->WritePage(pageId, f->data);
-        writes++;
+        s.writes++;
         f->dirty = false;
     }
 }
 
 void BufferPool::FlushAllPages()
 {
-    for (PageFrame* f = frameList.Front(); f != nullptr; f = f->next)
+    for (int i = 0; i < numShards; i++)
     {
-        if (f->pageId != -1 && f->dirty)
+        PoolShard& s = shards[i];
+        lock_guard<mutex> guard(s.latch);
+        for (PageFrame* f : s.frames)
         {
-            disk->WritePage(f->pageId, f->data);
-            writes++;
-            f->dirty = false;
+            WaitForWriteBack(f);
+            if (f->pageId != -1 && f->dirty)
+            {
+                disk->WritePage(f->pageId, f->data);
+                s.writes++;
+                f->dirty = false;
+            }
         }
     }
 }
 void BufferPool::ClearAllFrames()
 {
     // Reset every frame
-    for (PageFrame* f = frameList.Front(); f != nullptr; f = f->next)
+    for (int i = 0; i < numShards; i++)
+    {
+        PoolShard& s = shards[i];
+        lock_guard<mutex> guard(s.latch);
+        s.freeFrames.clear();
+        for (auto it = s.frames.rbegin(); it != s.frames.rend(); ++it)
+        {
+            PageFrame* f = *it;
+            // a write still in flight would land after the frame is reused
+            WaitForWriteBack(f);
+            if (f->pageId != -1)
+                s.policy->Remove(f);
+            s.oneShotFrames.Remove(f->frameId);
+            f->refCount = 0;
+            f->oneShot = false;
+            f->dirty = false;
+            f->pageId = -1;
+            s.freeFrames.push_back(f);
+        }
+
+        // Clear lookup table
+        s.pageTable.Clear();
+    }
+
+    // Reset statistics (optional)
+    ResetStats();
+}
+
+BufferStats BufferPool::GetStats() const
+{
+    BufferStats total{ 0, 0, 0, 0, 0, 0, 0 };
+    for (int i = 0; i < numShards; i++)
+    {
+        total.fetches += shards[i].fetches;
+        total.hits += shards[i].hits;
+        total.misses += shards[i].misses;
+        total.evictions += shards[i].evictions;
+        total.writes += shards[i].writes;
+        total.bgWrites += shards[i].bgWrites;
+        total.prefetches += shards[i].prefetches;
+    }
+    return total;
+}
+
+void BufferPool::ResetStats()
+{
+    for (int i = 0; i < numShards; i++)
+    {
+        PoolShard& s = shards[i];
+        s.fetches = s.hits = s.misses = s.evictions = s.writes = s.bgWrites = s.prefetches = 0;
+    }
+}
+
+/**********************************************************
+Read-ahead
+***********************************************************/
+
+void BufferPool::EnableReadAhead(ChainLinkFn link, int pages)
+{
+    DisableReadAhead();
+    int limit = poolSize / numShards / 4;
+    if (pages > limit) pages = limit;
+    if (!link || pages < 1) return;
+    chainLink = link;
+    ioStop = false;
+    ioThread = thread(&BufferPool::ReadAheadLoop, this);
+    readAheadPages = pages;
+}
+
+void BufferPool::DisableReadAhead()
+{
+    if (!ioThread.joinable()) return;
+    readAheadPages = 0;
+    {
+        lock_guard<mutex> guard(ioLatch);
+        ioStop = true;
+        ioQueue.clear();
+    }
+    ioWake.notify_one();
+    ioThread.join();
+}
+
+void BufferPool::DetectSequential(PageFrame* f)
+{
+    // each thread tracks its own scan, so concurrent readers do not confuse each other
+    struct ScanState { const BufferPool* pool; int lastPage; int expected; int run; };
+    static thread_local ScanState scan = { nullptr, -1, -1, 0 };
+
+    int pageId = f->pageId;
+    if (scan.pool == this && pageId == scan.lastPage)
+        return; // same page again (a search finds the leaf, then loads it)
+    int next = chainLink(pageId, f->data);
+    if (scan.pool == this && pageId == scan.expected)
+        scan.run++;
+    else
+        scan.run = 0;
+    scan.pool = this;
+    scan.lastPage = pageId;
+    scan.expected = next;
+    if (next == -1 || scan.run == 0)
+        return;
+
+    // refill once half of the window has been consumed
+    int step = readAheadPages / 2 > 0 ? readAheadPages / 2 : 1;
+    if ((scan.run - 1) % step != 0)
+        return;
+    {
+        lock_guard<mutex> guard(ioLatch);
+        // a reader that outruns the I/O thread only needs its latest window
+        if (ioQueue.size() >= 64)
+            ioQueue.pop_front();
+        ioQueue.emplace_back(next, readAheadPages);
+    }
+    ioWake.notify_one();
+}
+
+void BufferPool::ReadAheadLoop()
+{
+    while (true)
+    {
+        pair<int, int> req;
+        {
+            unique_lock<mutex> guard(ioLatch);
+            ioWake.wait(guard, [this] { return ioStop || !ioQueue.empty(); });
+            if (ioStop) return;
+            req = ioQueue.front();
+            ioQueue.pop_front();
+        }
+        int pid = req.first;
+        for (int i = 0; i < req.second && pid != -1 && !ioStop; i++)
+            pid = LoadAhead(pid);
+    }
+}
+
+int BufferPool::LoadAhead(int pageId)
+{
+    // links come from page contents, never trust them past the end of the file
+    if (pageId <= 0 || pageId >= disk->GetNumPages())
+        return -1;
+
+    PoolShard& s = ShardFor(pageId);
+    unique_lock<mutex> guard(s.latch);
+    PageFrame* f = s.pageTable.Find(pageId);
+    if (f)
     {
-        f->refCount = 0;
+        // resident pages only need their link, read under the latch so the replacement order is left alone
+        if (!f->loading)
+            return chainLink(pageId, f->data);
+        Pin(s, f);
+        guard.unlock();
+        WaitForLoad(f);
+    }
+    else
+    {
+        // the page goes in unpinned, if no frame is free now the read-ahead is skipped
+        f = GetFreeFrame(s);
+        if (!f) return -1;
+        f->pageId = pageId;
+        f->refCount = 1;
         f->dirty = false;
-        f->pageId = -1;
+        // only scans read ahead, so the page is one-shot until a normal fetch
+        f->oneShot = true;
+        f->loading = true;
+        f->latch.lock();
+        s.pageTable.Insert(pageId, f);
+        s.policy->RecordAccess(f, true);
+        s.prefetches++;
+        guard.unlock();
+
+        ReadIntoFrame(f, pageId);
+        f->loading = false;
+        f->latch.unlock();
     }
+    int next = chainLink(pageId, f->data);
+    UnpinPage(pageId, false);
+    return next;
+}
 
-    // Clear lookup table
-    pageTable.clear();
+/**********************************************************
+Background writer
+***********************************************************/
 
-    // Reset statistics (optional)
-    fetches = hits = misses = evictions = writes = 0;
+void BufferPool::EnableBackgroundWriter(int cleanFrames, int intervalMs)
+{
+    DisableBackgroundWriter();
+    if (disk->IsMapped() || cleanFrames < 1) return;
+    int limit = poolSize / numShards;
+    if (cleanFrames > limit) cleanFrames = limit;
+    // one aligned copy per page a round can write
+    for (int i = 0; i < cleanFrames; i++)
+        writerPages.push_back(FileDiskManager::AllocAlignedPage());
+    writerIntervalMs = intervalMs > 0 ? intervalMs : BG_WRITER_INTERVAL_MS;
+    writerStop = false;
+    writerThread = thread(&BufferPool::WriterLoop, this);
+    cleanTarget = cleanFrames;
+}
+
+void BufferPool::DisableBackgroundWriter()
+{
+    if (!writerThread.joinable()) return;
+    cleanTarget = 0;
+    {
+        lock_guard<mutex> guard(writerLatch);
+        writerStop = true;
+    }
+    writerWake.notify_one();
+    writerThread.join();
+    for (char* p : writerPages)
+        FileDiskManager::FreeAlignedPage(p);
+    writerPages.clear();
+}
+
+void BufferPool::WaitForWriteBack(PageFrame* f)
+{
+    /* the writer never takes the shard latch to finish, so the caller keeps
+    it and the frame cannot change hands; this is at most one page write */
+    while (f->writingBack)
+        this_thread::yield();
+}
+
+void BufferPool::WriterLoop()
+{
+    while (true)
+    {
+        {
+            unique_lock<mutex> guard(writerLatch);
+            if (writerStop) return;
+            // woken early when a fetch had to write a dirty victim itself
+            writerWake.wait_for(guard, chrono::milliseconds(writerIntervalMs));
+            if (writerStop) return;
+        }
+        lock_guard<mutex> round(writerRound);
+        for (int i = 0; i < numShards; i++)
+            CleanShard(shards[i]);
+    }
+}
+
+void BufferPool::CleanShard(PoolShard& s)
+{
+    vector<PageFrame*> batch;
+    {
+        lock_guard<mutex> guard(s.latch);
+        // free frames are handed out before anything is evicted
+        int upcoming = cleanTarget - static_cast<int>(s.freeFrames.size());
+        if (upcoming <= 0)
+            return;
+        // one-shot frames go first, then the policy's own order
+        vector<PageFrame*> next;
+        for (int id = s.oneShotFrames.Front(); id != -1 && static_cast<int>(next.size()) < upcoming;
+            id = s.oneShotFrames.Next(id))
+            next.push_back(s.frames[id]);
+        s.policy->NextVictims(upcoming, next);
+        for (PageFrame* f : next)
+        {
+            if (!f->dirty || f->writingBack || f->refCount != 0 || batch.size() == writerPages.size())
+                continue;
+            if (!f->latch.try_lock())
+                continue;
+            /* only marked under the latch: a hit waits for the copy as for a
+            page being read in, eviction and flushes wait for the write */
+            f->loading = true;
+            f->writingBack = true;
+            f->dirty = false;
+            batch.push_back(f);
+        }
+    }
+
+    // every copy is taken before any write, so no hit waits on the disk
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        memcpy(writerPages[i], batch[i]->data, PAGE_SIZE);
+        batch[i]->loading = false;
+        batch[i]->latch.unlock();
+    }
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        disk->WritePage(batch[i]->pageId, writerPages[i]);
+        s.bgWrites++;
+        batch[i]->writingBack = false;
+    }
 }
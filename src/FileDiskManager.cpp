@@ -1,71 +1,367 @@
 #include "FileDiskManager.h"
+#include "LogManager.h"
 #include <iostream>
 #include <cstring>
-#include <vector>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 using namespace std;
 
-void FileDiskManager::EnsureOpen() {
-    if (!file.is_open()) { //if file currently isnt open
-        file.open(filename, ios::in | ios::out | ios::binary);
-
-        if (!file.is_open()) { //if the file isnt open still create a new file
-            file.clear();
-            file.open(filename, ios::out | ios::binary);
-            file.close();
-            // Reopen the file
-            file.open(filename,
-                ios::in | ios::out | ios::binary);
+#ifdef _WIN32
+/* mingw has no positional I/O or O_DIRECT. pread/pwrite pass the offset to
+   ReadFile/WriteFile in an OVERLAPPED instead of seeking first, so threads
+   reading pages outside the latch never move each other's file position */
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+static long long pread(int fd, void* buf, size_t n, long long off) {
+    OVERLAPPED ov = {};
+    ov.Offset = static_cast<DWORD>(off);
+    ov.OffsetHigh = static_cast<DWORD>(off >> 32);
+    DWORD done = 0;
+    if (!ReadFile(reinterpret_cast<HANDLE>(_get_osfhandle(fd)), buf, static_cast<DWORD>(n), &done, &ov)) {
+        if (GetLastError() == ERROR_HANDLE_EOF) return 0;
+        errno = EIO;
+        return -1;
+    }
+    return done;
+}
+static long long pwrite(int fd, const void* buf, size_t n, long long off) {
+    OVERLAPPED ov = {};
+    ov.Offset = static_cast<DWORD>(off);
+    ov.OffsetHigh = static_cast<DWORD>(off >> 32);
+    DWORD done = 0;
+    if (!WriteFile(reinterpret_cast<HANDLE>(_get_osfhandle(fd)), buf, static_cast<DWORD>(n), &done, &ov)) {
+        errno = EIO;
+        return -1;
+    }
+    return done;
+}
+static int fsync(int fd) { return _commit(fd); }
+#define OPEN_FLAGS (O_RDWR | O_CREAT | O_BINARY)
+#else
+#define OPEN_FLAGS (O_RDWR | O_CREAT)
+#endif
+
+char* FileDiskManager::AllocAlignedPage() {
+#ifdef _WIN32
+    return static_cast<char*>(_aligned_malloc(PAGE_SIZE, IO_ALIGNMENT));
+#else
+    void* p = nullptr;
+    if (posix_memalign(&p, IO_ALIGNMENT, PAGE_SIZE) != 0) return nullptr;
+    return static_cast<char*>(p);
+#endif
+}
+
+void FileDiskManager::FreeAlignedPage(char* p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+char* FileDiskManager::AllocFrameArena(long long& bytes, bool& hugePages) {
+    if (hugePages)
+        bytes = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+#ifdef _WIN32
+    hugePages = false;
+    return static_cast<char*>(_aligned_malloc(bytes, IO_ALIGNMENT));
+#else
+    void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugePages)
+        p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p != MAP_FAILED) return static_cast<char*>(p);
+    // anonymous mappings are page aligned, which covers IO_ALIGNMENT
+    p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        cerr << "ERROR: Could not allocate " << bytes << " bytes of buffer frames: " << strerror(errno) << "\n";
+        return nullptr;
+    }
+#ifdef MADV_HUGEPAGE
+    // no reserved huge pages, let the kernel back the arena with transparent ones
+    if (hugePages) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    hugePages = false;
+    return static_cast<char*>(p);
+#endif
+}
+
+void FileDiskManager::FreeFrameArena(char* p, long long bytes) {
+    if (!p) return;
+#ifdef _WIN32
+    (void)bytes;
+    _aligned_free(p);
+#else
+    munmap(p, bytes);
+#endif
+}
+
+bool FileDiskManager::OpenMapping(long long fileBytes) {
+#ifdef _WIN32
+    (void)fileBytes;
+    return false;
+#else
+    // reserve the whole range without backing so later extents can be mapped
+    // at fixed addresses and frames pointing into the mapping stay valid
+    void* p = mmap(nullptr, MMAP_RESERVE, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) return false;
+    mapBase = static_cast<char*>(p);
+    mappedBytes = 0;
+    fileLength = fileBytes;
+    if (!GrowMapping(fileBytes > 0 ? fileBytes : EXTENT_BYTES)) {
+        munmap(mapBase, MMAP_RESERVE);
+        mapBase = nullptr;
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool FileDiskManager::GrowMapping(long long bytes) {
+#ifdef _WIN32
+    (void)bytes;
+    return false;
+#else
+    if (bytes <= fileLength && bytes <= mappedBytes) return true;
+    long long target = ((bytes + EXTENT_BYTES - 1) / EXTENT_BYTES) * EXTENT_BYTES;
+    if (target > MMAP_RESERVE) {
+        cerr << "ERROR: " << filename << " outgrew the mmap reservation\n";
+        return false;
+    }
+    // the file has to cover every page touched through the mapping, new bytes read back as zeroes
+    if (fileLength < target) {
+        if (ftruncate(fd, target) != 0) {
+            cerr << "ERROR: Could not extend " << filename << ": " << strerror(errno) << "\n";
+            return false;
+        }
+        fileLength = target;
+    }
+    // after a truncate the mapping may still cover the extents the file grows back into
+    if (mappedBytes < target) {
+        void* p = mmap(mapBase + mappedBytes, target - mappedBytes, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED, fd, mappedBytes);
+        if (p == MAP_FAILED) {
+            cerr << "ERROR: mmap of " << filename << " failed: " << strerror(errno) << "\n";
+            return false;
         }
+        mappedBytes = target;
     }
+    return true;
+#endif
 }
 
-FileDiskManager::FileDiskManager(const string& filename)
+void FileDiskManager::EnsureOpen() {
+    if (fd >= 0) return;
+    int flags = OPEN_FLAGS;
+#ifdef O_DIRECT
+    if (mode == DiskMode::Direct) {
+        fd = open(filename.c_str(), flags | O_DIRECT, 0644);
+        if (fd >= 0) return;
+        // tmpfs and some network filesystems reject O_DIRECT
+        cerr << "WARNING: O_DIRECT not supported for " << filename
+            << ", using buffered I/O\n";
+        mode = DiskMode::Buffered;
+    }
+#else
+    if (mode == DiskMode::Direct) mode = DiskMode::Buffered;
+#endif
+    fd = open(filename.c_str(), flags, 0644);
+    if (fd < 0) {
+        cerr << "ERROR: Could not open " << filename << ": " << strerror(errno) << "\n";
+    }
+}
+
+FileDiskManager::FileDiskManager(const string& filename, DiskMode mode)
     : filename(filename),
-    nextPageId(0)
+    fd(-1),
+    nextPageId(0),
+    allocatedPages(0),
+    mode(mode),
+    bounce(nullptr),
+    mapBase(nullptr),
+    mappedBytes(0),
+    fileLength(0),
+    journal(nullptr)
 {
     EnsureOpen();
-    //move the pointer toward to the end of file
-    file.seekp(0, ios::end);
-
-    streamoff endPos = file.tellp();
+    bounce = AllocAlignedPage();
+    struct stat st;
     //number of pages = file size/ page size
     //next page id = the number of pages due pages starting 0
     //allows for persistance access
-    nextPageId = (endPos > 0) ? static_cast<int>(endPos / PAGE_SIZE) : 0;
+    long long fileBytes = 0;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+        fileBytes = st.st_size;
+        nextPageId = static_cast<int>(st.st_size / PAGE_SIZE);
+    }
+    allocatedPages = nextPageId;
+    if (this->mode == DiskMode::Mmap && !OpenMapping(fileBytes)) {
+        cerr << "WARNING: mmap not available for " << filename
+            << ", using buffered I/O\n";
+        this->mode = DiskMode::Buffered;
+    }
+}
+
+FileDiskManager::~FileDiskManager() {
+#ifndef _WIN32
+    if (mapBase) munmap(mapBase, MMAP_RESERVE);
+    /* set the exact size so the page count survives a reopen: this drops the
+    unused tail of the last extent and covers new pages that were never written */
+    if (fd >= 0 && ftruncate(fd, static_cast<long long>(nextPageId) * PAGE_SIZE) != 0) {
+        cerr << "ERROR: Could not trim " << filename << "\n";
+    }
+#endif
+    if (fd >= 0) close(fd);
+    FreeAlignedPage(bounce);
 }
 
 void FileDiskManager::ReadPage(int pageId, char* dst) {
     EnsureOpen();
-    // calculate staring offset by multipling it page size 
-    // ie: page 2's starting offset is 2 * 4096
-    streamoff offset = static_cast<streamoff>(pageId) * PAGE_SIZE;
-
-    file.seekg(offset, ios::beg);
-    file.read(dst, PAGE_SIZE);
+    if (mode == DiskMode::Mmap) {
+        // pages past the end of the file have never been written (or were cut off)
+        if (static_cast<long long>(pageId + 1) * PAGE_SIZE > fileLength)
+            memset(dst, 0, PAGE_SIZE);
+        else if (dst != GetMappedPage(pageId))
+            memcpy(dst, GetMappedPage(pageId), PAGE_SIZE);
+        return;
+    }
+    // calculate staring offset by multipling it page size
+    // ie: page 2's starting offset is 2 * 16384
+    long long offset = static_cast<long long>(pageId) * PAGE_SIZE;
+    /* O_DIRECT needs the destination aligned, otherwise read into a page of
+    this call's own: the shared bounce page belongs to WritePage, which holds
+    the latch while the journal reads through here */
+    bool useBounce = mode == DiskMode::Direct
+        && reinterpret_cast<uintptr_t>(dst) % IO_ALIGNMENT != 0;
+    char* buf = useBounce ? AllocAlignedPage() : dst;
+    if (!buf) {
+        memset(dst, 0, PAGE_SIZE);
+        return;
+    }
 
+    long long n = 0;
+    while (n < PAGE_SIZE) {
+        long long r = pread(fd, buf + n, PAGE_SIZE - n, offset + n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        n += r;
+    }
     // If reading hits EOF, pad with zeroes
-    if (file.gcount() != PAGE_SIZE) {
-        streamsize n = file.gcount();
-        memset(dst + n, 0, PAGE_SIZE - n);
+    if (n < PAGE_SIZE) {
+        if (n < 0) n = 0;
+        memset(buf + n, 0, PAGE_SIZE - n);
+    }
+    if (useBounce) {
+        memcpy(dst, buf, PAGE_SIZE);
+        FreeAlignedPage(buf);
     }
 }
 
 void FileDiskManager::WritePage(int pageId, const char* src) {
+    lock_guard<mutex> guard(latch);
     EnsureOpen();
 
-    streamoff offset = static_cast<streamoff>(pageId) * PAGE_SIZE;
+    long long offset = static_cast<long long>(pageId) * PAGE_SIZE;
+    if (journal) journal->SaveBeforeImage(pageId);
+    // writing past the end extends the file (recovery restores truncated pages)
+    if (pageId >= nextPageId) nextPageId = pageId + 1;
+    if (mode == DiskMode::Mmap) {
+        // frames handed out by the pool already live in the mapping
+        if (GrowMapping(offset + PAGE_SIZE) && src != GetMappedPage(pageId))
+            memcpy(GetMappedPage(pageId), src, PAGE_SIZE);
+        return;
+    }
+    const char* buf = src;
+    if (mode == DiskMode::Direct && reinterpret_cast<uintptr_t>(src) % IO_ALIGNMENT != 0) {
+        memcpy(bounce, src, PAGE_SIZE);
+        buf = bounce;
+    }
+    long long n = 0;
+    while (n < PAGE_SIZE) {
+        long long w = pwrite(fd, buf + n, PAGE_SIZE - n, offset + n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            cerr << "ERROR: Write of page " << pageId << " failed: " << strerror(errno) << "\n";
+            return;
+        }
+        n += w;
+    }
+}
 
-    file.seekp(offset, ios::beg);
-    file.write(src, PAGE_SIZE);
-    file.flush();
+void FileDiskManager::Sync() {
+#ifndef _WIN32
+    if (mapBase && msync(mapBase, min(mappedBytes, fileLength), MS_SYNC) != 0) {
+        cerr << "ERROR: msync of " << filename << " failed: " << strerror(errno) << "\n";
+    }
+#endif
+    if (fd >= 0 && fsync(fd) != 0) {
+        cerr << "ERROR: fsync of " << filename << " failed: " << strerror(errno) << "\n";
+    }
 }
+
 int FileDiskManager::NewPageId() {
+    lock_guard<mutex> guard(latch);
     EnsureOpen();
 
     int pid = nextPageId++;
-    vector<char> zero(PAGE_SIZE, 0);
-
-    WritePage(pid, zero.data());
-
+    if (mode == DiskMode::Mmap) {
+        // extending the file zero fills, nothing has to be written
+        GrowMapping(static_cast<long long>(nextPageId) * PAGE_SIZE);
+        return pid;
+    }
+    /* no zero page is written: reads past the end of the file already come
+    back as zeroes and the buffer pool builds new pages in memory. Space is
+    reserved an extent at a time so the filesystem can keep the file contiguous */
+    if (pid >= allocatedPages) {
+        long long off = static_cast<long long>(allocatedPages) * PAGE_SIZE;
+#ifdef __linux__
+        // KEEP_SIZE leaves the file size alone so it still counts written pages only
+        if (fallocate(fd, FALLOC_FL_KEEP_SIZE, off, EXTENT_BYTES) != 0 && errno != EOPNOTSUPP) {
+            cerr << "WARNING: Could not preallocate " << filename << ": " << strerror(errno) << "\n";
+        }
+#else
+        (void)off;
+#endif
+        allocatedPages += EXTENT_PAGES;
+    }
     return pid;
-}
\ No newline at end of file
+}
+
+void FileDiskManager::Truncate(int numPages) {
+    lock_guard<mutex> guard(latch);
+    EnsureOpen();
+    if (numPages < 0 || numPages >= nextPageId) return;
+    if (journal) journal->SaveBeforeTruncate(numPages);
+    nextPageId = numPages;
+    if (allocatedPages > numPages) allocatedPages = numPages;
+    /* a mapped file is cut too, so freed pages and the extents a crashed run
+    left behind do not linger; the mapping keeps its extents, and nothing
+    touches it past the end until GrowMapping extends the file again */
+    if (mode == DiskMode::Mmap)
+        fileLength = static_cast<long long>(numPages) * PAGE_SIZE;
+#ifdef _WIN32
+    if (_chsize_s(fd, static_cast<long long>(numPages) * PAGE_SIZE) != 0) {
+#else
+    if (ftruncate(fd, static_cast<long long>(numPages) * PAGE_SIZE) != 0) {
+#endif
+        cerr << "ERROR: Could not truncate " << filename << ": " << strerror(errno) << "\n";
+    }
+}
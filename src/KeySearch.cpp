@@ -0,0 +1,104 @@
+#include "KeySearch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEY_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+int keyUpperBoundScalar(const int* keys, int n, int key)
+{
+    int idx = 0;
+    while (idx < n && key >= keys[idx]) {
+        ++idx;
+    }
+    return idx;
+}
+
+int keyUpperBoundBinary(const int* keys, int n, int key)
+{
+    if (n == 0) return 0;
+    // the answer stays in [base, base + len]; the select compiles to a cmov
+    int base = 0;
+    int len = n;
+    while (len > 1) {
+        int half = len / 2;
+        base = (keys[base + half] <= key) ? base + half : base;
+        len -= half;
+    }
+    return base + (keys[base] <= key);
+}
+
+#ifdef KEY_SEARCH_X86
+/* narrow like the binary search until the answer is inside a window of
+width keys, then count the keys <= key in that window. The window is slid
+left to stay inside the array: keys before base are all <= key and keys
+past base + len are all greater, so the count still lands on the answer */
+static inline int narrowWindow(const int* keys, int n, int key, int width)
+{
+    int base = 0;
+    int len = n;
+    while (len > width) {
+        int half = len / 2;
+        base = (keys[base + half] <= key) ? base + half : base;
+        len -= half;
+    }
+    return base + width <= n ? base : n - width;
+}
+
+__attribute__((target("avx2")))
+static int upperBoundAvx2(const int* keys, int n, int key)
+{
+    const int WIDTH = 16;
+    if (n < WIDTH) return keyUpperBoundBinary(keys, n, key);
+    int start = narrowWindow(keys, n, key, WIDTH);
+    __m256i k = _mm256_set1_epi32(key);
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + start));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + start + 8));
+    // one bit per key that is greater than the search key
+    int gtA = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, k)));
+    int gtB = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, k)));
+    return start + WIDTH - __builtin_popcount(gtA | (gtB << 8));
+}
+
+static int upperBoundSse2(const int* keys, int n, int key)
+{
+    const int WIDTH = 8;
+    if (n < WIDTH) return keyUpperBoundBinary(keys, n, key);
+    int start = narrowWindow(keys, n, key, WIDTH);
+    __m128i k = _mm_set1_epi32(key);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + start));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + start + 4));
+    int gtA = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, k)));
+    int gtB = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(b, k)));
+    return start + WIDTH - __builtin_popcount(gtA | (gtB << 4));
+}
+#endif
+
+struct KeySearchImpl {
+    int (*fn)(const int*, int, int);
+    const char* name;
+};
+
+static KeySearchImpl pickKeySearch()
+{
+#ifdef KEY_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return { upperBoundAvx2, "avx2" };
+    if (__builtin_cpu_supports("sse2"))
+        return { upperBoundSse2, "sse2" };
+#endif
+    return { keyUpperBoundBinary, "binary" };
+}
+
+static const KeySearchImpl keySearch = pickKeySearch();
+
+int keyUpperBound(const int* keys, int n, int key)
+{
+    return keySearch.fn(keys, n, key);
+}
+
+const char* keySearchName()
+{
+    return keySearch.name;
+}
@@ -0,0 +1,293 @@
+#include "LogManager.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#define fsync _commit
+#define ftruncate _chsize_s
+#define LOG_OPEN_FLAGS (O_RDWR | O_CREAT | O_BINARY)
+#else
+#include <unistd.h>
+#define LOG_OPEN_FLAGS (O_RDWR | O_CREAT)
+#endif
+using namespace std;
+
+static const uint32_t JOURNAL_MAGIC = 0x314C4E4Au; // "JNL1"
+
+// journal file header, followed by JournalEntry + page image pairs
+struct JournalHeader {
+    uint32_t magic;
+    int32_t  pageSize;
+    int32_t  checkpointPages;
+    int32_t  pad;
+};
+
+struct JournalEntry {
+    int32_t  pageId;
+    uint32_t checksum;
+};
+
+// FNV-1a, stable across builds so old logs stay readable
+static uint32_t checksum32(const char* data, size_t n, uint32_t h = 2166136261u) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static uint32_t recordChecksum(const LogRecordHeader& h, const char* payload) {
+    uint32_t c = checksum32(reinterpret_cast<const char*>(&h.lsn), sizeof(h.lsn));
+    c = checksum32(reinterpret_cast<const char*>(&h.type), sizeof(h.type), c);
+    c = checksum32(reinterpret_cast<const char*>(&h.size), sizeof(h.size), c);
+    return checksum32(payload, h.size, c);
+}
+
+static bool writeAll(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        long long w = write(fd, p, static_cast<unsigned>(n));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+static bool readAll(int fd, char* p, size_t n) {
+    while (n > 0) {
+        long long r = read(fd, p, static_cast<unsigned>(n));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+LogManager::LogManager(const string& basePath, FileDiskManager* disk, WalSyncMode mode)
+    : walPath(basePath + ".wal"),
+    journalPath(basePath + ".jnl"),
+    disk(disk),
+    mode(mode),
+    walFd(-1),
+    journalFd(-1),
+    pendingRecords(0),
+    nextLsn(1),
+    logBytes(0),
+    syncs(0),
+    checkpointPages(disk->GetNumPages()),
+    scratch(nullptr),
+    restoring(false)
+{
+    walFd = open(walPath.c_str(), LOG_OPEN_FLAGS, 0644);
+    journalFd = open(journalPath.c_str(), LOG_OPEN_FLAGS, 0644);
+    if (walFd < 0 || journalFd < 0) {
+        cerr << "ERROR: Could not open log files for " << basePath << ": " << strerror(errno) << "\n";
+    }
+    scratch = FileDiskManager::AllocAlignedPage();
+    struct stat st;
+    if (walFd >= 0 && fstat(walFd, &st) == 0) {
+        logBytes = st.st_size;
+        lseek(walFd, 0, SEEK_END);
+    }
+    // an empty journal means the file on disk is a clean checkpoint
+    if (journalFd >= 0 && fstat(journalFd, &st) == 0 && st.st_size == 0) {
+        ResetJournal();
+    }
+    // every page write now goes through SaveBeforeImage first
+    disk->SetJournal(this);
+}
+
+LogManager::~LogManager() {
+    Commit();
+    disk->SetJournal(nullptr);
+    if (walFd >= 0) close(walFd);
+    if (journalFd >= 0) close(journalFd);
+    FileDiskManager::FreeAlignedPage(scratch);
+}
+
+/**********************************************************
+Redo log
+***********************************************************/
+
+uint64_t LogManager::Append(LogType type, const string& key, const foodItem* item) {
+    LogRecordHeader h{};
+    h.lsn = nextLsn++;
+    h.type = static_cast<uint8_t>(type);
+    // payload: key length byte, key bytes, then the item for an insert
+    uint8_t keyLen = static_cast<uint8_t>(min(key.size(), static_cast<size_t>(MAX_KEY_BYTES)));
+    h.size = static_cast<uint32_t>(1 + keyLen + (item ? sizeof(foodItem) : 0));
+    char payload[1 + MAX_KEY_BYTES + sizeof(foodItem)];
+    payload[0] = static_cast<char>(keyLen);
+    memcpy(payload + 1, key.data(), keyLen);
+    if (item) memcpy(payload + 1 + keyLen, item, sizeof(foodItem));
+    h.checksum = recordChecksum(h, payload);
+
+    const char* hp = reinterpret_cast<const char*>(&h);
+    buffer.insert(buffer.end(), hp, hp + sizeof(h));
+    buffer.insert(buffer.end(), payload, payload + h.size);
+    pendingRecords++;
+    logBytes += static_cast<long long>(sizeof(h) + h.size);
+
+    if (mode == WalSyncMode::PerOp || (mode == WalSyncMode::Batch && pendingRecords >= WAL_GROUP_SIZE)) {
+        Commit();
+    }
+    else if (mode == WalSyncMode::Off && buffer.size() >= static_cast<size_t>(EXTENT_BYTES)) {
+        WriteBuffer();
+    }
+    return h.lsn;
+}
+
+uint64_t LogManager::LogInsert(const string& key, const foodItem& item) {
+    return Append(LogType::Insert, key, &item);
+}
+
+uint64_t LogManager::LogRemove(const string& key) {
+    return Append(LogType::Remove, key, nullptr);
+}
+
+void LogManager::WriteBuffer() {
+    if (buffer.empty()) return;
+    if (!writeAll(walFd, buffer.data(), buffer.size())) {
+        cerr << "ERROR: Write to " << walPath << " failed: " << strerror(errno) << "\n";
+    }
+    buffer.clear();
+    pendingRecords = 0;
+}
+
+void LogManager::Commit() {
+    bool hadRecords = !buffer.empty();
+    WriteBuffer();
+    // one fsync covers the whole group
+    if (hadRecords && mode != WalSyncMode::Off) {
+        fsync(walFd);
+        syncs++;
+    }
+}
+
+/**********************************************************
+Checkpoint journal
+***********************************************************/
+
+void LogManager::ResetJournal() {
+    lock_guard<mutex> guard(journalLatch);
+    journaled.clear();
+    checkpointPages = disk->GetNumPages();
+    JournalHeader jh{ JOURNAL_MAGIC, PAGE_SIZE, checkpointPages, 0 };
+    if (ftruncate(journalFd, 0) != 0 || lseek(journalFd, 0, SEEK_SET) < 0
+        || !writeAll(journalFd, reinterpret_cast<const char*>(&jh), sizeof(jh))) {
+        cerr << "ERROR: Could not reset " << journalPath << ": " << strerror(errno) << "\n";
+    }
+    fsync(journalFd);
+}
+
+void LogManager::SaveBeforeImage(int pageId) {
+    lock_guard<mutex> guard(journalLatch);
+    // pages allocated after the checkpoint are cut off by recovery instead
+    if (restoring || pageId >= checkpointPages || journaled.count(pageId)) return;
+    journaled.insert(pageId);
+    disk->ReadPage(pageId, scratch);
+    JournalEntry e{ pageId, checksum32(scratch, PAGE_SIZE) };
+    if (!writeAll(journalFd, reinterpret_cast<const char*>(&e), sizeof(e))
+        || !writeAll(journalFd, scratch, PAGE_SIZE)) {
+        cerr << "ERROR: Write to " << journalPath << " failed: " << strerror(errno) << "\n";
+    }
+    /* the image must be durable before the page itself is overwritten, in
+       every mode: without it a crash leaves a torn tree, not lost operations */
+    fsync(journalFd);
+}
+
+void LogManager::SaveBeforeTruncate(int numPages) {
+    int end = disk->GetNumPages();
+    if (end > checkpointPages) end = checkpointPages;
+    for (int pid = numPages; pid < end; pid++) {
+        SaveBeforeImage(pid);
+    }
+}
+
+void LogManager::CheckpointComplete() {
+    // journal first: a crash in between replays the log onto the new checkpoint,
+    // which is harmless because every record is a blind write of one key
+    ResetJournal();
+    buffer.clear();
+    pendingRecords = 0;
+    if (ftruncate(walFd, 0) != 0 || lseek(walFd, 0, SEEK_SET) < 0) {
+        cerr << "ERROR: Could not truncate " << walPath << ": " << strerror(errno) << "\n";
+    }
+    fsync(walFd);
+    logBytes = 0;
+}
+
+/**********************************************************
+Recovery
+***********************************************************/
+
+bool LogManager::RestoreCheckpoint() {
+    if (lseek(journalFd, 0, SEEK_SET) < 0) return false;
+    JournalHeader jh{};
+    if (!readAll(journalFd, reinterpret_cast<char*>(&jh), sizeof(jh))
+        || jh.magic != JOURNAL_MAGIC || jh.pageSize != PAGE_SIZE) {
+        ResetJournal();
+        return false;
+    }
+    restoring = true;
+    int restored = 0;
+    JournalEntry e{};
+    while (readAll(journalFd, reinterpret_cast<char*>(&e), sizeof(e))
+        && readAll(journalFd, scratch, PAGE_SIZE)) {
+        // a torn entry was never fsynced, so its page was never overwritten
+        if (checksum32(scratch, PAGE_SIZE) != e.checksum) break;
+        disk->WritePage(e.pageId, scratch);
+        restored++;
+    }
+    // drop pages that were allocated after the checkpoint
+    disk->Truncate(jh.checkpointPages);
+    disk->Sync();
+    restoring = false;
+    ResetJournal();
+    if (restored > 0) {
+        cout << "Recovery: restored " << restored << " page(s) from the checkpoint journal.\n";
+    }
+    return restored > 0;
+}
+
+long long LogManager::Replay(const function<void(const LogRecord&)>& apply) {
+    WriteBuffer();
+    if (lseek(walFd, 0, SEEK_SET) < 0) return 0;
+    long long applied = 0;
+    long long validBytes = 0;
+    LogRecordHeader h{};
+    char payload[1 + MAX_KEY_BYTES + sizeof(foodItem)];
+    while (readAll(walFd, reinterpret_cast<char*>(&h), sizeof(h))) {
+        // stop at the first torn or corrupt record, nothing after it was committed
+        if (h.size < 1 || h.size > sizeof(payload)) break;
+        if (!readAll(walFd, payload, h.size)) break;
+        if (recordChecksum(h, payload) != h.checksum) break;
+
+        LogRecord rec;
+        rec.lsn = h.lsn;
+        rec.type = static_cast<LogType>(h.type);
+        uint32_t keyLen = static_cast<uint8_t>(payload[0]);
+        if (1 + keyLen > h.size) break;
+        rec.key.assign(payload + 1, keyLen);
+        if (rec.type == LogType::Insert && h.size == 1 + keyLen + sizeof(foodItem))
+            memcpy(&rec.item, payload + 1 + keyLen, sizeof(foodItem));
+        apply(rec);
+        applied++;
+        validBytes += static_cast<long long>(sizeof(h) + h.size);
+        if (h.lsn >= nextLsn) nextLsn = h.lsn + 1;
+    }
+    // new records go after the last intact one
+    if (ftruncate(walFd, validBytes) != 0) {
+        cerr << "ERROR: Could not trim " << walPath << "\n";
+    }
+    lseek(walFd, validBytes, SEEK_SET);
+    logBytes = validBytes;
+    return applied;
+}
@@ -0,0 +1,330 @@
+#include "ReplacementPolicy.h"
+#include <algorithm>
+
+ReplacementPolicy* ReplacementPolicy::Create(ReplacementType type, const vector<PageFrame*>& frames)
+{
+    switch (type) {
+    case ReplacementType::LRU:   return new LRUPolicy(frames);
+    case ReplacementType::CLOCK: return new ClockPolicy(frames);
+    case ReplacementType::LRUK:  return new LRUKPolicy(frames);
+    case ReplacementType::TwoQ:  return new TwoQPolicy(frames);
+    case ReplacementType::FIFO:
+    default:                     return new FIFOPolicy(frames);
+    }
+}
+
+/**********************************************************
+FIFO
+***********************************************************/
+
+FIFOPolicy::FIFOPolicy(const vector<PageFrame*>& frames)
+    : frames(frames), loadOrder(static_cast<int>(frames.size()))
+{
+}
+
+void FIFOPolicy::RecordAccess(PageFrame* f, bool newlyLoaded)
+{
+    // hits never reorder
+    if (newlyLoaded) {
+        loadOrder.Remove(f->frameId);
+        loadOrder.PushBack(f->frameId);
+    }
+}
+
+void FIFOPolicy::SetEvictable(PageFrame*, bool)
+{
+}
+
+PageFrame* FIFOPolicy::Victim()
+{
+    for (int id = loadOrder.Front(); id != -1; id = loadOrder.Next(id)) {
+        if (frames[id]->refCount == 0) {
+            loadOrder.Remove(id);
+            return frames[id];
+        }
+    }
+    return nullptr;
+}
+
+void FIFOPolicy::Remove(PageFrame* f)
+{
+    loadOrder.Remove(f->frameId);
+}
+
+void FIFOPolicy::NextVictims(int n, vector<PageFrame*>& out) const
+{
+    for (int id = loadOrder.Front(); id != -1 && static_cast<int>(out.size()) < n; id = loadOrder.Next(id)) {
+        if (frames[id]->refCount == 0)
+            out.push_back(frames[id]);
+    }
+}
+
+/**********************************************************
+LRU
+***********************************************************/
+
+LRUPolicy::LRUPolicy(const vector<PageFrame*>& frames)
+    : frames(frames), candidates(static_cast<int>(frames.size()))
+{
+}
+
+void LRUPolicy::RecordAccess(PageFrame*, bool)
+{
+    // recency is taken when the frame is released, see SetEvictable
+}
+
+void LRUPolicy::SetEvictable(PageFrame* f, bool evictable)
+{
+    candidates.Remove(f->frameId);
+    if (evictable)
+        candidates.PushBack(f->frameId);
+}
+
+PageFrame* LRUPolicy::Victim()
+{
+    int id = candidates.Front();
+    if (id == -1) return nullptr;
+    candidates.Remove(id);
+    return frames[id];
+}
+
+void LRUPolicy::Remove(PageFrame* f)
+{
+    candidates.Remove(f->frameId);
+}
+
+void LRUPolicy::NextVictims(int n, vector<PageFrame*>& out) const
+{
+    for (int id = candidates.Front(); id != -1 && static_cast<int>(out.size()) < n; id = candidates.Next(id))
+        out.push_back(frames[id]);
+}
+
+/**********************************************************
+CLOCK
+***********************************************************/
+
+ClockPolicy::ClockPolicy(const vector<PageFrame*>& frames)
+    : frames(frames), ring(static_cast<int>(frames.size())), referenced(frames.size(), 0)
+{
+}
+
+void ClockPolicy::RecordAccess(PageFrame* f, bool)
+{
+    referenced[f->frameId] = 1;
+}
+
+void ClockPolicy::SetEvictable(PageFrame* f, bool evictable)
+{
+    // a released frame joins just behind the hand
+    if (evictable && !ring.Contains(f->frameId))
+        ring.PushBack(f->frameId);
+    else if (!evictable)
+        ring.Remove(f->frameId);
+}
+
+PageFrame* ClockPolicy::Victim()
+{
+    // every frame passed over loses its reference bit, so this ends within one turn
+    while (ring.Size() > 0) {
+        int id = ring.Front();
+        ring.Remove(id);
+        if (referenced[id]) {
+            referenced[id] = 0;
+            ring.PushBack(id);
+            continue;
+        }
+        return frames[id];
+    }
+    return nullptr;
+}
+
+void ClockPolicy::Remove(PageFrame* f)
+{
+    ring.Remove(f->frameId);
+    referenced[f->frameId] = 0;
+}
+
+void ClockPolicy::NextVictims(int n, vector<PageFrame*>& out) const
+{
+    // the hand takes unreferenced frames on its first turn, the others on the second
+    for (int pass = 0; pass < 2; pass++) {
+        for (int id = ring.Front(); id != -1 && static_cast<int>(out.size()) < n; id = ring.Next(id)) {
+            if ((referenced[id] != 0) == (pass == 1))
+                out.push_back(frames[id]);
+        }
+    }
+}
+
+/**********************************************************
+LRU-K
+***********************************************************/
+
+LRUKPolicy::LRUKPolicy(const vector<PageFrame*>& frames)
+    : frames(frames), accesses(frames.size(), 0), lastAccess(frames.size(), 0), clock(0),
+    cold(static_cast<int>(frames.size())), hot(static_cast<int>(frames.size()))
+{
+}
+
+void LRUKPolicy::Link(int frameId)
+{
+    if (accesses[frameId] >= LRU_K) hot.PushBack(frameId);
+    else cold.PushBack(frameId);
+}
+
+void LRUKPolicy::RecordAccess(PageFrame* f, bool newlyLoaded)
+{
+    int id = f->frameId;
+    // accessed frames are pinned, but keep the lists consistent regardless
+    bool queued = cold.Contains(id) || hot.Contains(id);
+    cold.Remove(id);
+    hot.Remove(id);
+    // the frame starts a new history when it receives a new page
+    if (newlyLoaded) accesses[id] = 0;
+    ++clock;
+    if (accesses[id] == 0 || clock - lastAccess[id] > LRU_K_CRP)
+        accesses[id] = std::min(accesses[id] + 1, LRU_K);
+    lastAccess[id] = clock;
+    if (queued) Link(id);
+}
+
+void LRUKPolicy::SetEvictable(PageFrame* f, bool evictable)
+{
+    cold.Remove(f->frameId);
+    hot.Remove(f->frameId);
+    if (evictable)
+        Link(f->frameId);
+}
+
+PageFrame* LRUKPolicy::Victim()
+{
+    int id = cold.Front();
+    if (id != -1) {
+        cold.Remove(id);
+        return frames[id];
+    }
+    id = hot.Front();
+    if (id == -1) return nullptr;
+    hot.Remove(id);
+    return frames[id];
+}
+
+void LRUKPolicy::Remove(PageFrame* f)
+{
+    cold.Remove(f->frameId);
+    hot.Remove(f->frameId);
+    accesses[f->frameId] = 0;
+}
+
+void LRUKPolicy::NextVictims(int n, vector<PageFrame*>& out) const
+{
+    for (int id = cold.Front(); id != -1 && static_cast<int>(out.size()) < n; id = cold.Next(id))
+        out.push_back(frames[id]);
+    for (int id = hot.Front(); id != -1 && static_cast<int>(out.size()) < n; id = hot.Next(id))
+        out.push_back(frames[id]);
+}
+
+/**********************************************************
+2Q
+***********************************************************/
+
+TwoQPolicy::TwoQPolicy(const vector<PageFrame*>& frames)
+    : frames(frames),
+    a1in(static_cast<int>(frames.size())),
+    amCandidates(static_cast<int>(frames.size())),
+    queueOf(frames.size(), 0)
+{
+    // sizes suggested by the 2Q paper: A1in 25% of the pool, A1out 50%
+    kin = std::max(1, static_cast<int>(frames.size()) / 4);
+    kout = std::max<size_t>(1, frames.size() / 2);
+}
+
+void TwoQPolicy::Unlink(PageFrame* f)
+{
+    int q = queueOf[f->frameId];
+    if (q == 1) a1in.Remove(f->frameId);
+    else if (q == 2) amCandidates.Remove(f->frameId);
+    queueOf[f->frameId] = 0;
+}
+
+void TwoQPolicy::RecordAccess(PageFrame* f, bool newlyLoaded)
+{
+    /* hits in A1in are ignored (correlated references), hits in Am are
+    refreshed when the frame is released */
+    if (!newlyLoaded) return;
+    Unlink(f);
+    auto ghost = a1outIndex.find(f->pageId);
+    if (ghost != a1outIndex.end()) {
+        // evicted from A1in not long ago and wanted again: it is hot
+        a1out.erase(ghost->second);
+        a1outIndex.erase(ghost);
+        queueOf[f->frameId] = 2;
+    }
+    else {
+        a1in.PushBack(f->frameId);
+        queueOf[f->frameId] = 1;
+    }
+}
+
+void TwoQPolicy::SetEvictable(PageFrame* f, bool evictable)
+{
+    if (queueOf[f->frameId] != 2) return;
+    amCandidates.Remove(f->frameId);
+    if (evictable)
+        amCandidates.PushBack(f->frameId);
+}
+
+PageFrame* TwoQPolicy::Victim()
+{
+    int victim = -1;
+    bool triedA1in = false;
+    if (a1in.Size() > kin || amCandidates.Size() == 0) {
+        for (int id = a1in.Front(); id != -1 && victim == -1; id = a1in.Next(id)) {
+            if (frames[id]->refCount == 0) victim = id;
+        }
+        triedA1in = true;
+    }
+    if (victim == -1)
+        victim = amCandidates.Front();
+    if (victim == -1 && !triedA1in) {
+        for (int id = a1in.Front(); id != -1 && victim == -1; id = a1in.Next(id)) {
+            if (frames[id]->refCount == 0) victim = id;
+        }
+    }
+    if (victim == -1) return nullptr;
+
+    PageFrame* f = frames[victim];
+    if (queueOf[victim] == 1) {
+        // remember the page id so a quick re-reference promotes it to Am
+        a1out.push_front(f->pageId);
+        a1outIndex[f->pageId] = a1out.begin();
+        if (a1out.size() > kout) {
+            a1outIndex.erase(a1out.back());
+            a1out.pop_back();
+        }
+    }
+    Unlink(f);
+    return f;
+}
+
+void TwoQPolicy::Remove(PageFrame* f)
+{
+    Unlink(f);
+}
+
+void TwoQPolicy::NextVictims(int n, vector<PageFrame*>& out) const
+{
+    // same queue preference as Victim, then whatever is left in the other queue
+    bool a1inFirst = a1in.Size() > kin || amCandidates.Size() == 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if ((pass == 0) == a1inFirst) {
+            for (int id = a1in.Front(); id != -1 && static_cast<int>(out.size()) < n; id = a1in.Next(id)) {
+                if (frames[id]->refCount == 0)
+                    out.push_back(frames[id]);
+            }
+        }
+        else {
+            for (int id = amCandidates.Front(); id != -1 && static_cast<int>(out.size()) < n; id = amCandidates.Next(id))
+                out.push_back(frames[id]);
+        }
+    }
+}
@@ -1,19 +1,110 @@
 #include "bPlusTree.h"
+#include "LogManager.h"
+#include "KeySearch.h"
 #include <iostream>
 #include <cstring>
 #include <cctype>
+#include <algorithm>
+#include <thread>
+#include <climits>
+
+/* frame versions: a writer sets bit 0 while it holds a page and moves the
+   version on when it lets go, so a reader that sees the same even version
+   before and after reading a page knows the page did not change meanwhile */
+static uint64_t readVersion(const PageFrame* f) {
+    return f->version.load(memory_order_acquire);
+}
+
+static bool versionLocked(uint64_t v) {
+    return (v & 1) != 0;
+}
+
+static bool validateVersion(const PageFrame* f, uint64_t v) {
+    // the page reads before this must not move past the second version read
+    atomic_thread_fence(memory_order_acquire);
+    return f->version.load(memory_order_relaxed) == v;
+}
+
+static void lockVersion(PageFrame* f) {
+    uint64_t v = f->version.load(memory_order_relaxed);
+    while (versionLocked(v) || !f->version.compare_exchange_weak(v, v | 1, memory_order_acquire)) {
+        this_thread::yield();
+        v = f->version.load(memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+}
+
+static void unlockVersion(PageFrame* f) {
+    f->version.fetch_add(1, memory_order_release);
+}
 
 // Load a node from the buffer pool
-NodePage* BPlusTreePaged::loadNode(int pageId, PageFrame*& frame) const {
-    frame = buffer->FetchPage(pageId);
-    return reinterpret_cast<NodePage*>(frame->data);
+NodeHeader* BPlusTreePaged::loadNode(int pageId, PageFrame*& frame, AccessHint hint) const {
+    frame = fetchPage(pageId, hint);
+    return reinterpret_cast<NodeHeader*>(frame->data);
+}
+
+LeafPage* BPlusTreePaged::loadLeaf(int pageId, PageFrame*& frame, AccessHint hint) const {
+    return static_cast<LeafPage*>(loadNode(pageId, frame, hint));
+}
+
+InternalPage* BPlusTreePaged::loadInternal(int pageId, PageFrame*& frame) const {
+    return static_cast<InternalPage*>(loadNode(pageId, frame));
+}
+
+PageFrame* BPlusTreePaged::fetchPage(int pageId, AccessHint hint) const {
+    PageFrame* frame = buffer->FetchPage(pageId, hint);
+    if (writingPages) buffer->PrepareWrite(pageId);
+    if (latchPages) latchFrame(frame);
+    return frame;
+}
+
+void BPlusTreePaged::latchFrame(PageFrame* frame) const {
+    // a page fetched again by the same operation is already held
+    if (find(latchedFrames.begin(), latchedFrames.end(), frame) != latchedFrames.end()) return;
+    lockVersion(frame);
+    /* the lock lives in the frame, so the page has to stay in it: callers
+       unpin pages as they go, and an evicted page would come back unlocked */
+    buffer->PinPage(frame);
+    latchedFrames.push_back(frame);
+}
+
+void BPlusTreePaged::latchTree() {
+    structureLatch.lock();
+    latchPages = true;
+    writingPages = true;
+}
+
+void BPlusTreePaged::unlatchTree() {
+    /* pages stay locked until the whole split or merge is done, searches
+       that reach one in the meantime wait and start over */
+    for (PageFrame* f : latchedFrames) {
+        unlockVersion(f);
+        buffer->UnpinPage(f->pageId, false);
+    }
+    latchedFrames.clear();
+    latchPages = false;
+    writingPages = false;
+    structureLatch.unlock();
 }
 /**********************************************************
 Header Helpers
 ***********************************************************/
 void BPlusTreePaged::writeHeader() {
-    PageFrame* pf = buffer->FetchPage(0);
-    BPTreeHeader hdr{ rootPageId, hasRoot ? 1 : 0 };
+    PageFrame* pf = fetchPage(0);
+    buffer->PrepareWrite(0);
+    BPTreeHeader hdr{};
+    hdr.rootPageId = rootPageId;
+    hdr.hasRoot = hasRoot ? 1 : 0;
+    hdr.freeListHead = freeListHead;
+    hdr.freePageCount = freePageCount;
+    hdr.magic = TREE_MAGIC;
+    hdr.version = TREE_FORMAT_VERSION;
+    hdr.pageSize = PAGE_SIZE;
+    hdr.leafBytes = LEAF_CAPACITY;
+    hdr.internalBytes = INTERNAL_CAPACITY;
+    hdr.cleanShutdown = cleanShutdown ? 1 : 0;
+    hdr.source = source;
     memcpy(pf->data, &hdr, sizeof(hdr));
     buffer->UnpinPage(0, true);
 }
@@ -23,18 +114,26 @@ void BPlusTreePaged::loadHeader() {
     BPTreeHeader hdr{};
     memcpy(&hdr, pf->data, sizeof(hdr));
     buffer->UnpinPage(0, false);
+    // a file from another build (or not a tree at all) is never interpreted
+    valid = hdr.magic == TREE_MAGIC && hdr.version == TREE_FORMAT_VERSION
+        && hdr.pageSize == PAGE_SIZE && hdr.leafBytes == LEAF_CAPACITY
+        && hdr.internalBytes == INTERNAL_CAPACITY;
+    if (!valid) return;
     rootPageId = hdr.rootPageId;
     hasRoot = (hdr.hasRoot != 0);
+    // page 0 is never free
+    freeListHead = (hdr.freeListHead > 0) ? hdr.freeListHead : -1;
+    freePageCount = (freeListHead != -1) ? hdr.freePageCount : 0;
+    cleanShutdown = (hdr.cleanShutdown != 0);
+    source = hdr.source;
 }
 
 // Bloom filter helper: rebuild from keys in a leaf node
-void BPlusTreePaged::rebuildBloom(NodePage* node) {
+void BPlusTreePaged::rebuildBloom(LeafPage* node) {
     node->bloom.clear();
-    if (!node->isLeaf) {
-        return;
-    }
+    char key[MAX_KEY_BYTES];
     for (int i = 0; i < node->size; ++i) {
-        node->bloom.add(node->keys[i]);
+        node->bloom.add(key, node->keyBytes(i, key));
     }
 }
 
@@ -42,50 +141,588 @@ void BPlusTreePaged::rebuildBloom(NodePage* node) {
 Constructor
 ***********************************************************/
 BPlusTreePaged::BPlusTreePaged(BufferPool* buffer, FileDiskManager* disk)
-    : buffer(buffer), disk(disk), rootPageId(-1), hasRoot(false)
+    : buffer(buffer), disk(disk), rootPageId(-1), hasRoot(false),
+    freeListHead(-1), freePageCount(0), log(nullptr),
+    valid(false), openedClean(true), cleanShutdown(true), source{},
+    latchPages(false), writingPages(false)
 {
     if (disk->GetNumPages() == 0) {
         // Create EMPTY metadata page 0
-        int       pid;
-        PageFrame* pf = buffer->NewPage(pid);
-        BPTreeHeader hdr{ -1, 0 };
-        memcpy(pf->data, &hdr, sizeof(hdr));
+        int pid;
+        buffer->NewPage(pid);
         buffer->UnpinPage(pid, true);
+        writeHeader();
     }
-    else {
-        // if there's more than 0 pages the header should exist
-        loadHeader();
+    // if there's more than 0 pages the header should exist
+    loadHeader();
+    if (!valid) {
+        cerr << "WARNING: tree header does not match this build, the file has to be rebuilt\n";
         return;
     }
-
-    // Now load header from page 0
-    loadHeader();
+    openedClean = cleanShutdown;
+    // the file stays marked as in use until close() runs
+    cleanShutdown = false;
+    writeHeader();
+    buffer->WritePage(0);
+    disk->Sync();
 }
 
 
 /**********************************************************
-Node Creation Methods
+Leaf Page Helpers
 ***********************************************************/
 
-int BPlusTreePaged::createLeafNode() {
-    //create page int to store the page id from new page
-    int pid;
-    PageFrame* pf = buffer->NewPage(pid);
-    //Zero out entire page to prevent stale data
-    memset(pf->data, 0, PAGE_SIZE);
-    NodePage* n = reinterpret_cast<NodePage*>(pf->data);
-    n->isLeaf = true;
-    n->size = 0;
-    n->nextLeaf = -1;
+void LeafPage::init() {
+    isLeaf = true;
+    size = 0;
+    nextLeaf = -1;
+    heapStart = PAGE_SIZE;
+    deadBytes = 0;
+    prefixLen = 0;
+    bloom.clear();
+}
+
+void LeafPage::setPrefix(const char* bytes, int len) {
+    prefixLen = min(max(len, 0), MAX_KEY_BYTES);
+    memcpy(prefix, bytes, prefixLen);
+}
+
+int LeafPage::prefixBytes() const {
+    int n = prefixLen;
+    return n < 0 ? 0 : min(n, MAX_KEY_BYTES);
+}
+
+int LeafPage::comparePrefix(const KeyRef& key) const {
+    int p = prefixBytes();
+    int c = memcmp(key.data, prefix, min(p, key.len));
+    if (c != 0) return c < 0 ? -1 : 1;
+    // a key that is only part of the prefix is below every key with all of it
+    return key.len < p ? -1 : 0;
+}
 
-    for (int i = 0; i < MAX_KEYS; ++i) {
-        n->keys[i] = 0;
+int LeafPage::entryBytes(int keyLen, const foodItem& item) {
+    size_t nameLen = strnlen(item.foodName, sizeof(item.foodName) - 1);
+    return static_cast<int>(sizeof(LeafSlot) + sizeof(LeafRecord) + 1 + keyTailBytes(keyLen) + nameLen);
+}
+
+/* the key bytes of a record after its head and the key length, kept inside
+   the page whatever a racing writer left in the slot */
+static const char* recordKeyTail(const LeafPage* leaf, const LeafSlot& s, int& len) {
+    const int keyAt = static_cast<int>(sizeof(LeafRecord));
+    int offset = min(static_cast<int>(s.offset), PAGE_SIZE - keyAt - 1);
+    const char* rec = reinterpret_cast<const char*>(leaf) + offset;
+    len = min({ static_cast<int>(static_cast<unsigned char>(rec[keyAt])), MAX_KEY_BYTES - leaf->prefixBytes(),
+        KEY_HEAD_BYTES + PAGE_SIZE - offset - keyAt - 1 });
+    return rec + keyAt + 1;
+}
+
+// a whole key from its head and the bytes after it, returns its length
+static int joinKey(int head, const char* tail, int len, char* out) {
+    uint32_t h = static_cast<uint32_t>(head) ^ 0x80000000u;
+    for (int b = 0; b < min(len, KEY_HEAD_BYTES); ++b) {
+        out[b] = static_cast<char>(h >> (8 * (KEY_HEAD_BYTES - 1 - b)));
+    }
+    if (len > KEY_HEAD_BYTES) memcpy(out + KEY_HEAD_BYTES, tail, len - KEY_HEAD_BYTES);
+    return len;
+}
+
+int LeafPage::keyBytes(int i, char* out) const {
+    const LeafSlot& s = slots()[i];
+    int p = prefixBytes();
+    memcpy(out, prefix, p);
+    int len;
+    const char* tail = recordKeyTail(this, s, len);
+    return p + joinKey(s.head, tail, len, out + p);
+}
+
+string LeafPage::key(int i) const {
+    char buf[MAX_KEY_BYTES];
+    return string(buf, keyBytes(i, buf));
+}
+
+int LeafPage::compareSuffix(int i, const KeyRef& rest) const {
+    const LeafSlot& s = slots()[i];
+    // most keys are told apart by the head in the slot, without a look at the record
+    if (s.head != rest.head) return s.head < rest.head ? -1 : 1;
+    int len;
+    const char* tail = recordKeyTail(this, s, len);
+    return compareKey(s.head, tail, len, rest);
+}
+
+int LeafPage::compareAt(int i, const KeyRef& key) const {
+    // a key without the prefix sorts on the same side of every key in the page
+    int c = comparePrefix(key);
+    if (c != 0) return -c;
+    int p = prefixBytes();
+    return compareSuffix(i, KeyRef(key.data + p, key.len - p));
+}
+
+foodItem LeafPage::item(int i) const {
+    LeafSlot s = slots()[i];
+    LeafRecord r;
+    int keyLen;
+    const char* tail = recordKeyTail(this, s, keyLen);
+    const char* rec = tail - 1 - sizeof(r);
+    memcpy(&r, rec, sizeof(r));
+    foodItem out;
+    // the name follows the key, kept inside the page and the name buffer as the key is
+    int nameAt = static_cast<int>(sizeof(r)) + 1 + keyTailBytes(keyLen);
+    int nameLen = min({ s.length - nameAt, static_cast<int>(sizeof(out.foodName)) - 1,
+        PAGE_SIZE - static_cast<int>(rec - reinterpret_cast<const char*>(this)) - nameAt });
+    nameLen = max(nameLen, 0);
+    memcpy(out.foodName, rec + nameAt, nameLen);
+    out.foodName[nameLen] = '\0';
+    out.proteinAmt = r.proteinAmt;
+    out.calorieAmt = r.calorieAmt;
+    out.cost = r.cost;
+    return out;
+}
+
+int LeafPage::slotCount() const {
+    static const int MAX_SLOTS = LEAF_CAPACITY / static_cast<int>(sizeof(LeafSlot));
+    int n = size;
+    return n < 0 ? 0 : min(n, MAX_SLOTS);
+}
+
+long long InternalPage::total() const {
+    int n = keyCount();
+    const int* c = counts();
+    long long sum = 0;
+    for (int i = 0; i <= n; ++i) {
+        sum += c[i];
+    }
+    return sum;
+}
+
+long long BPlusTreePaged::nodeCount(const NodeHeader* node) {
+    if (node->isLeaf) return static_cast<const LeafPage*>(node)->slotCount();
+    return static_cast<const InternalPage*>(node)->total();
+}
+
+int LeafPage::lowerBound(const KeyRef& key) const {
+    int len = slotCount();
+    int c = comparePrefix(key);
+    if (len == 0 || c < 0) return 0;
+    if (c > 0) return len;
+    // binary search over the slot directory with the prefix taken off once, as keyUpperBound does
+    int p = prefixBytes();
+    KeyRef rest(key.data + p, key.len - p);
+    int base = 0;
+    while (len > 1) {
+        int half = len / 2;
+        base = (compareSuffix(base + half - 1, rest) < 0) ? base + half : base;
+        len -= half;
+    }
+    return base + (compareSuffix(base, rest) < 0);
+}
+
+int LeafPage::usedBytes() const {
+    return size * static_cast<int>(sizeof(LeafSlot)) + (PAGE_SIZE - heapStart - deadBytes);
+}
+
+void LeafPage::writeRecord(int offset, const char* tail, int keyLen, const foodItem& item, int length) {
+    char* rec = reinterpret_cast<char*>(this) + offset;
+    LeafRecord r{ item.proteinAmt, item.calorieAmt, item.cost };
+    memcpy(rec, &r, sizeof(r));
+    rec[sizeof(r)] = static_cast<char>(keyLen);
+    int tailLen = keyTailBytes(keyLen);
+    // a record rewritten in place passes its own key bytes
+    memmove(rec + sizeof(r) + 1, tail, tailLen);
+    memcpy(rec + sizeof(r) + 1 + tailLen, item.foodName, length - sizeof(r) - 1 - tailLen);
+}
+
+bool LeafPage::insertAt(int i, const KeyRef& key, const foodItem& item) {
+    // keys of the leaf's range all have the prefix, only the rest is stored
+    if (comparePrefix(key) != 0) {
+        return false;
+    }
+    int p = prefixBytes();
+    KeyRef rest(key.data + p, key.len - p);
+    int bytes = entryBytes(rest.len, item);
+    if (usedBytes() + bytes > LEAF_CAPACITY) {
+        return false;
+    }
+    int length = bytes - static_cast<int>(sizeof(LeafSlot));
+    // the gap between the directory and the heap has to take the new slot and record
+    int slotsEnd = static_cast<int>(sizeof(LeafPage) + (size + 1) * sizeof(LeafSlot));
+    if (heapStart - length < slotsEnd) {
+        compact();
+    }
+    heapStart -= length;
+    writeRecord(heapStart, rest.data + KEY_HEAD_BYTES, rest.len, item, length);
+    LeafSlot* s = slots();
+    memmove(s + i + 1, s + i, (size - i) * sizeof(LeafSlot));
+    s[i] = LeafSlot{ rest.head, static_cast<uint16_t>(heapStart), static_cast<uint16_t>(length) };
+    size++;
+    return true;
+}
+
+bool LeafPage::replaceAt(int i, const foodItem& item) {
+    LeafSlot& s = slots()[i];
+    int keyLen;
+    const char* tail = recordKeyTail(this, s, keyLen);
+    int length = entryBytes(keyLen, item) - static_cast<int>(sizeof(LeafSlot));
+    // a record that does not grow is rewritten where it is
+    if (length <= s.length) {
+        deadBytes += s.length - length;
+        writeRecord(s.offset, tail, keyLen, item, length);
+        s.length = static_cast<uint16_t>(length);
+        return true;
     }
+    if (usedBytes() - s.length + length > LEAF_CAPACITY) {
+        return false;
+    }
+    string k = key(i);
+    eraseAt(i);
+    return insertAt(i, KeyRef(k), item);
+}
+
+void LeafPage::eraseAt(int i) {
+    LeafSlot* s = slots();
+    // the lowest record gives its bytes straight back, others wait for compact()
+    if (s[i].offset == heapStart) {
+        heapStart += s[i].length;
+    }
+    else {
+        deadBytes += s[i].length;
+    }
+    memmove(s + i, s + i + 1, (size - i - 1) * sizeof(LeafSlot));
+    size--;
+    if (size == 0) {
+        heapStart = PAGE_SIZE;
+        deadBytes = 0;
+    }
+}
+
+void LeafPage::collect(vector<pair<string, foodItem>>& out) const {
+    for (int i = 0; i < size; ++i) {
+        out.emplace_back(key(i), item(i));
+    }
+}
+
+void LeafPage::compact() {
+    // copy the live records out, then pack them against the end of the page
+    char heap[PAGE_SIZE];
+    char* page = reinterpret_cast<char*>(this);
+    LeafSlot* s = slots();
+    int top = PAGE_SIZE;
+    for (int i = 0; i < size; ++i) {
+        top -= s[i].length;
+        memcpy(heap + top, page + s[i].offset, s[i].length);
+        s[i].offset = static_cast<uint16_t>(top);
+    }
+    memcpy(page + top, heap + top, PAGE_SIZE - top);
+    heapStart = top;
+    deadBytes = 0;
+}
+
+/**********************************************************
+Internal Page Helpers
+***********************************************************/
+
+void InternalPage::init() {
+    isLeaf = false;
+    size = 0;
+    capacity = INTERNAL_MAX_KEYS;
+    heapStart = PAGE_SIZE;
+    deadBytes = 0;
     /*due to 0 being a valid page set children to -1 so you dont
     infinitely recurse through the tree*/
-    for (int i = 0; i < MAX_CHILDREN; ++i) {
-        n->children[i] = -1;
+    children()[0] = -1;
+    counts()[0] = 0;
+}
+
+int InternalPage::entryBytes(int keyLen) {
+    return INTERNAL_SLOT_BYTES + keyTailBytes(keyLen);
+}
+
+int InternalPage::arrayCapacity() const {
+    int c = capacity;
+    return c < 0 ? 0 : min(c, INTERNAL_MAX_KEYS);
+}
+
+int InternalPage::keyCount() const {
+    int n = size;
+    return n < 0 ? 0 : min(n, arrayCapacity());
+}
+
+// as recordKeyTail(), for separator i of an internal page
+static const char* separatorTail(const InternalPage* node, int i, int& len) {
+    InternalTail t = node->tails()[i];
+    len = min(static_cast<int>(t.length), MAX_KEY_BYTES);
+    int offset = min(static_cast<int>(t.offset), PAGE_SIZE - keyTailBytes(len));
+    return reinterpret_cast<const char*>(node) + offset;
+}
+
+string InternalPage::key(int i) const {
+    char buf[MAX_KEY_BYTES];
+    int len;
+    const char* tail = separatorTail(this, i, len);
+    return string(buf, joinKey(heads()[i], tail, len, buf));
+}
+
+int InternalPage::compareAt(int i, const KeyRef& key) const {
+    int head = heads()[i];
+    if (head != key.head) return head < key.head ? -1 : 1;
+    int len;
+    const char* tail = separatorTail(this, i, len);
+    return compareKey(head, tail, len, key);
+}
+
+/* first separator > key (or >= key with orEqual): the SIMD search over the
+   heads finds the run of separators that share the key's head, and only
+   inside that run are the bytes after the heads compared */
+static int separatorBound(const InternalPage* node, const KeyRef& key, bool orEqual) {
+    int n = node->keyCount();
+    const int* heads = node->heads();
+    int hi = keyUpperBound(heads, n, key.head);
+    if (hi == 0 || heads[hi - 1] != key.head) return hi;
+    int lo = (key.head == INT_MIN) ? 0 : keyUpperBound(heads, hi, key.head - 1);
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int c = node->compareAt(mid, key);
+        if (c < 0 || (c == 0 && !orEqual)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int InternalPage::upperBound(const KeyRef& key) const {
+    return separatorBound(this, key, false);
+}
+
+int InternalPage::lowerBound(const KeyRef& key) const {
+    return separatorBound(this, key, true);
+}
+
+int InternalPage::usedBytes() const {
+    return size * INTERNAL_SLOT_BYTES + (PAGE_SIZE - heapStart - deadBytes);
+}
+
+bool InternalPage::insertAt(int i, const KeyRef& key, int child, int count) {
+    if (usedBytes() + entryBytes(key.len) > INTERNAL_CAPACITY) {
+        return false;
+    }
+    int tailLen = keyTailBytes(key.len);
+    int arraysEnd = static_cast<int>(reinterpret_cast<char*>(tails() + capacity) - reinterpret_cast<char*>(this));
+    if (size == capacity || heapStart - tailLen < arraysEnd) {
+        // the arrays or the heap are out of room: lay the node out again with the entry in it
+        vector<InternalEntry> entries;
+        collect(entries);
+        entries.insert(entries.begin() + i + 1, InternalEntry{ string(key.data, key.len), child, count });
+        fill(entries, 0, static_cast<int>(entries.size()));
+        return true;
+    }
+    heapStart -= tailLen;
+    memcpy(reinterpret_cast<char*>(this) + heapStart, key.data + KEY_HEAD_BYTES, tailLen);
+    int* h = heads();
+    int* c = children();
+    int* n = counts();
+    InternalTail* t = tails();
+    memmove(h + i + 1, h + i, (size - i) * sizeof(int));
+    memmove(t + i + 1, t + i, (size - i) * sizeof(InternalTail));
+    memmove(c + i + 2, c + i + 1, (size - i) * sizeof(int));
+    memmove(n + i + 2, n + i + 1, (size - i) * sizeof(int));
+    h[i] = key.head;
+    t[i] = InternalTail{ static_cast<uint16_t>(heapStart), static_cast<uint16_t>(key.len) };
+    c[i + 1] = child;
+    n[i + 1] = count;
+    size++;
+    return true;
+}
+
+void InternalPage::eraseAt(int i) {
+    int* h = heads();
+    int* c = children();
+    int* n = counts();
+    InternalTail* t = tails();
+    // the lowest separator gives its bytes straight back, others wait for the next layout
+    int tailLen = keyTailBytes(t[i].length);
+    if (t[i].offset == heapStart) {
+        heapStart += tailLen;
+    }
+    else {
+        deadBytes += tailLen;
+    }
+    memmove(h + i, h + i + 1, (size - i - 1) * sizeof(int));
+    memmove(t + i, t + i + 1, (size - i - 1) * sizeof(InternalTail));
+    memmove(c + i + 1, c + i + 2, (size - i - 1) * sizeof(int));
+    memmove(n + i + 1, n + i + 2, (size - i - 1) * sizeof(int));
+    size--;
+    if (size == 0) {
+        heapStart = PAGE_SIZE;
+        deadBytes = 0;
+    }
+}
+
+bool InternalPage::replaceKeyAt(int i, const KeyRef& key) {
+    InternalTail& t = tails()[i];
+    int oldLen = keyTailBytes(t.length);
+    int newLen = keyTailBytes(key.len);
+    // a separator that does not grow is rewritten where it is
+    if (newLen <= oldLen) {
+        memcpy(reinterpret_cast<char*>(this) + t.offset, key.data + KEY_HEAD_BYTES, newLen);
+        deadBytes += oldLen - newLen;
+        heads()[i] = key.head;
+        t.length = static_cast<uint16_t>(key.len);
+        return true;
+    }
+    if (usedBytes() - oldLen + newLen > INTERNAL_CAPACITY) {
+        return false;
+    }
+    vector<InternalEntry> entries;
+    collect(entries);
+    entries[i + 1].key.assign(key.data, key.len);
+    fill(entries, 0, static_cast<int>(entries.size()));
+    return true;
+}
+
+void InternalPage::collect(vector<InternalEntry>& out) const {
+    for (int i = 0; i <= size; ++i) {
+        out.push_back(InternalEntry{ i == 0 ? string() : key(i - 1), children()[i], counts()[i] });
     }
+}
+
+void InternalPage::fill(const vector<InternalEntry>& entries, int from, int to) {
+    int keys = to - from - 1;
+    int tailBytes = 0;
+    for (int j = from + 1; j < to; ++j) {
+        tailBytes += keyTailBytes(KeyRef(entries[j].key).len);
+    }
+    /* the free bytes are shared between the arrays and the separator heap as the
+       keys already here share them, so either can grow without a new layout */
+    int freeBytes = max(INTERNAL_CAPACITY - keys * INTERNAL_SLOT_BYTES - tailBytes, 0);
+    int avgBytes = INTERNAL_SLOT_BYTES + (keys > 0 ? tailBytes / keys : 0);
+    capacity = min(INTERNAL_MAX_KEYS, keys + freeBytes / avgBytes);
+    size = 0;
+    heapStart = PAGE_SIZE;
+    deadBytes = 0;
+    int* h = heads();
+    int* c = children();
+    int* n = counts();
+    InternalTail* t = tails();
+    c[0] = entries[from].child;
+    n[0] = entries[from].count;
+    for (int j = from + 1; j < to; ++j) {
+        KeyRef key(entries[j].key);
+        int tailLen = keyTailBytes(key.len);
+        heapStart -= tailLen;
+        memcpy(reinterpret_cast<char*>(this) + heapStart, key.data + KEY_HEAD_BYTES, tailLen);
+        h[size] = key.head;
+        t[size] = InternalTail{ static_cast<uint16_t>(heapStart), static_cast<uint16_t>(key.len) };
+        c[size + 1] = entries[j].child;
+        n[size + 1] = entries[j].count;
+        size++;
+    }
+}
+
+/**********************************************************
+Page Allocation
+***********************************************************/
+
+PageFrame* BPlusTreePaged::allocatePage(int& pid) {
+    if (freeListHead == -1) {
+        PageFrame* pf = buffer->NewPage(pid);
+        if (latchPages) latchFrame(pf);
+        return pf;
+    }
+    // pop the head of the free list
+    pid = freeListHead;
+    PageFrame* pf = fetchPage(pid);
+    FreePageHeader fp;
+    memcpy(&fp, pf->data, sizeof(fp));
+    memset(pf->data, 0, PAGE_SIZE);
+    unlinkFreePage(pid, -1, fp.nextFree);
+    writeHeader();
+    return pf;
+}
+
+PageFrame* BPlusTreePaged::fetchFreePage(int pid) {
+    PageFrame* pf = buffer->FetchPage(pid);
+    if (writingPages) buffer->PrepareWrite(pid);
+    return pf;
+}
+
+void BPlusTreePaged::unlinkFreePage(int pid, int prevFree, int nextFree) {
+    if (prevFree != -1) {
+        PageFrame* pf = fetchFreePage(prevFree);
+        reinterpret_cast<FreePageHeader*>(pf->data)->nextFree = nextFree;
+        buffer->UnpinPage(prevFree, true);
+    }
+    else if (freeListHead == pid) {
+        freeListHead = nextFree;
+    }
+    if (nextFree != -1) {
+        PageFrame* pf = fetchFreePage(nextFree);
+        reinterpret_cast<FreePageHeader*>(pf->data)->prevFree = prevFree;
+        buffer->UnpinPage(nextFree, true);
+    }
+    freePageCount--;
+}
+
+bool BPlusTreePaged::isFreePage(int pid) {
+    PageFrame* pf = fetchFreePage(pid);
+    FreePageHeader fp;
+    memcpy(&fp, pf->data, sizeof(fp));
+    buffer->UnpinPage(pid, false);
+    if (fp.magic != FREE_PAGE_MAGIC) return false;
+    // the links have to agree, a node page could hold the same bytes
+    if (fp.prevFree == -1) return freeListHead == pid;
+    PageFrame* prev = fetchFreePage(fp.prevFree);
+    bool linked = reinterpret_cast<FreePageHeader*>(prev->data)->nextFree == pid;
+    buffer->UnpinPage(fp.prevFree, false);
+    return linked;
+}
+
+void BPlusTreePaged::freePage(int pid) {
+    if (pid <= 0) return;
+    int last = disk->GetNumPages() - 1;
+    if (pid == last) {
+        /* the last page can go straight back to the filesystem, then keep
+        trimming while the new last page is also on the free list */
+        buffer->DiscardPage(pid);
+        disk->Truncate(pid);
+        last = pid - 1;
+        while (last > 0 && isFreePage(last)) {
+            PageFrame* pf = fetchFreePage(last);
+            FreePageHeader fp;
+            memcpy(&fp, pf->data, sizeof(fp));
+            buffer->UnpinPage(last, false);
+            unlinkFreePage(last, fp.prevFree, fp.nextFree);
+            buffer->DiscardPage(last);
+            disk->Truncate(last);
+            last--;
+        }
+        writeHeader();
+        return;
+    }
+    // push onto the head of the free list
+    PageFrame* pf = fetchPage(pid);
+    memset(pf->data, 0, PAGE_SIZE);
+    FreePageHeader fp{ FREE_PAGE_MAGIC, -1, freeListHead };
+    memcpy(pf->data, &fp, sizeof(fp));
+    buffer->UnpinPage(pid, true);
+    if (freeListHead != -1) {
+        PageFrame* hf = fetchFreePage(freeListHead);
+        reinterpret_cast<FreePageHeader*>(hf->data)->prevFree = pid;
+        buffer->UnpinPage(freeListHead, true);
+    }
+    freeListHead = pid;
+    freePageCount++;
+    writeHeader();
+}
+
+/**********************************************************
+Node Creation Methods
+***********************************************************/
+
+int BPlusTreePaged::createLeafNode() {
+    //create page int to store the page id from new page
+    int pid;
+    //page comes back zeroed from allocatePage
+    PageFrame* pf = allocatePage(pid);
+    LeafPage* n = reinterpret_cast<LeafPage*>(pf->data);
+    n->init();
     buffer->UnpinPage(pid, true);
     return pid;
 }
@@ -93,21 +730,10 @@ int BPlusTreePaged::createLeafNode() {
 int BPlusTreePaged::createInternalNode() {
     //create page int to store the page id from new page
     int pid;
-    PageFrame* pf = buffer->NewPage(pid);
-    //Zero out entire page to prevent stale data
-    memset(pf->data, 0, PAGE_SIZE);
-    NodePage* n = reinterpret_cast<NodePage*>(pf->data);
-    n->isLeaf = false;
-    n->size = 0;
-    n->nextLeaf = -1;
-    for (int i = 0; i < MAX_KEYS; ++i) {
-        n->keys[i] = 0;
-    }
-    /*due to 0 being a valid page set children to -1 so you dont
-    infinitely recurse through the tree*/
-    for (int i = 0; i < MAX_CHILDREN; ++i) {
-        n->children[i] = -1;
-    }
+    //page comes back zeroed from allocatePage
+    PageFrame* pf = allocatePage(pid);
+    InternalPage* n = reinterpret_cast<InternalPage*>(pf->data);
+    n->init();
     buffer->UnpinPage(pid, true);
     return pid;
 }
@@ -116,532 +742,1015 @@ int BPlusTreePaged::createInternalNode() {
 Tree Management Helpers
 ***********************************************************/
 
-BPlusTreePaged::InsertResult BPlusTreePaged::insertRecursive(int pageId, int key, const foodItem& item) {
+BPlusTreePaged::InsertResult BPlusTreePaged::insertRecursive(int pageId, const KeyRef& key, const foodItem& item,
+    const string& low, const string& high) {
     PageFrame* frame;
-    NodePage* node = loadNode(pageId, frame);
+    NodeHeader* header = loadNode(pageId, frame);
     // Case 1: Leaf
-    if (node->isLeaf) {
+    if (header->isLeaf) {
+        LeafPage* node = static_cast<LeafPage*>(header);
+        int pos = node->lowerBound(key);
         // Duplicate keys are overwritten
-        for (int i = 0; i < node->size; ++i) {
-            if (node->keys[i] == key) {
-                // Update existing entry
-                node->items[i] = item;
+        bool existed = pos < node->size && node->compareAt(pos, key) == 0;
+        if (existed) {
+            if (node->replaceAt(pos, item)) {
                 buffer->UnpinPage(pageId, true);
                 return InsertResult(false);
             }
+            // the longer record no longer fits, it goes in again through a split
+            node->eraseAt(pos);
         }
-        // Case 1.a: leaf is not full
-        if (node->size < MAX_KEYS) {
-            int i = node->size - 1;
-            while (i >= 0 && key < node->keys[i]) {
-                node->keys[i + 1] = node->keys[i];
-                node->items[i + 1] = node->items[i];
-                --i;
-            }
-            node->keys[i + 1] = key;
-            node->items[i + 1] = item;
-            node->size++;
+        // Case 1.a: leaf has room for the record
+        if (node->insertAt(pos, key, item)) {
             rebuildBloom(node);
-
             buffer->UnpinPage(pageId, true);
-            return InsertResult(false);
+            return InsertResult(false, string(), -1, !existed);
         }
         // Case 1.b: Leaf is full and needs to be split
-        /*first make temporary copies of page parameters
-        with one extra space to store new key*/
-        const int TOT = MAX_KEYS + 1;
-        int tKeys[TOT];
-        foodItem  tItems[TOT];
-        for (int i = 0; i < MAX_KEYS; ++i) {
-            tKeys[i] = node->keys[i];
-            tItems[i] = node->items[i];
-        }
-        // Insert new key into temporary array
-        int i = MAX_KEYS - 1;
-        while (i >= 0 && key < tKeys[i]) {
-            tKeys[i + 1] = tKeys[i];
-            tItems[i + 1] = tItems[i];
-            --i;
-        }
-        tKeys[i + 1] = key;
-        tItems[i + 1] = item;
-        // left gets first mid elements, right gets rest
-        int mid = TOT / 2;
-        node->size = mid;
-        for (int j = 0; j < mid; ++j) {
-            node->keys[j] = tKeys[j];
-            node->items[j] = tItems[j];
-        }
-        rebuildBloom(node);
+        // first copy the entries out with the new one in its place
+        vector<pair<string, foodItem>> entries;
+        node->collect(entries);
+        entries.insert(entries.begin() + pos, make_pair(string(key.data, key.len), item));
+        // left keeps the first half of the bytes, right gets the rest
+        int total = static_cast<int>(entries.size());
+        int mid = splitByBytes(entries, 0, total, low, high);
+        // only as much of the right leaf's first key as tells it from the left leaf goes up
+        string upKey = shortestSeparator(entries[mid - 1].first, entries[mid].first);
+        int oldNext = node->nextLeaf;
+        fillLeaf(node, entries, 0, mid, low, upKey);
         int newLeaf = createLeafNode();
         PageFrame* nf;
-        NodePage* nl = loadNode(newLeaf, nf);
-        // store the rest of the temp array in the new leaf
-        nl->size = TOT - mid;
-        for (int j = 0; j < nl->size; ++j) {
-            nl->keys[j] = tKeys[mid + j];
-            nl->items[j] = tItems[mid + j];
-        }
-        nl->nextLeaf = node->nextLeaf;
+        LeafPage* nl = loadLeaf(newLeaf, nf);
+        fillLeaf(nl, entries, mid, total, upKey, high);
+        nl->nextLeaf = oldNext;
         node->nextLeaf = newLeaf;
-        rebuildBloom(nl);
-        //keys track of left most key in new node for recursive propagation upwards
-        int upKey = nl->keys[0];
+        int rightCount = nl->size;
         buffer->UnpinPage(pageId, true);
         buffer->UnpinPage(newLeaf, true);
-        return InsertResult(true, upKey, newLeaf);
+        return InsertResult(true, upKey, newLeaf, !existed, rightCount);
     }
 
     //Case 2: Internal
-    int idx = 0;
-    while (idx < node->size && key >= node->keys[idx]) {
-        ++idx;
-    }
-    int childId = node->children[idx];
+    InternalPage* node = static_cast<InternalPage*>(header);
+    int idx = node->upperBound(key);
+    int childId = node->children()[idx];
+    // the child's range lies between the separators on either side of it
+    string childLow = idx > 0 ? node->key(idx - 1) : low;
+    string childHigh = idx < node->size ? node->key(idx) : high;
     buffer->UnpinPage(pageId, false);
     //Case 2.a: Split if the child has not been split no need to propate upKey
     /*VERY IMPORTANT: Recursively call on the children till you insert in the leaf
     and propagate the child's id/if it split/key that is getting brought upward information*/
-    InsertResult cres = insertRecursive(childId, key, item);
-    if (!cres.split) {
+    InsertResult cres = insertRecursive(childId, key, item, childLow, childHigh);
+    if (!cres.split && !cres.added) {
         return InsertResult(false);
     }
     PageFrame* frame2;
-    NodePage* n2 = loadNode(pageId, frame2);
+    InternalPage* n2 = loadInternal(pageId, frame2);
+    // a new record below: one more under the child
+    if (!cres.split) {
+        n2->counts()[idx]++;
+        buffer->UnpinPage(pageId, true);
+        return InsertResult(false, string(), -1, true);
+    }
+    // the child's records are now shared between it and its new right sibling
+    int leftCount = n2->counts()[idx] + (cres.added ? 1 : 0) - cres.rightCount;
     //Case 2.b: Need to insert promoted key into this internal node
-    //Case 2.b.i internal node is not full insert normally
-    if (n2->size < MAX_KEYS) {
-        int i = n2->size - 1;
-        while (i >= 0 && cres.newKey < n2->keys[i]) {
-            n2->keys[i + 1] = n2->keys[i];
-            n2->children[i + 2] = n2->children[i + 1];
-            --i;
-        }
-        n2->keys[i + 1] = cres.newKey;
-        n2->children[i + 2] = cres.newRight;
-        n2->size++;
-
+    //Case 2.b.i internal node has room for it, the separator goes right of the child
+    if (n2->insertAt(idx, KeyRef(cres.newKey), cres.newRight, cres.rightCount)) {
+        n2->counts()[idx] = leftCount;
         buffer->UnpinPage(pageId, true);
-        return InsertResult(false);
+        return InsertResult(false, string(), -1, cres.added);
     }
     //Case 2.b.ii internal node is full and has to be split
-    const int TOTK = MAX_KEYS + 1;
-    int       tKeys[TOTK];
-    int       tChild[TOTK + 1];
-    for (int i = 0; i < n2->size; ++i) {
-        tKeys[i] = n2->keys[i];
-    }
-    for (int i = 0; i < n2->size + 1; ++i) {
-        tChild[i] = n2->children[i];
-    }
-    int i = n2->size - 1;
-    while (i >= 0 && cres.newKey < tKeys[i]) {
-        tKeys[i + 1] = tKeys[i];
-        tChild[i + 2] = tChild[i + 1];
-        --i;
-    }
-    tKeys[i + 1] = cres.newKey;
-    tChild[i + 2] = cres.newRight;
-    int mid = TOTK / 2;
-    int upKey = tKeys[mid];
-    n2->size = mid;
-    for (int j = 0; j < mid; ++j) {
-        n2->keys[j] = tKeys[j];
-        n2->children[j] = tChild[j];
-    }
-    n2->children[mid] = tChild[mid];
+    // as a leaf: copy the entries out with the new one in, then split them by bytes
+    vector<InternalEntry> entries;
+    n2->collect(entries);
+    entries[idx].count = leftCount;
+    entries.insert(entries.begin() + idx + 1, InternalEntry{ cres.newKey, cres.newRight, cres.rightCount });
+    int mid = splitByBytes(entries);
+    // the separator left of the right node's first child moves up
+    string upKey = entries[mid].key;
+    n2->fill(entries, 0, mid);
     int       newInt = createInternalNode();
     PageFrame* ff;
-    NodePage* ni = loadNode(newInt, ff);
-    ni->size = TOTK - mid - 1;
-    for (int j = 0; j < ni->size; ++j) {
-        ni->keys[j] = tKeys[mid + 1 + j];
-        ni->children[j] = tChild[mid + 1 + j];
-    }
-    ni->children[ni->size] = tChild[TOTK];
+    InternalPage* ni = loadInternal(newInt, ff);
+    ni->fill(entries, mid, static_cast<int>(entries.size()));
+    int rightCount = static_cast<int>(ni->total());
     buffer->UnpinPage(pageId, true);
     buffer->UnpinPage(newInt, true);
-    return InsertResult(true, upKey, newInt);
+    return InsertResult(true, upKey, newInt, cres.added, rightCount);
 }
 
-bool BPlusTreePaged::deleteRecursive(int pageId, int key, bool& removed) {
+bool BPlusTreePaged::deleteRecursive(int pageId, const KeyRef& key, bool& removed, const string& low, const string& high) {
     PageFrame* pf;
-    NodePage* node = loadNode(pageId, pf);
-    const int  MIN_KEYS = ORDER;
+    NodeHeader* header = loadNode(pageId, pf);
 
     // Case 1: Leaf
-    if (node->isLeaf) {
-        int idx = -1;
-        for (int i = 0; i < node->size; ++i) {
-            if (node->keys[i] == key) { idx = i; break; }
-        }
-        if (idx == -1) {
+    if (header->isLeaf) {
+        LeafPage* node = static_cast<LeafPage*>(header);
+        int idx = node->lowerBound(key);
+        if (idx == node->size || node->compareAt(idx, key) != 0) {
             buffer->UnpinPage(pageId, false);
             removed = false;
             return false;
         }
         // Remove key/item
-        for (int i = idx; i < node->size - 1; ++i) {
-            node->keys[i] = node->keys[i + 1];
-            node->items[i] = node->items[i + 1];
-        }
-        node->size--;
+        node->eraseAt(idx);
         rebuildBloom(node);
         removed = true;
-        bool underflow = (pageId != rootPageId && node->size < MIN_KEYS);
+        bool underflow = (pageId != rootPageId && node->usedBytes() < LEAF_MIN_BYTES);
         buffer->UnpinPage(pageId, true);
         return underflow;
     }
 
     // Case 2: Internal
-    int idx = 0;
-    while (idx < node->size && key >= node->keys[idx]) {
-        ++idx;
-    }
-    int childId = node->children[idx];
+    InternalPage* node = static_cast<InternalPage*>(header);
+    int idx = node->upperBound(key);
+    int childId = node->children()[idx];
+    string childLow = idx > 0 ? node->key(idx - 1) : low;
+    string childHigh = idx < node->size ? node->key(idx) : high;
     buffer->UnpinPage(pageId, false);
     /*
     Recurse till you get to the leaf and remove the node if possible:
     if it was removed and there was no underflow or the node was not 
     there return false
     */
-    bool childUnderflow = deleteRecursive(childId, key, removed);
+    bool childUnderflow = deleteRecursive(childId, key, removed, childLow, childHigh);
     if (!removed) {
         return false;
     }
-    if (!childUnderflow) {
-        return false;
-    }
-    //Case 2.a: search for child and remove it or return false if not found
     PageFrame* pf2;
-    NodePage* parent = loadNode(pageId, pf2);
-    int childIdx = -1;
-    for (int i = 0; i <= parent->size; ++i) {
-        if (parent->children[i] == childId) {
-            childIdx = i; break;
+    InternalPage* parent = loadInternal(pageId, pf2);
+    // one record less under the child
+    parent->counts()[idx]--;
+    //Case 2.a: Handle underflow of the child
+    bool underflowHere = childUnderflow && rebalanceChild(pageId, parent, idx, low, high);
+    buffer->UnpinPage(pageId, true);
+    return underflowHere;
+}
+
+bool BPlusTreePaged::rebalanceChild(int pageId, InternalPage* parent, int childIdx, const string& low, const string& high) {
+    // a node left with a single child has no sibling to work with, its parent handles it
+    if (parent->size == 0) {
+        return pageId != rootPageId;
+    }
+    /* nodes differ in bytes per entry, so a node does not borrow one entry at a
+    time: it is merged with a sibling when both fit in one page, otherwise the
+    entries of the two are shared out evenly by bytes */
+    int sepIdx = (childIdx > 0) ? childIdx - 1 : childIdx;
+    int leftPid = parent->children()[sepIdx];
+    int rightPid = parent->children()[sepIdx + 1];
+    PageFrame* lf;
+    NodeHeader* left = loadNode(leftPid, lf);
+    PageFrame* rf;
+    NodeHeader* right = loadNode(rightPid, rf);
+    bool merge;
+    if (left->isLeaf) {
+        LeafPage* l = static_cast<LeafPage*>(left);
+        LeafPage* r = static_cast<LeafPage*>(right);
+        vector<pair<string, foodItem>> entries;
+        l->collect(entries);
+        r->collect(entries);
+        int total = static_cast<int>(entries.size());
+        // the two leaves together cover the range between the separators around them
+        string leftLow = sepIdx > 0 ? parent->key(sepIdx - 1) : low;
+        string rightHigh = sepIdx + 1 < parent->size ? parent->key(sepIdx + 1) : high;
+        // a wider range can have a shorter prefix, so the merged leaf is measured anew
+        merge = leafBytes(entries, 0, total, leftLow, rightHigh) <= LEAF_CAPACITY;
+        if (merge) {
+            fillLeaf(l, entries, 0, total, leftLow, rightHigh);
+            l->nextLeaf = r->nextLeaf;
+        }
+        else {
+            int mid = splitByBytes(entries, 0, total, leftLow, rightHigh);
+            string sep = shortestSeparator(entries[mid - 1].first, entries[mid].first);
+            /* the new separator can be longer than the old one and either leaf's
+            prefix shorter; a parent that has no room for it, or a leaf that would
+            not fit, keeps the child underfull, which is still a valid tree */
+            if (leafBytes(entries, 0, mid, leftLow, sep) > LEAF_CAPACITY
+                || leafBytes(entries, mid, total, sep, rightHigh) > LEAF_CAPACITY
+                || !parent->replaceKeyAt(sepIdx, KeyRef(sep))) {
+                buffer->UnpinPage(leftPid, false);
+                buffer->UnpinPage(rightPid, false);
+                return false;
+            }
+            fillLeaf(l, entries, 0, mid, leftLow, sep);
+            fillLeaf(r, entries, mid, total, sep, rightHigh);
+            parent->counts()[sepIdx] = l->size;
+            parent->counts()[sepIdx + 1] = r->size;
         }
     }
-    if (childIdx == -1) {
-        buffer->UnpinPage(pageId, false);
+    else {
+        InternalPage* l = static_cast<InternalPage*>(left);
+        InternalPage* r = static_cast<InternalPage*>(right);
+        vector<InternalEntry> entries;
+        l->collect(entries);
+        size_t rightFirst = entries.size();
+        r->collect(entries);
+        // the parent's separator comes down between the two
+        entries[rightFirst].key = parent->key(sepIdx);
+        merge = l->usedBytes() + r->usedBytes() + InternalPage::entryBytes(KeyRef(entries[rightFirst].key).len)
+            <= INTERNAL_CAPACITY;
+        if (merge) {
+            l->fill(entries, 0, static_cast<int>(entries.size()));
+        }
+        else {
+            int mid = splitByBytes(entries);
+            if (!parent->replaceKeyAt(sepIdx, KeyRef(entries[mid].key))) {
+                buffer->UnpinPage(leftPid, false);
+                buffer->UnpinPage(rightPid, false);
+                return false;
+            }
+            l->fill(entries, 0, mid);
+            r->fill(entries, mid, static_cast<int>(entries.size()));
+            parent->counts()[sepIdx] = static_cast<int>(l->total());
+            parent->counts()[sepIdx + 1] = static_cast<int>(r->total());
+        }
+    }
+    if (!merge) {
+        buffer->UnpinPage(leftPid, true);
+        buffer->UnpinPage(rightPid, true);
         return false;
     }
-    int leftIdx = (childIdx > 0) ? childIdx - 1 : -1;
-    int rightIdx = (childIdx < parent->size) ? childIdx + 1 : -1;
-    int leftId = (leftIdx != -1) ? parent->children[leftIdx] : -1;
-    int rightId = (rightIdx != -1) ? parent->children[rightIdx] : -1;
-    PageFrame* cf;
-    NodePage* child = loadNode(childId, cf);
-    const bool childIsLeaf = child->isLeaf;
-    //Case 2.b: Handle underflow
-    // Try to borrow from the left siblling 
-    if (leftId != -1) {
-        PageFrame* lf;
-        NodePage* left = loadNode(leftId, lf);
-        // if removing a key from the sibling doesn make it underflow
-        if (left->size > MIN_KEYS) {
-            // if it is a leaf adjust leaf only parameters
-            if (childIsLeaf) {
-                for (int i = child->size; i > 0; --i) {
-                    child->keys[i] = child->keys[i - 1];
-                    child->items[i] = child->items[i - 1];
+    // the right page is now empty and goes onto the free list below
+    buffer->UnpinPage(rightPid, false);
+    buffer->UnpinPage(leftPid, true);
+    parent->counts()[sepIdx] += parent->counts()[sepIdx + 1];
+    parent->eraseAt(sepIdx);
+    freePage(rightPid);
+    return pageId != rootPageId && parent->usedBytes() < INTERNAL_MIN_BYTES;
+}
+
+/**********************************************************
+Printing
+***********************************************************/
+
+void BPlusTreePaged::printNodeWithItems(int pageId, int depth) const {
+    if (pageId < 0) return;
+    PageFrame* pf;
+    NodeHeader* node = loadNode(pageId, pf);
+    const LeafPage* leaf = static_cast<const LeafPage*>(node);
+    const InternalPage* inner = static_cast<const InternalPage*>(node);
+    // indentation by depth
+    for (int i = 0; i < depth; i++)
+        cout << "    ";
+    // Header
+    cout << (node->isLeaf ? "[Leaf] " : "[Int ] ")
+        << "Page " << pageId
+        << " | size=" << node->size;
+    if (node->isLeaf)
+        cout << " | nextLeaf=" << leaf->nextLeaf;
+    cout << "\n";
+    // Print keys
+    for (int i = 0; i < depth; i++)
+        cout << "    ";
+    cout << "    Keys: ";
+    for (int i = 0; i < node->size; i++)
+        cout << (node->isLeaf ? leaf->key(i) : inner->key(i)) << (i + 1 < node->size ? ", " : "");
+    cout << "\n";
+    // If LEAF: print full foodItem records
+    if (node->isLeaf) {
+        for (int i = 0; i < node->size; i++) {
+            for (int j = 0; j < depth; j++)
+                cout << "    ";
+            foodItem f = leaf->item(i);
+            cout << "        "
+                << "key=" << leaf->key(i)
+                << " | name=\"" << f.foodName << "\""
+                << " | protein=" << f.proteinAmt
+                << " | calories=" << f.calorieAmt
+                << " | cost=" << f.cost << "\n";
+        }
+    }
+    // If INTERNAL: print child pointers
+    if (!node->isLeaf) {
+        for (int i = 0; i < depth; i++)
+            cout << "    ";
+        cout << "    Children: ";
+        for (int i = 0; i <= node->size; i++) {
+            cout << inner->children()[i];
+            if (i < node->size) cout << ", ";
+        }
+        cout << "\n";
+    }
+    buffer->UnpinPage(pageId, false);
+    // Recurse
+    if (!node->isLeaf) {
+        for (int i = 0; i <= node->size; i++) {
+            int child = inner->children()[i];
+            if (child != -1)
+                printNodeWithItems(child, depth + 1);
+        }
+    }
+}
+
+void BPlusTreePaged::printTree() const {
+    // the leaves are printed as they are, so no writer may run meanwhile
+    unique_lock<shared_mutex> guard(structureLatch);
+    cout << "\n========== B+ TREE (WITH FOOD ITEMS) ==========\n";
+    if (!hasRoot) {
+        cout << "(empty tree)\n";
+        return;
+    }
+    printNodeWithItems(rootPageId, 0);
+    cout << "================================================\n";
+}
+
+/**********************************************************
+Key Encoding
+***********************************************************/
+
+int keyHead(const char* key, int len)
+{
+    uint32_t head = 0;
+    for (int i = 0; i < KEY_HEAD_BYTES; ++i) {
+        head = (head << 8) | (i < len ? static_cast<unsigned char>(key[i]) : 0u);
+    }
+    // with the sign bit flipped int order is the order of the bytes
+    return static_cast<int>(head ^ 0x80000000u);
+}
+
+int compareKey(int head, const char* tail, int len, const KeyRef& key)
+{
+    if (head != key.head) return head < key.head ? -1 : 1;
+    // equal heads: the bytes after them decide, then the shorter key comes first
+    int n = min(len, key.len) - KEY_HEAD_BYTES;
+    if (n > 0) {
+        int c = memcmp(tail, key.data + KEY_HEAD_BYTES, n);
+        if (c != 0) return c;
+    }
+    return (len > key.len) - (len < key.len);
+}
+
+// Encodes the key for storage
+string foodKey(const string& name)
+{
+    // the zero byte sorts a name before every longer name it is the start of
+    string key = foodKeyPrefix(name);
+    key.push_back('\0');
+    size_t caseAt = key.size();
+    key.resize(caseAt + (name.size() + 7) / 8, '\0');
+    for (size_t i = 0; i < name.size(); ++i) {
+        if (islower(static_cast<unsigned char>(name[i])))
+            key[caseAt + i / 8] = static_cast<char>(key[caseAt + i / 8] | (0x80 >> (i % 8)));
+    }
+    return key;
+}
+
+string foodKeyPrefix(const string& namePrefix)
+{
+    string key = namePrefix;
+    for (char& ch : key) {
+        ch = static_cast<char>(toupper(static_cast<unsigned char>(ch)));
+    }
+    return key;
+}
+
+string intKey(int value)
+{
+    uint32_t u = static_cast<uint32_t>(value) ^ 0x80000000u;
+    char bytes[4] = { static_cast<char>(u >> 24), static_cast<char>(u >> 16),
+        static_cast<char>(u >> 8), static_cast<char>(u) };
+    return string(bytes, sizeof(bytes));
+}
+
+const string& maxKey()
+{
+    static const string key(MAX_KEY_BYTES, '\xff');
+    return key;
+}
+
+string prefixEnd(const string& prefix)
+{
+    // no key of up to MAX_KEY_BYTES that starts with prefix sorts after this
+    string end = prefix.substr(0, MAX_KEY_BYTES);
+    end.resize(MAX_KEY_BYTES, '\xff');
+    return end;
+}
+
+int commonPrefix(const string& a, const string& b)
+{
+    size_t n = min({ a.size(), b.size(), static_cast<size_t>(MAX_KEY_BYTES) });
+    size_t i = 0;
+    while (i < n && a[i] == b[i]) {
+        ++i;
+    }
+    return static_cast<int>(i);
+}
+
+string shortestSeparator(const string& left, const string& right)
+{
+    // right up to the first byte it differs from left in: above left and a prefix of right
+    return right.substr(0, commonPrefix(left, right) + 1);
+}
+
+/**********************************************************
+Tree Management
+***********************************************************/
+bool BPlusTreePaged::insert(const string& key,
+    const string& name,
+    int protein,
+    int calories,
+    double cost) {
+    // a key is never cut, one that does not fit would stand for others
+    if (key.size() > static_cast<size_t>(MAX_KEY_BYTES)) return false;
+    foodItem item(name, protein, calories, cost);
+    bool done;
+    {
+        shared_lock<shared_mutex> guard(structureLatch);
+        done = tryLeafInsert(key, item);
+    }
+    // the leaf has to split (or there is no tree yet)
+    if (!done) {
+        latchTree();
+        applyInsert(key, item);
+        if (log) {
+            lock_guard<mutex> guard(logLatch);
+            log->LogInsert(key, item);
+        }
+        unlatchTree();
+    }
+    maybeCheckpoint();
+    return true;
+}
+
+bool BPlusTreePaged::remove(const string& key) {
+    // no stored key is that long
+    if (key.size() > static_cast<size_t>(MAX_KEY_BYTES)) return false;
+    bool removed;
+    bool done;
+    {
+        shared_lock<shared_mutex> guard(structureLatch);
+        done = tryLeafRemove(key, removed);
+    }
+    // the leaf would underflow (or it is the last record of the root)
+    if (!done) {
+        latchTree();
+        removed = applyRemove(key);
+        if (removed && log) {
+            lock_guard<mutex> guard(logLatch);
+            log->LogRemove(key);
+        }
+        unlatchTree();
+    }
+    maybeCheckpoint();
+    return removed;
+}
+
+size_t BPlusTreePaged::insertBatch(vector<pair<string, foodItem>>& records) {
+    size_t n = sortRecords(records);
+    if (n == 0) return 0;
+    if (!hasRoot) return bulkLoad(records);
+    return insertSorted(records);
+}
+
+size_t BPlusTreePaged::insertSorted(const vector<pair<string, foodItem>>& records) {
+    /* pinned nodes from the root down to the current leaf, each with the end of
+       its key range; internal nodes only change under the exclusive latch, so
+       the path stays good for as long as the shared latch is held */
+    vector<PathNode> path;
+    shared_lock<shared_mutex> guard(structureLatch);
+    size_t i = 0;
+    while (i < records.size()) {
+        const string& key = records[i].first;
+        // climb to the lowest node whose range still holds the key
+        while (!path.empty() && path.back().bounded && key >= path.back().upper) {
+            buffer->UnpinPage(path.back().pageId, path.back().dirty);
+            path.pop_back();
+        }
+        bool split = !hasRoot;
+        if (!split) {
+            if (path.empty()) {
+                PageFrame* rf;
+                int rootId = rootPageId;
+                loadNode(rootId, rf);
+                path.push_back({ rootId, rf, -1, string(), false, false });
+            }
+            // then down to the leaf for the key
+            KeyRef ref(key);
+            while (!reinterpret_cast<NodeHeader*>(path.back().frame->data)->isLeaf) {
+                InternalPage* node = reinterpret_cast<InternalPage*>(path.back().frame->data);
+                int idx = node->upperBound(ref);
+                bool bounded = idx < node->size || path.back().bounded;
+                string upper = idx < node->size ? node->key(idx) : path.back().upper;
+                int childId = node->children()[idx];
+                path.back().childIdx = idx;
+                PageFrame* cf;
+                loadNode(childId, cf);
+                path.push_back({ childId, cf, -1, upper, bounded, false });
+            }
+            // every record up to the end of the leaf's range goes in under one lock
+            PathNode leafNode = path.back();
+            path.pop_back();
+            LeafPage* leaf = reinterpret_cast<LeafPage*>(leafNode.frame->data);
+            lockVersion(leafNode.frame);
+            buffer->PrepareWrite(leafNode.pageId);
+            size_t first = i;
+            int added = 0;
+            for (; i < records.size() && (!leafNode.bounded || records[i].first < leafNode.upper); ++i) {
+                const pair<string, foodItem>& r = records[i];
+                KeyRef rk(r.first);
+                int pos = leaf->lowerBound(rk);
+                bool existed = pos < leaf->size && leaf->compareAt(pos, rk) == 0;
+                bool fits = existed ? leaf->replaceAt(pos, r.second) : leaf->insertAt(pos, rk, r.second);
+                if (!fits) {
+                    split = true;
+                    break;
                 }
-                child->keys[0] = left->keys[left->size - 1];
-                child->items[0] = left->items[left->size - 1];
-                child->size++;
-                left->size--;
-                parent->keys[leftIdx] = child->keys[0];
-                rebuildBloom(child);
-                rebuildBloom(left);
+                if (!existed) added++;
             }
-            else { // if it is internal adjust internal only params
-                for (int i = child->size; i > 0; --i) {
-                    child->keys[i] = child->keys[i - 1];
-                    child->children[i + 1] = child->children[i];
+            countOnPath(path, added);
+            if (i > first) {
+                rebuildBloom(leaf);
+                if (log) {
+                    lock_guard<mutex> logGuard(logLatch);
+                    for (size_t j = first; j < i; ++j) {
+                        log->LogInsert(records[j].first, records[j].second);
+                    }
                 }
-                child->children[1] = child->children[0];
-                child->keys[0] = parent->keys[leftIdx];
-                child->children[0] = left->children[left->size];
-                parent->keys[leftIdx] = left->keys[left->size - 1];
-                child->size++;
-                left->size--;
             }
-            buffer->UnpinPage(leftId, true);
-            buffer->UnpinPage(childId, true);
-            buffer->UnpinPage(pageId, true);
-            return false;
+            unlockVersion(leafNode.frame);
+            buffer->UnpinPage(leafNode.pageId, i > first);
         }
-        buffer->UnpinPage(leftId, false);
-    }
-    // Try to borrow from right sibling
-    if (rightId != -1) {
-        PageFrame* rf;
-        NodePage* right = loadNode(rightId, rf);
-        if (right->size > MIN_KEYS) {
-            if (childIsLeaf) {
-                child->keys[child->size] = right->keys[0];
-                child->items[child->size] = right->items[0];
-                child->size++;
-                for (int i = 0; i < right->size - 1; ++i) {
-                    right->keys[i] = right->keys[i + 1];
-                    right->items[i] = right->items[i + 1];
-                }
-                right->size--;
-                parent->keys[childIdx] = right->keys[0];
-                rebuildBloom(child);
-                rebuildBloom(right);
+        if (split) {
+            // the record that did not fit goes in alone under the exclusive latch
+            unpinPath(path);
+            guard.unlock();
+            latchTree();
+            applyInsert(records[i].first, records[i].second);
+            if (log) {
+                lock_guard<mutex> logGuard(logLatch);
+                log->LogInsert(records[i].first, records[i].second);
             }
-            else {
-                child->keys[child->size] = parent->keys[childIdx];
-                child->children[child->size + 1] = right->children[0];
-                child->size++;
-                parent->keys[childIdx] = right->keys[0];
-                for (int i = 0; i < right->size - 1; ++i) {
-                    right->keys[i] = right->keys[i + 1];
-                    right->children[i] = right->children[i + 1];
-                }
-                right->children[right->size - 1] = right->children[right->size];
-                right->size--;
+            unlatchTree();
+            guard.lock();
+            ++i;
+        }
+    }
+    unpinPath(path);
+    guard.unlock();
+    maybeCheckpoint();
+    return records.size();
+}
+
+int BPlusTreePaged::descendToLeaf(const KeyRef& key, PageFrame*& frame, vector<PathNode>& path) const {
+    // internal nodes only change under the exclusive latch
+    int cur = rootPageId;
+    while (true) {
+        NodeHeader* header = loadNode(cur, frame);
+        if (header->isLeaf) {
+            return cur;
+        }
+        InternalPage* n = static_cast<InternalPage*>(header);
+        int idx = n->upperBound(key);
+        path.push_back({ cur, frame, idx, string(), false, false });
+        cur = n->children()[idx];
+    }
+}
+
+void BPlusTreePaged::countOnPath(vector<PathNode>& path, int delta) const {
+    if (delta == 0) return;
+    for (PathNode& p : path) {
+        buffer->PrepareWrite(p.pageId);
+        InternalPage* n = reinterpret_cast<InternalPage*>(p.frame->data);
+        __atomic_fetch_add(&n->counts()[p.childIdx], delta, __ATOMIC_RELAXED);
+        p.dirty = true;
+    }
+}
+
+void BPlusTreePaged::unpinPath(vector<PathNode>& path) const {
+    for (const PathNode& p : path) {
+        buffer->UnpinPage(p.pageId, p.dirty);
+    }
+    path.clear();
+}
+
+bool BPlusTreePaged::tryLeafInsert(const string& key, const foodItem& item) {
+    if (!hasRoot) return false;
+    KeyRef ref(key);
+    PageFrame* pf;
+    vector<PathNode> path;
+    int leafPage = descendToLeaf(ref, pf, path);
+    lockVersion(pf);
+    buffer->PrepareWrite(leafPage);
+    LeafPage* leaf = reinterpret_cast<LeafPage*>(pf->data);
+    int pos = leaf->lowerBound(ref);
+    bool done;
+    // neither call changes the page when the record does not fit
+    if (pos < leaf->size && leaf->compareAt(pos, ref) == 0) {
+        done = leaf->replaceAt(pos, item);
+    }
+    else {
+        done = leaf->insertAt(pos, ref, item);
+        if (done) {
+            rebuildBloom(leaf);
+            countOnPath(path, 1);
+        }
+    }
+    // logged under the leaf lock so writes to one key reach the log in the order they were made
+    if (done && log) {
+        lock_guard<mutex> guard(logLatch);
+        log->LogInsert(key, item);
+    }
+    unlockVersion(pf);
+    buffer->UnpinPage(leafPage, done);
+    unpinPath(path);
+    return done;
+}
+
+bool BPlusTreePaged::tryLeafRemove(const string& key, bool& removed) {
+    removed = false;
+    if (!hasRoot) return true;
+    KeyRef ref(key);
+    PageFrame* pf;
+    vector<PathNode> path;
+    int leafPage = descendToLeaf(ref, pf, path);
+    lockVersion(pf);
+    buffer->PrepareWrite(leafPage);
+    LeafPage* leaf = reinterpret_cast<LeafPage*>(pf->data);
+    int idx = leaf->lowerBound(ref);
+    bool done = true;
+    if (idx < leaf->size && leaf->compareAt(idx, ref) == 0) {
+        // the same underflow test deleteRecursive makes after the erase
+        int after = leaf->usedBytes() - static_cast<int>(sizeof(LeafSlot)) - leaf->slots()[idx].length;
+        if (leafPage == rootPageId ? leaf->size == 1 : after < LEAF_MIN_BYTES) {
+            done = false;
+        }
+        else {
+            leaf->eraseAt(idx);
+            rebuildBloom(leaf);
+            countOnPath(path, -1);
+            removed = true;
+            if (log) {
+                lock_guard<mutex> guard(logLatch);
+                log->LogRemove(key);
             }
-            buffer->UnpinPage(rightId, true);
-            buffer->UnpinPage(childId, true);
-            buffer->UnpinPage(pageId, true);
-            return false;
         }
-        buffer->UnpinPage(rightId, false);
     }
-    // merge the two nodes
-    int mergeLeftIdx;
-    int leftPid, rightPid;
-    if (leftId != -1) {
-        mergeLeftIdx = leftIdx;
-        leftPid = leftId;
-        rightPid = childId;
+    unlockVersion(pf);
+    buffer->UnpinPage(leafPage, removed);
+    unpinPath(path);
+    return done;
+}
+
+int BPlusTreePaged::splitPoint(const vector<int>& weights, int from, int count) {
+    int total = 0;
+    for (int i = from; i < from + count; ++i) {
+        total += weights[i];
+    }
+    // take entries while the first part stays within half of the weight
+    int taken = 0;
+    int half = 0;
+    while (taken < count - 1 && 2 * (half + weights[from + taken]) <= total) {
+        half += weights[from + taken++];
+    }
+    // one more entry if that lands closer to the middle
+    if (taken < count - 1 && 2 * (half + weights[from + taken]) - total < total - 2 * half) {
+        taken++;
+    }
+    return max(taken, 1);
+}
+
+// page bytes of entries [from, to) in a leaf whose prefix is prefix bytes long
+static int prefixedBytes(const vector<pair<string, foodItem>>& entries, int from, int to, int prefix) {
+    int bytes = 0;
+    for (int i = from; i < to; ++i) {
+        bytes += LeafPage::entryBytes(static_cast<int>(entries[i].first.size()) - prefix, entries[i].second);
+    }
+    return bytes;
+}
+
+int BPlusTreePaged::leafBytes(const vector<pair<string, foodItem>>& entries, int from, int to,
+    const string& low, const string& high) {
+    // every key of the range has the bytes its two ends start with, the page keeps them once
+    return prefixedBytes(entries, from, to, commonPrefix(low, high));
+}
+
+int BPlusTreePaged::splitByBytes(const vector<pair<string, foodItem>>& entries, int from, int to,
+    const string& low, const string& high) {
+    // bytes of the left and the right leaf when the right one starts at entry k
+    auto sides = [&](int k) {
+        string sep = shortestSeparator(entries[k - 1].first, entries[k].first);
+        return make_pair(leafBytes(entries, from, k, low, sep), leafBytes(entries, k, to, sep, high));
+    };
+    /* a leaf that takes more entries also gets a wider range and so no longer
+       a prefix, the left leaf only grows with k and the right one only shrinks:
+       find the first split where the left has at least the bytes of the right */
+    int lo = from + 1;
+    int hi = to - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        pair<int, int> s = sides(mid);
+        if (s.first >= s.second) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    // one entry less if that leaves the larger leaf smaller
+    if (lo > from + 1) {
+        pair<int, int> a = sides(lo - 1);
+        pair<int, int> b = sides(lo);
+        if (max(a.first, a.second) < max(b.first, b.second)) {
+            lo--;
+        }
     }
-    else {
-        mergeLeftIdx = childIdx;
-        leftPid = childId;
-        rightPid = rightId;
+    return lo;
+}
+
+int BPlusTreePaged::splitByBytes(const vector<InternalEntry>& entries) {
+    vector<int> bytes;
+    bytes.reserve(entries.size());
+    for (const auto& e : entries) {
+        bytes.push_back(InternalPage::entryBytes(KeyRef(e.key).len));
     }
-    PageFrame* lf;
-    NodePage* left = loadNode(leftPid, lf);
-    PageFrame* rf2;
-    NodePage* right = loadNode(rightPid, rf2);
-    //set leaf params
-    if (childIsLeaf) {
-        for (int i = 0; i < right->size; ++i) {
-            left->keys[left->size + i] = right->keys[i];
-            left->items[left->size + i] = right->items[i];
-        }
-        left->size += right->size;
-        left->nextLeaf = right->nextLeaf;
-        rebuildBloom(left);
-    }
-    else { //set internal params
-        int oldL = left->size;
-        left->keys[oldL] = parent->keys[mergeLeftIdx];
-        left->children[oldL + 1] = right->children[0];
-
-        for (int i = 0; i < right->size; ++i) {
-            left->keys[oldL + 1 + i] = right->keys[i];
-            left->children[oldL + 2 + i] = right->children[i + 1];
-        }
-        left->size = oldL + 1 + right->size;
-    }
-    // Mark the right page as deleted by zeroing it out
-    right->isLeaf = childIsLeaf;
-    right->size = 0;
-    right->nextLeaf = -1;
-    right->bloom.clear();
-    buffer->UnpinPage(rightPid, true);  // Write the zeroed page
-    for (int i = mergeLeftIdx; i < parent->size - 1; ++i) {
-        parent->keys[i] = parent->keys[i + 1];
-        parent->children[i + 1] = parent->children[i + 2];
-    }
-    parent->size--;
-    bool underflowHere = (pageId != rootPageId && parent->size < MIN_KEYS);
-    buffer->UnpinPage(leftPid, true);
-    buffer->UnpinPage(pageId, true);
-    buffer->UnpinPage(childId, false);
-    return underflowHere;
+    return splitPoint(bytes, 0, static_cast<int>(entries.size()));
 }
 
-/**********************************************************
-Printing
-***********************************************************/
+void BPlusTreePaged::fillLeaf(LeafPage* leaf, const vector<pair<string, foodItem>>& entries, int from, int to,
+    const string& low, const string& high) {
+    int nextLeaf = leaf->nextLeaf;
+    leaf->init();
+    leaf->nextLeaf = nextLeaf;
+    leaf->setPrefix(high.data(), commonPrefix(low, high));
+    for (int i = from; i < to; ++i) {
+        leaf->insertAt(leaf->size, KeyRef(entries[i].first), entries[i].second);
+    }
+    rebuildBloom(leaf);
+}
 
-void BPlusTreePaged::printNodeWithItems(int pageId, int depth) const {
-    if (pageId < 0) return;
-    PageFrame* pf;
-    NodePage* node = loadNode(pageId, pf);
-    // indentation by depth
-    for (int i = 0; i < depth; i++)
-        cout << "    ";
-    // Header
-    cout << (node->isLeaf ? "[Leaf] " : "[Int ] ")
-        << "Page " << pageId
-        << " | size=" << node->size;
-    if (node->isLeaf)
-        cout << " | nextLeaf=" << node->nextLeaf;
-    cout << "\n";
-    // Print keys
-    for (int i = 0; i < depth; i++)
-        cout << "    ";
-    cout << "    Keys: ";
-    for (int i = 0; i < node->size; i++)
-        cout << node->keys[i] << (i + 1 < node->size ? ", " : "");
-    cout << "\n";
-    // If LEAF: print full foodItem records
-    if (node->isLeaf) {
-        for (int i = 0; i < node->size; i++) {
-            for (int j = 0; j < depth; j++)
-                cout << "    ";
-            const foodItem& f = node->items[i];
-            cout << "        "
-                << "key=" << node->keys[i]
-                << " | name=\"" << f.foodName << "\""
-                << " | protein=" << f.proteinAmt
-                << " | calories=" << f.calorieAmt
-                << " | cost=" << f.cost << "\n";
+vector<int> BPlusTreePaged::bulkGroups(const vector<int>& weights, int per, int minPer, int maxPer) {
+    vector<int> groups;
+    vector<int> groupWeights;
+    for (int w : weights) {
+        if (groups.empty() || groupWeights.back() + w > per) {
+            groups.push_back(0);
+            groupWeights.push_back(0);
         }
+        groups.back()++;
+        groupWeights.back() += w;
     }
-    // If INTERNAL: print child pointers
-    if (!node->isLeaf) {
-        for (int i = 0; i < depth; i++)
-            cout << "    ";
-        cout << "    Children: ";
-        for (int i = 0; i <= node->size; i++) {
-            cout << node->children[i];
-            if (i < node->size) cout << ", ";
+    // a light last node is merged into its neighbour, or the two share evenly
+    if (groups.size() > 1 && groupWeights.back() < minPer) {
+        int count = groups.back() + groups[groups.size() - 2];
+        int total = groupWeights.back() + groupWeights[groupWeights.size() - 2];
+        groups.pop_back();
+        if (total <= maxPer) {
+            groups.back() = count;
         }
-        cout << "\n";
-    }
-    buffer->UnpinPage(pageId, false);
-    // Recurse
-    if (!node->isLeaf) {
-        for (int i = 0; i <= node->size; i++) {
-            int child = node->children[i];
-            if (child != -1)
-                printNodeWithItems(child, depth + 1);
+        else {
+            int first = splitPoint(weights, static_cast<int>(weights.size()) - count, count);
+            groups.back() = first;
+            groups.push_back(count - first);
         }
     }
+    return groups;
 }
 
-void BPlusTreePaged::printTree() const {
-    cout << "\n========== B+ TREE (WITH FOOD ITEMS) ==========\n";
-    if (!hasRoot) {
-        cout << "(empty tree)\n";
-        return;
+vector<int> BPlusTreePaged::leafGroups(const vector<pair<string, foodItem>>& records, int per) {
+    /* as bulkGroups, but a leaf's bytes depend on its prefix: a leaf that ends
+       at record i reaches up to the separator after i, and the further that is
+       the fewer bytes its range may have in common with the separator in front */
+    int n = static_cast<int>(records.size());
+    /* one pass over the keys: the bytes each record takes but its key, its key
+       length and what it has in common with the next key. Sorted keys share
+       with a later key the least any two keys in between share, so prefixes
+       are found from these without going back to the keys */
+    vector<int> fixedBytes(n);
+    vector<int> keyLens(n);
+    vector<int> nextCommon(n, 0);
+    for (int i = 0; i < n; ++i) {
+        // sorting left the key bytes scattered over the heap, start loading them early
+        if (i + 8 < n) __builtin_prefetch(records[i + 8].first.data());
+        fixedBytes[i] = LeafPage::entryBytes(0, records[i].second);
+        keyLens[i] = static_cast<int>(records[i].first.size());
+        if (i + 1 < n) nextCommon[i] = commonPrefix(records[i].first, records[i + 1].first);
     }
-    printNodeWithItems(rootPageId, 0);
-    cout << "================================================\n";
+    auto recordBytes = [&](int i, int p) {
+        return fixedBytes[i] + keyTailBytes(keyLens[i] - p);
+    };
+    vector<int> groups;
+    int from = 0;
+    int lowLen = 0;   // the separator in front of the current leaf is its first key cut to this
+    int shared = 0;   // bytes the leaf's keys and the key after them have in common
+    int prefix = 0;
+    int bytes = 0;    // of the current leaf up to record i
+    /* prefix of the current leaf if it ends at record i: its range reaches up
+       to the next key cut one byte past nextCommon[i], the last leaf's up to maxKey() */
+    auto prefixTo = [&](int i) {
+        if (i + 1 < n) return min(lowLen, shared);
+        return commonPrefix(records[from].first.substr(0, lowLen), maxKey());
+    };
+    for (int i = 0; i < n; ++i) {
+        shared = (i == from) ? nextCommon[i] : min(shared, nextCommon[i]);
+        int p = prefixTo(i);
+        int b = bytes + recordBytes(i, p);
+        // a shorter prefix adds bytes to every record already in
+        if (i > from && p != prefix) {
+            b = 0;
+            for (int j = from; j <= i; ++j) {
+                b += recordBytes(j, p);
+            }
+        }
+        if (i > from && b > per) {
+            groups.push_back(i - from);
+            from = i;
+            lowLen = nextCommon[i - 1] + 1;
+            shared = nextCommon[i];
+            p = prefixTo(i);
+            b = recordBytes(i, p);
+        }
+        prefix = p;
+        bytes = b;
+    }
+    groups.push_back(n - from);
+    // a light last leaf is merged into its neighbour, or the two share evenly
+    if (groups.size() > 1 && bytes < LEAF_MIN_BYTES) {
+        int count = groups.back() + groups[groups.size() - 2];
+        int start = n - count;
+        string before = start > 0 ? shortestSeparator(records[start - 1].first, records[start].first) : string();
+        if (leafBytes(records, start, n, before, maxKey()) <= LEAF_CAPACITY) {
+            groups.pop_back();
+            groups.back() = count;
+        }
+        else {
+            int mid = splitByBytes(records, start, n, before, maxKey());
+            string sep = shortestSeparator(records[mid - 1].first, records[mid].first);
+            if (leafBytes(records, start, mid, before, sep) <= LEAF_CAPACITY
+                && leafBytes(records, mid, n, sep, maxKey()) <= LEAF_CAPACITY) {
+                groups[groups.size() - 2] = mid - start;
+                groups.back() = n - mid;
+            }
+        }
+    }
+    return groups;
 }
 
-/**********************************************************
-Hashing Helpers
-***********************************************************/
-
-static inline uint16_t prefix16(const string& s)
-{
-    // Encode first 12 chars into 16 bits
-    unsigned char c1 = 'A';
-    unsigned char c2 = 0;  // 0 means "no second char"
-    if (!s.empty()) {
-        c1 = static_cast<unsigned char>(
-            toupper(static_cast<unsigned char>(s[0])));
-    }
-    if (s.size() >= 2) {
-        c2 = static_cast<unsigned char>(
-            toupper(static_cast<unsigned char>(s[1])));
+size_t BPlusTreePaged::sortRecords(vector<pair<string, foodItem>>& records) {
+    // keys too long to store are dropped, as insert() refuses them
+    records.erase(remove_if(records.begin(), records.end(),
+        [](const pair<string, foodItem>& r) { return r.first.size() > static_cast<size_t>(MAX_KEY_BYTES); }),
+        records.end());
+    // stable so equal keys stay in input order, then keep the last of each run
+    stable_sort(records.begin(), records.end(),
+        [](const pair<string, foodItem>& a, const pair<string, foodItem>& b) { return a.first < b.first; });
+    size_t n = 0;
+    for (size_t i = 0; i < records.size(); ++i) {
+        if (i + 1 < records.size() && records[i + 1].first == records[i].first) continue;
+        records[n++] = records[i];
     }
-    return static_cast<uint16_t>((uint16_t(c1) << 8) | uint16_t(c2));
+    records.resize(n);
+    return n;
 }
 
-// Encodes the key for storage
-int alphabeticalKey32(const string& s)
-{
-    //upper 16 bits from characters
-    uint16_t pref = prefix16(s);
-    // Lower 16 bits from hash
-    uint16_t h = static_cast<uint16_t>(hash<string>{}(s) & 0xFFFFu
-        );
-    uint32_t key = (uint32_t(pref) << 16) | uint32_t(h);
-    return static_cast<int>(key);
+size_t BPlusTreePaged::bulkLoad(vector<pair<string, foodItem>>& records, double fillFactor) {
+    size_t n = sortRecords(records);
+    if (n == 0) return 0;
+    /* the new pages are out of reach of searches until the root is set at
+       the end, so only other writers have to be kept out */
+    unique_lock<shared_mutex> guard(structureLatch);
+    if (hasRoot) {
+        guard.unlock();
+        return insertSorted(records);
+    }
+    writingPages = true;
+    // nodes are packed to fillFactor but never below the minimum a node keeps
+    fillFactor = min(max(fillFactor, 0.0), 1.0);
+    int leafPer = max(LEAF_MIN_BYTES, static_cast<int>(fillFactor * LEAF_CAPACITY));
+    int internalPer = max(INTERNAL_MIN_BYTES, static_cast<int>(fillFactor * INTERNAL_CAPACITY));
+    // page id, separator in front and record count of every node on the level being built
+    vector<int> level;
+    vector<string> firstKeys;
+    vector<int> levelCounts;
+    /* leaves: the next leaf is allocated before the current one is released,
+       so nextLeaf is set without going back to a page */
+    vector<int> groups = leafGroups(records, leafPer);
+    // the separator in front of every leaf, the first one has none
+    firstKeys.push_back(string());
+    int next = 0;
+    for (size_t g = 0; g + 1 < groups.size(); ++g) {
+        next += groups[g];
+        firstKeys.push_back(shortestSeparator(records[next - 1].first, records[next].first));
+    }
+    next = 0;
+    int pid = createLeafNode();
+    for (size_t g = 0; g < groups.size(); ++g) {
+        PageFrame* pf;
+        LeafPage* leaf = loadLeaf(pid, pf);
+        fillLeaf(leaf, records, next, next + groups[g], firstKeys[g],
+            g + 1 < groups.size() ? firstKeys[g + 1] : maxKey());
+        next += groups[g];
+        level.push_back(pid);
+        levelCounts.push_back(groups[g]);
+        int nextPid = -1;
+        if (g + 1 < groups.size()) {
+            nextPid = createLeafNode();
+        }
+        leaf->nextLeaf = nextPid;
+        buffer->UnpinPage(pid, true);
+        pid = nextPid;
+    }
+    // internal levels until a single node is left, that one is the root
+    while (level.size() > 1) {
+        vector<int> upper;
+        vector<string> upperKeys;
+        vector<int> upperCounts;
+        // separator i is the one in front of child i + 1
+        vector<InternalEntry> entries;
+        vector<int> bytes;
+        for (size_t i = 0; i < level.size(); ++i) {
+            entries.push_back(InternalEntry{ firstKeys[i], level[i], levelCounts[i] });
+            bytes.push_back(InternalPage::entryBytes(static_cast<int>(firstKeys[i].size())));
+        }
+        groups = bulkGroups(bytes, internalPer, INTERNAL_MIN_BYTES, INTERNAL_CAPACITY);
+        next = 0;
+        for (int count : groups) {
+            int nodeId = createInternalNode();
+            PageFrame* pf;
+            InternalPage* node = loadInternal(nodeId, pf);
+            node->fill(entries, next, next + count);
+            next += count;
+            upper.push_back(nodeId);
+            upperKeys.push_back(firstKeys[next - count]);
+            upperCounts.push_back(static_cast<int>(node->total()));
+            buffer->UnpinPage(nodeId, true);
+        }
+        level.swap(upper);
+        firstKeys.swap(upperKeys);
+        levelCounts.swap(upperCounts);
+    }
+    rootPageId = level[0];
+    hasRoot = true;
+    writeHeader();
+    writingPages = false;
+    // the records never went through the log, so they become a checkpoint
+    if (log) writeCheckpoint();
+    return n;
 }
 
-/**********************************************************
-Tree Management
-***********************************************************/
-void BPlusTreePaged::insert(int key,
-    const string& name,
-    int protein,
-    int calories,
-    double cost) {
-    foodItem item(name, protein, calories, cost);
+void BPlusTreePaged::applyInsert(const string& key, const foodItem& item) {
+    KeyRef ref(key);
     //Case 1: insertion into a empty tree
     if (!hasRoot) {
         rootPageId = createLeafNode();
         hasRoot = true;
         writeHeader();
         PageFrame* pf;
-        NodePage* r = loadNode(rootPageId, pf);
-        // Check for duplicate in empty tree
-        for (int i = 0; i < r->size; ++i) {
-            if (r->keys[i] == key) {
-                r->items[i] = item;
-                buffer->UnpinPage(rootPageId, true);
-                return;
-            }
-        }
-        r->keys[0] = key;
-        r->items[0] = item;
-        r->size = 1;
+        LeafPage* r = loadLeaf(rootPageId, pf);
+        r->insertAt(0, ref, item);
         rebuildBloom(r);
         buffer->UnpinPage(rootPageId, true);
         return;
     }
     //Case 2: insertion into a Non-empty tree
-    InsertResult res = insertRecursive(rootPageId, key, item);
+    InsertResult res = insertRecursive(rootPageId, ref, item, string(), maxKey());
     /*if split is true the split has propagated to the root
     so create a new root and add the old one as a child*/
     if (res.split) {
         int newRoot = createInternalNode();
         PageFrame* pf;
-        NodePage* r = loadNode(newRoot, pf);
-        r->isLeaf = false;
-        r->size = 1;
-        r->keys[0] = res.newKey;
-        r->children[0] = rootPageId;
-        r->children[1] = res.newRight;
+        InternalPage* r = loadInternal(newRoot, pf);
+        r->children()[0] = rootPageId;
+        PageFrame* of;
+        r->counts()[0] = static_cast<int>(nodeCount(loadNode(rootPageId, of)));
+        r->insertAt(0, KeyRef(res.newKey), res.newRight, res.rightCount);
+        buffer->UnpinPage(rootPageId, false);
         buffer->UnpinPage(newRoot, true);
         rootPageId = newRoot;
         hasRoot = true;
+        // the header only changes with the root (page allocation writes its own)
         writeHeader();
     }
-    writeHeader();
 }
 
-bool BPlusTreePaged::remove(int key) {
+bool BPlusTreePaged::applyRemove(const string& key) {
     if (!hasRoot) return false;
     bool removed = false;
-    deleteRecursive(rootPageId, key, removed);
+    deleteRecursive(rootPageId, KeyRef(key), removed, string(), maxKey());
     //if removal failed
     if (!removed) return false;
     PageFrame* pf;
-    NodePage* root = loadNode(rootPageId, pf);
+    NodeHeader* root = loadNode(rootPageId, pf);
     //Case 1: if root is a internal node and empty
     if (!root->isLeaf && root->size == 0) {
-        int newRootId = root->children[0];
+        int newRootId = static_cast<InternalPage*>(root)->children()[0];
+        int oldRootId = rootPageId;
         buffer->UnpinPage(rootPageId, false);
         rootPageId = newRootId;
         writeHeader();
+        freePage(oldRootId);
         return true;
     }
     // Case 2:Root is leaf and empty
     if (root->isLeaf && root->size == 0) {
+        int oldRootId = rootPageId;
         buffer->UnpinPage(rootPageId, false);
         rootPageId = -1;
         hasRoot = false;
         writeHeader();  // Update header - tree is now empty
+        freePage(oldRootId);
         return true;
     }
     buffer->UnpinPage(rootPageId, false);
@@ -649,8 +1758,88 @@ bool BPlusTreePaged::remove(int key) {
     return true;
 }
 
+/**********************************************************
+Write-Ahead Log
+***********************************************************/
+
+long long BPlusTreePaged::recoverFromLog(LogManager* wal) {
+    // runs before the tree is served, the latch only keeps writers out
+    unique_lock<shared_mutex> guard(structureLatch);
+    // replayed operations are already in the log, so nothing is logged yet
+    log = nullptr;
+    writingPages = true;
+    long long applied = wal->Replay([this](const LogRecord& rec) {
+        if (rec.type == LogType::Insert)
+            applyInsert(rec.key, rec.item);
+        else if (rec.type == LogType::Remove)
+            applyRemove(rec.key);
+    });
+    writingPages = false;
+    log = wal;
+    // the replayed state becomes the new checkpoint and the log starts empty
+    writeCheckpoint();
+    return applied;
+}
+
+void BPlusTreePaged::commit() {
+    lock_guard<mutex> guard(logLatch);
+    if (log) log->Commit();
+}
+
+bool BPlusTreePaged::matchesSource(const DataSource& src) const {
+    return source.bytes == src.bytes && source.mtime == src.mtime
+        && strncmp(source.name, src.name, sizeof(source.name)) == 0;
+}
+
+void BPlusTreePaged::setSource(const DataSource& src) {
+    unique_lock<shared_mutex> guard(structureLatch);
+    source = src;
+    writeHeader();
+}
+
+void BPlusTreePaged::close() {
+    if (!valid) return;
+    unique_lock<shared_mutex> guard(structureLatch);
+    cleanShutdown = true;
+    writeHeader();
+    writeCheckpoint();
+}
+
+void BPlusTreePaged::checkpoint() {
+    unique_lock<shared_mutex> guard(structureLatch);
+    writeCheckpoint();
+}
+
+void BPlusTreePaged::maybeCheckpoint() {
+    if (!log) return;
+    {
+        lock_guard<mutex> guard(logLatch);
+        if (!log->NeedsCheckpoint()) return;
+    }
+    unique_lock<shared_mutex> guard(structureLatch);
+    // another writer may have taken it while this one waited
+    {
+        lock_guard<mutex> logGuard(logLatch);
+        if (!log->NeedsCheckpoint()) return;
+    }
+    writeCheckpoint();
+}
+
+void BPlusTreePaged::writeCheckpoint() {
+    // no appends or commits while the log is reset
+    lock_guard<mutex> guard(logLatch);
+    if (log) log->Commit();
+    // no background page writes between the flush and the reset of the log
+    buffer->SuspendBackgroundWriter();
+    buffer->FlushAllPages();
+    disk->Sync();
+    if (log) log->CheckpointComplete();
+    buffer->ResumeBackgroundWriter();
+}
+
 int BPlusTreePaged::computeTreeDepth() const
 {
+    shared_lock<shared_mutex> guard(structureLatch);
     if (!hasRoot || rootPageId < 0)
         return 0;  // empty tree
     int depth = 0;
@@ -659,7 +1848,7 @@ int BPlusTreePaged::computeTreeDepth() const
     {
         depth++;
         PageFrame* pf;
-        NodePage* node = const_cast<BPlusTreePaged*>(this)->loadNodeForTest(pid, pf);
+        NodeHeader* node = const_cast<BPlusTreePaged*>(this)->loadNodeForTest(pid, pf);
         if (!node) {
             const_cast<BPlusTreePaged*>(this)->unpinForTest(pid, false);
             break;
@@ -671,7 +1860,7 @@ int BPlusTreePaged::computeTreeDepth() const
         }
 
         // Follow the leftmost child
-        int nextPid = node->children[0];
+        int nextPid = static_cast<InternalPage*>(node)->children()[0];
         const_cast<BPlusTreePaged*>(this)->unpinForTest(pid, false);
 
         pid = nextPid;
@@ -681,147 +1870,503 @@ int BPlusTreePaged::computeTreeDepth() const
  /********************************************************** 
  Searches 
  ***********************************************************/
-int BPlusTreePaged::findLeafPage(int key) const {
-    if (!hasRoot) return -1;
-    int cur = rootPageId;
+int BPlusTreePaged::optimisticLeaf(const string& key, PageFrame*& frame, uint64_t& version,
+    bool before, string* lowerFence, bool* fenced, AccessHint hint) const {
+    KeyRef ref(key);
     while (true) {
-        PageFrame* pf;
-        NodePage* n = loadNode(cur, pf);
-        if (n->isLeaf) {
+        // separator on the way down below which the leaf holds no keys
+        string lower;
+        bool hasLower = false;
+        int cur = rootPageId;
+        if (!hasRoot || cur < 0) return -1;
+        /* a node's level is only known once it is read, so every page on the
+           way down is fetched with the leaf's hint and the inner ones kept */
+        PageFrame* pf = buffer->FetchPage(cur, hint);
+        uint64_t v = readVersion(pf);
+        // a root read before a root split or collapse is not the root any more
+        bool ok = !versionLocked(v) && rootPageId == cur;
+        while (ok) {
+            const NodeHeader* header = reinterpret_cast<const NodeHeader*>(pf->data);
+            // the caller validates the leaf, the isLeaf read included
+            if (header->isLeaf) {
+                frame = pf;
+                version = v;
+                if (lowerFence) lowerFence->swap(lower);
+                if (fenced) *fenced = hasLower;
+                return cur;
+            }
+            if (hint == AccessHint::Scan) buffer->KeepPage(pf);
+            const InternalPage* n = static_cast<const InternalPage*>(header);
+            int idx = before ? n->lowerBound(ref) : n->upperBound(ref);
+            int nxt = n->children()[idx];
+            bool newFence = lowerFence && idx > 0;
+            string fence;
+            if (newFence) fence = n->key(idx - 1);
+            if (!validateVersion(pf, v)) break;
+            PageFrame* cf = buffer->FetchPage(nxt, hint);
+            uint64_t cv = readVersion(cf);
+            // the child has to still hang off this node when its version is read
+            if (versionLocked(cv) || !validateVersion(pf, v)) {
+                buffer->UnpinPage(nxt, false);
+                break;
+            }
             buffer->UnpinPage(cur, false);
-            return cur;
-        }
-        int idx = 0;
-        while (idx < n->size && key >= n->keys[idx]) {
-            ++idx;
+            cur = nxt;
+            pf = cf;
+            v = cv;
+            if (newFence) {
+                lower.swap(fence);
+                hasLower = true;
+            }
         }
-        int nxt = n->children[idx];
+        // a writer holds part of the path, let it finish and start over
         buffer->UnpinPage(cur, false);
-        cur = nxt;
+        this_thread::yield();
     }
 }
 
-bool BPlusTreePaged::search(int key, foodItem& out) const {
-    int leafPage = findLeafPage(key);
-    if (leafPage == -1) return false;
+int BPlusTreePaged::findLeafPage(const string& key) const {
     PageFrame* pf;
-    NodePage* leaf = loadNode(leafPage, pf);
-    //check for bloom filter miss
-    if (!leaf->bloom.possiblyContains(key)) {
+    uint64_t v;
+    int leafPage = optimisticLeaf(key, pf, v);
+    if (leafPage != -1) buffer->UnpinPage(leafPage, false);
+    return leafPage;
+}
+
+bool BPlusTreePaged::searchLeaf(const string& key, foodItem& out, bool useBloom) const {
+    // KeyRef would cut the key and find the stored key it starts with
+    if (key.size() > static_cast<size_t>(MAX_KEY_BYTES)) return false;
+    KeyRef ref(key);
+    while (true) {
+        PageFrame* pf;
+        uint64_t v;
+        int leafPage = optimisticLeaf(key, pf, v);
+        if (leafPage == -1) return false;
+        const LeafPage* leaf = reinterpret_cast<const LeafPage*>(pf->data);
+        bool found = false;
+        foodItem item;
+        //check for bloom filter miss
+        if (!useBloom || leaf->bloom.possiblyContains(ref.data, ref.len)) {
+            int i = leaf->lowerBound(ref);
+            if (i < leaf->slotCount() && leaf->compareAt(i, ref) == 0) {
+                item = leaf->item(i);
+                found = true;
+            }
+        }
+        bool stable = validateVersion(pf, v);
         buffer->UnpinPage(leafPage, false);
-        return false;
+        if (stable) {
+            if (found) out = item;
+            return found;
+        }
+    }
+}
+
+bool BPlusTreePaged::search(const string& key, foodItem& out) const {
+    return searchLeaf(key, out, true);
+}
+
+unordered_map<string, foodItem> BPlusTreePaged::rangeSearch(const string& k1, const string& k2) const {
+    unordered_map<string, foodItem> out;
+    for (RangeCursor c = scan(k1, k2); c.valid(); c.next()) {
+        out[c.key()] = c.item();
     }
-    for (int i = 0; i < leaf->size; ++i) {
-        if (leaf->keys[i] == key) {
-            out = leaf->items[i];
-            buffer->UnpinPage(leafPage, false);
-            return true;
+    return out;
+}
+
+RangeCursor BPlusTreePaged::scan(const string& k1, const string& k2, size_t limit, size_t offset, ScanOrder order) const {
+    /* an offset is turned into the key the cursor starts at, found from the
+       record counts, so the rows before it are never read */
+    if (offset > 0 && k1 <= k2) {
+        size_t low = countBelow(k1);
+        size_t high = countBelow(k2, true);
+        string key;
+        foodItem item;
+        if (high <= low || high - low <= offset
+            || !select(order == ScanOrder::Descending ? high - 1 - offset : low + offset, key, item)) {
+            return RangeCursor(this, k1, k2, 0, order);
         }
+        if (order == ScanOrder::Descending) return RangeCursor(this, k1, min(k2, key), limit, order);
+        return RangeCursor(this, max(k1, key), k2, limit, order);
     }
-    buffer->UnpinPage(leafPage, false);
-    return false;
+    return RangeCursor(this, k1, k2, limit, order);
 }
 
-unordered_map<int, foodItem> BPlusTreePaged::rangeSearch(int k1, int k2) const {
-    unordered_map<int, foodItem> out;
-    int leafPage = findLeafPage(k1);
-    if (leafPage == -1) return out;
-    int cur = leafPage;
-    while (cur != -1) {
-        PageFrame* pf;
-        NodePage* leaf = loadNode(cur, pf);
-        for (int i = 0; i < leaf->size; ++i) {
-            int key = leaf->keys[i];
-            if (key > k2) {
-                buffer->UnpinPage(cur, false);
-                return out;
+RangeCursor BPlusTreePaged::scanByChar(char c1, char c2, size_t limit, size_t offset, ScanOrder order) const {
+    string k1, k2;
+    charKeyRange(c1, c2, k1, k2);
+    return scan(k1, k2, limit, offset, order);
+}
+
+void BPlusTreePaged::advanceCursor(RangeCursor& c) const {
+    c.entries.clear();
+    c.pos = 0;
+    while (c.entries.empty() && !c.done) {
+        string lowerFence;
+        bool fenced = false;
+        if (c.reverse && c.pageId != -1) {
+            /* leaves only link forward: a reverse cursor seeks the leaf left of
+               the one it finished from the root (inner nodes are cached) */
+            buffer->UnpinPage(c.pageId, false);
+            c.pageId = -1;
+        }
+        if (c.pageId == -1) {
+            // the first leaf, or the place is found again after a leaf changed
+            c.pageId = c.reverse
+                ? optimisticLeaf(c.to, c.frame, c.version, c.toOpen, &lowerFence, &fenced, AccessHint::Scan)
+                : optimisticLeaf(c.from, c.frame, c.version, false, nullptr, nullptr, AccessHint::Scan);
+            if (c.pageId == -1) {
+                c.done = true;
+                break;
+            }
+        }
+        else {
+            const LeafPage* leaf = reinterpret_cast<const LeafPage*>(c.frame->data);
+            int nxt = leaf->nextLeaf;
+            bool stable = validateVersion(c.frame, c.version);
+            if (stable && nxt == -1) {
+                c.done = true;
+                break;
+            }
+            PageFrame* nf = nullptr;
+            uint64_t nv = 0;
+            if (stable) {
+                // leaves are read once, keep them from pushing the inner nodes out
+                nf = buffer->FetchPage(nxt, AccessHint::Scan);
+                nv = readVersion(nf);
+                // the link has to still be current when the next leaf's version is read
+                stable = !versionLocked(nv) && validateVersion(c.frame, c.version);
+                if (!stable) buffer->UnpinPage(nxt, false);
             }
-            if (key >= k1) {
-                out[key] = leaf->items[i];
+            buffer->UnpinPage(c.pageId, false);
+            if (!stable) {
+                c.pageId = -1;
+                this_thread::yield();
+                continue;
             }
+            c.pageId = nxt;
+            c.frame = nf;
+            c.version = nv;
         }
-        int nxt = leaf->nextLeaf;
-        buffer->UnpinPage(cur, false);
-        cur = nxt;
+        const LeafPage* leaf = reinterpret_cast<const LeafPage*>(c.frame->data);
+        KeyRef from(c.from);
+        KeyRef to(c.to);
+        bool end = false;
+        int n = leaf->slotCount();
+        // the limit is only taken off once the copy is known to be good
+        size_t room = c.remaining;
+        int last = -1;
+        int step = c.reverse ? -1 : 1;
+        int i;
+        if (c.reverse) {
+            // start at the last key below to (or at it)
+            i = leaf->lowerBound(to);
+            if (!c.toOpen && i < n && leaf->compareAt(i, to) == 0) i++;
+            i--;
+        }
+        else {
+            i = leaf->lowerBound(from);
+            if (c.fromOpen && i < n && leaf->compareAt(i, from) == 0) i++;
+        }
+        // when the leaf's far end is still inside the range no key needs a check of its own
+        bool inside = n > 0 && (c.reverse ? leaf->compareAt(0, from) > 0 : leaf->compareAt(n - 1, to) < 0);
+        for (; i >= 0 && i < n; i += step) {
+            int cmp = inside ? -step : (c.reverse ? leaf->compareAt(i, from) : leaf->compareAt(i, to));
+            bool past = c.reverse ? (cmp < 0 || (cmp == 0 && c.fromOpen))
+                : (cmp > 0 || (cmp == 0 && c.toOpen));
+            if (room == 0 || past) {
+                end = true;
+                break;
+            }
+            // the range ends at this key, nothing after it can be in it
+            if (cmp == 0) end = true;
+            last = i;
+            c.entries.emplace_back(leaf->key(i), leaf->item(i));
+            room--;
+            if (end) break;
+        }
+        if (!validateVersion(c.frame, c.version)) {
+            c.entries.clear();
+            buffer->UnpinPage(c.pageId, false);
+            c.pageId = -1;
+            this_thread::yield();
+            continue;
+        }
+        c.remaining = room;
+        // the end read from becomes the last key returned, left out from now on
+        if (last != -1) {
+            if (c.reverse) {
+                c.to = c.entries.back().first;
+                c.toOpen = true;
+            }
+            else {
+                c.from = c.entries.back().first;
+                c.fromOpen = true;
+            }
+        }
+        if (c.remaining == 0) end = true;
+        // a reverse cursor that ran off the leaf goes on below the leaf's fence
+        if (c.reverse && !end) {
+            if (!fenced || lowerFence <= c.from) end = true;
+            else {
+                c.to.swap(lowerFence);
+                c.toOpen = true;
+            }
+        }
+        c.done = end;
     }
-    return out;
+    // a cursor with no leaf left to read holds no pin
+    if (c.done && c.pageId != -1) {
+        buffer->UnpinPage(c.pageId, false);
+        c.pageId = -1;
+    }
+}
+
+RangeCursor::RangeCursor(const BPlusTreePaged* tree, const string& k1, const string& k2, size_t limit, ScanOrder order)
+    : tree(tree), from(k1), to(k2), fromOpen(false), toOpen(false), reverse(order == ScanOrder::Descending),
+    remaining(limit), done(k1 > k2 || limit == 0),
+    pageId(-1), frame(nullptr), version(0), pos(0)
+{
+    /* bounds over MAX_KEY_BYTES are cut: no stored key lies between the cut
+       bound and the whole one, so a cut lower bound leaves itself out */
+    if (from.size() > static_cast<size_t>(MAX_KEY_BYTES)) {
+        from.resize(MAX_KEY_BYTES);
+        fromOpen = true;
+    }
+    if (to.size() > static_cast<size_t>(MAX_KEY_BYTES)) to.resize(MAX_KEY_BYTES);
+    tree->advanceCursor(*this);
+}
+
+RangeCursor::RangeCursor(RangeCursor&& other) noexcept
+    : tree(other.tree), from(std::move(other.from)), to(std::move(other.to)),
+    fromOpen(other.fromOpen), toOpen(other.toOpen), reverse(other.reverse),
+    remaining(other.remaining), done(other.done),
+    pageId(other.pageId), frame(other.frame), version(other.version),
+    entries(std::move(other.entries)), pos(other.pos)
+{
+    // the pin moves with it
+    other.pageId = -1;
+    other.done = true;
+    other.entries.clear();
+    other.pos = 0;
+}
+
+void RangeCursor::next() {
+    if (++pos >= entries.size()) {
+        tree->advanceCursor(*this);
+    }
+}
+
+void RangeCursor::close() {
+    if (pageId != -1) {
+        tree->buffer->UnpinPage(pageId, false);
+        pageId = -1;
+    }
+    done = true;
+    entries.clear();
+    pos = 0;
 }
 
-unordered_map<int, foodItem> BPlusTreePaged::rangeSearchByChar(char c1, char c2) const
+void BPlusTreePaged::charKeyRange(char c1, char c2, string& k1, string& k2)
 {
+    // letters are compared the way keys are, so ('c', 'D') and ('D', 'c') are the same range
+    c1 = static_cast<char>(toupper(static_cast<unsigned char>(c1)));
+    c2 = static_cast<char>(toupper(static_cast<unsigned char>(c2)));
     if (c1 > c2)
         swap(c1, c2);
-    unsigned char uc1 = static_cast<unsigned char>(toupper(static_cast<unsigned char>(c1)));
-    unsigned char uc2 = static_cast<unsigned char>(toupper(static_cast<unsigned char>(c2)));
-    // low bucket = C1 XX
-    uint16_t lowPref16 =
-        static_cast<uint16_t>((uint16_t(uc1) << 8) | 0x00u);
-    // high bucket = C2 FF
-    uint16_t highPref16 =
-        static_cast<uint16_t>((uint16_t(uc2) << 8) | 0xFFu);
-    int k1 = static_cast<int>((uint32_t(lowPref16) << 16));
-    int k2 = static_cast<int>((uint32_t(highPref16) << 16) | 0x0000FFFFu);
+    // from the first letter alone up to the last key that starts with c2
+    k1 = foodKeyPrefix(string(1, c1));
+    k2 = prefixEnd(foodKeyPrefix(string(1, c2)));
+}
+
+unordered_map<string, foodItem> BPlusTreePaged::rangeSearchByChar(char c1, char c2) const
+{
+    string k1, k2;
+    charKeyRange(c1, c2, k1, k2);
     return rangeSearch(k1, k2);
 }
 
-vector<foodItem> BPlusTreePaged::prefixSearch(const string& prefix) const
+void BPlusTreePaged::prefixKeyRange(const string& prefix, string& lowKey, string& highKey)
+{
+    // keys start with the upper-cased names, so the names with the prefix are one run of keys
+    lowKey = foodKeyPrefix(prefix);
+    highKey = prefixEnd(lowKey);
+}
+
+vector<foodItem> BPlusTreePaged::prefixSearch(const string& prefix, size_t limit, size_t offset, ScanOrder order) const
 {
     vector<foodItem> results;
-    if (prefix.empty())
+    if (prefix.empty() || limit == 0)
         return results;
-    // Upper-case copy for bucket computations
-    string up = prefix;
-    for (char& ch : up) {
-        ch = static_cast<char>(
-            toupper(static_cast<unsigned char>(ch)));
+    string lowKey, highKey;
+    prefixKeyRange(prefix, lowKey, highKey);
+    for (RangeCursor c = scan(lowKey, highKey, limit, offset, order); c.valid(); c.next()) {
+        results.push_back(c.item());
     }
-    uint16_t lowPref16, highPref16;
-    if (up.size() >= 2) {
-        // all names whose first two chars match
-        unsigned char c1 = static_cast<unsigned char>(up[0]);
-        unsigned char c2 = static_cast<unsigned char>(up[1]);
+    return results;
+}
+
+size_t BPlusTreePaged::prefixCount(const string& prefix) const
+{
+    if (prefix.empty())
+        return 0;
+    string lowKey, highKey;
+    prefixKeyRange(prefix, lowKey, highKey);
+    return countRange(lowKey, highKey);
+}
 
-        lowPref16 = static_cast<uint16_t>((uint16_t(c1) << 8) | uint16_t(c2));
-        highPref16 = lowPref16;
+/**********************************************************
+Order Statistics
+***********************************************************/
+size_t BPlusTreePaged::count() const
+{
+    while (true) {
+        int cur = rootPageId;
+        if (!hasRoot || cur < 0) return 0;
+        PageFrame* pf = buffer->FetchPage(cur);
+        uint64_t v = readVersion(pf);
+        long long n = nodeCount(reinterpret_cast<const NodeHeader*>(pf->data));
+        bool stable = !versionLocked(v) && rootPageId == cur && validateVersion(pf, v);
+        buffer->UnpinPage(cur, false);
+        if (stable) return static_cast<size_t>(max(n, 0LL));
+        this_thread::yield();
     }
-    else {
-        // Only 1 char: cover all second-char possibilities for that first letter
-        unsigned char c1 = static_cast<unsigned char>(up[0]);
-        lowPref16 = static_cast<uint16_t>((uint16_t(c1) << 8) | 0x00u);
-        highPref16 = static_cast<uint16_t>((uint16_t(c1) << 8) | 0xFFu);
-    }
-    int lowKey = static_cast<int>((uint32_t(lowPref16) << 16));
-    int highKey = static_cast<int>((uint32_t(highPref16) << 16) | 0x0000FFFFu);
-    // Integer range search over that bucket
-    auto bucket = rangeSearch(lowKey, highKey);
-    // Exact prefix filter (case-insensitive)
-    for (const auto& entry : bucket) {
-        const foodItem& item = entry.second;
-        if (matchesPrefix(prefix, item.foodName))
-            results.push_back(item);
+}
+
+size_t BPlusTreePaged::countBelow(const string& key, bool orEqual) const
+{
+    /* KeyRef cuts a key over MAX_KEY_BYTES; no stored key lies between the cut
+       key and the whole one, so the keys below it are the cut key and those below */
+    if (key.size() > static_cast<size_t>(MAX_KEY_BYTES)) orEqual = true;
+    KeyRef ref(key);
+    // the descent of optimisticLeaf(), adding up the children left of the path
+    while (true) {
+        long long below = 0;
+        int cur = rootPageId;
+        if (!hasRoot || cur < 0) return 0;
+        PageFrame* pf = buffer->FetchPage(cur);
+        uint64_t v = readVersion(pf);
+        bool ok = !versionLocked(v) && rootPageId == cur;
+        while (ok) {
+            const NodeHeader* header = reinterpret_cast<const NodeHeader*>(pf->data);
+            if (header->isLeaf) {
+                const LeafPage* leaf = static_cast<const LeafPage*>(header);
+                int i = leaf->lowerBound(ref);
+                if (orEqual && i < leaf->slotCount() && leaf->compareAt(i, ref) == 0) i++;
+                below += i;
+                if (!validateVersion(pf, v)) break;
+                buffer->UnpinPage(cur, false);
+                return static_cast<size_t>(max(below, 0LL));
+            }
+            const InternalPage* n = static_cast<const InternalPage*>(header);
+            int idx = n->upperBound(ref);
+            const int* counts = n->counts();
+            for (int i = 0; i < idx; ++i) {
+                below += counts[i];
+            }
+            int nxt = n->children()[idx];
+            if (!validateVersion(pf, v)) break;
+            PageFrame* cf = buffer->FetchPage(nxt);
+            uint64_t cv = readVersion(cf);
+            if (versionLocked(cv) || !validateVersion(pf, v)) {
+                buffer->UnpinPage(nxt, false);
+                break;
+            }
+            buffer->UnpinPage(cur, false);
+            cur = nxt;
+            pf = cf;
+            v = cv;
+        }
+        buffer->UnpinPage(cur, false);
+        this_thread::yield();
     }
-    return results;
 }
 
-bool BPlusTreePaged::search_noBloom(int key, foodItem& out) const
+size_t BPlusTreePaged::countRange(const string& k1, const string& k2) const
 {
-    int leafPage = findLeafPage(key);
-    if (leafPage == -1) return false;
-    PageFrame* pf;
-    NodePage* leaf = loadNode(leafPage, pf);
-    for (int i = 0; i < leaf->size; ++i) {
-        if (leaf->keys[i] == key) {
-            out = leaf->items[i];
-            buffer->UnpinPage(leafPage, false);
-            return true;
+    if (k1 > k2) return 0;
+    size_t high = countBelow(k2, true);
+    size_t low = countBelow(k1);
+    return high > low ? high - low : 0;
+}
+
+size_t BPlusTreePaged::countByChar(char c1, char c2) const
+{
+    string k1, k2;
+    charKeyRange(c1, c2, k1, k2);
+    return countRange(k1, k2);
+}
+
+size_t BPlusTreePaged::rank(const string& key) const
+{
+    return countBelow(key);
+}
+
+bool BPlusTreePaged::select(size_t i, string& key, foodItem& out) const
+{
+    while (true) {
+        long long pos = static_cast<long long>(i);
+        int cur = rootPageId;
+        if (!hasRoot || cur < 0) return false;
+        PageFrame* pf = buffer->FetchPage(cur);
+        uint64_t v = readVersion(pf);
+        bool ok = !versionLocked(v) && rootPageId == cur;
+        if (ok && static_cast<size_t>(max(nodeCount(reinterpret_cast<const NodeHeader*>(pf->data)), 0LL)) <= i) {
+            // fewer records than that in the whole tree
+            ok = validateVersion(pf, v);
+            if (ok) {
+                buffer->UnpinPage(cur, false);
+                return false;
+            }
+        }
+        while (ok) {
+            const NodeHeader* header = reinterpret_cast<const NodeHeader*>(pf->data);
+            if (header->isLeaf) {
+                const LeafPage* leaf = static_cast<const LeafPage*>(header);
+                // a count still being moved up by a leaf writer can point past the leaf
+                bool found = pos < leaf->slotCount();
+                if (found) {
+                    key = leaf->key(static_cast<int>(pos));
+                    out = leaf->item(static_cast<int>(pos));
+                }
+                if (!validateVersion(pf, v) || !found) break;
+                buffer->UnpinPage(cur, false);
+                return true;
+            }
+            // the child whose records hold position pos
+            const InternalPage* n = static_cast<const InternalPage*>(header);
+            int size = n->keyCount();
+            const int* counts = n->counts();
+            int idx = 0;
+            while (idx < size && pos >= counts[idx]) {
+                pos -= counts[idx++];
+            }
+            int nxt = n->children()[idx];
+            if (!validateVersion(pf, v)) break;
+            PageFrame* cf = buffer->FetchPage(nxt);
+            uint64_t cv = readVersion(cf);
+            if (versionLocked(cv) || !validateVersion(pf, v)) {
+                buffer->UnpinPage(nxt, false);
+                break;
+            }
+            buffer->UnpinPage(cur, false);
+            cur = nxt;
+            pf = cf;
+            v = cv;
         }
+        buffer->UnpinPage(cur, false);
+        this_thread::yield();
     }
-    buffer->UnpinPage(leafPage, false);
-    return false;
+}
+
+bool BPlusTreePaged::search_noBloom(const string& key, foodItem& out) const
+{
+    return searchLeaf(key, out, false);
 }
 
 int BPlusTreePaged::getFirstLeafPageId() const
 {
+    shared_lock<shared_mutex> guard(structureLatch);
     if (!hasRoot)
         return -1;
 
@@ -844,7 +2389,7 @@ int BPlusTreePaged::getFirstLeafPageId() const
             return -1;
         }
 
-        NodePage* n = loadNode(pid, pf);
+        NodeHeader* n = loadNode(pid, pf);
         if (!n) {
             cout << "ERROR: Unable to load page " << pid << "\n";
             buffer->UnpinPage(pid, false);
@@ -860,7 +2405,7 @@ int BPlusTreePaged::getFirstLeafPageId() const
         // Find first valid child (skip -1 and skip header page 0)
         int child = -1;
         for (int i = 0; i <= n->size; i++) {
-            int cid = n->children[i];
+            int cid = static_cast<InternalPage*>(n)->children()[i];
 
             // skip unused
             if (cid == -1)
@@ -891,24 +2436,17 @@ int BPlusTreePaged::getFirstLeafPageId() const
 }
 
 
-bool BPlusTreePaged::matchesPrefix(const string& prefix, const char* foodName)
+int BPlusTreePaged::leafChainLink(int pageId, const char* data)
 {
-    if (!foodName || prefix.empty())
-        return false;
-    // Uppercase prefix
-    string upPrefix = prefix;
-    for (char& c : upPrefix)
-        c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
-    // Uppercase only the characters needed from foodName
-    string upName;
-    for (size_t i = 0; i < upPrefix.size() && foodName[i] != '\0'; i++)
-    {
-        upName.push_back(static_cast<char>(
-            toupper(static_cast<unsigned char>(foodName[i]))
-            ));
-    }
-    if (upName.size() < upPrefix.size())
-        return false;
-    return upName.compare(0, upPrefix.size(), upPrefix) == 0;
+    // the header page and free pages do not start with a node
+    if (pageId == 0)
+        return -1;
+    unsigned magic;
+    memcpy(&magic, data, sizeof(magic));
+    if (magic == FREE_PAGE_MAGIC)
+        return -1;
+    const LeafPage* n = reinterpret_cast<const LeafPage*>(data);
+    if (!n->isLeaf || n->size <= 0)
+        return -1;
+    return n->nextLeaf;
 }
-
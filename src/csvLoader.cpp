@@ -5,6 +5,8 @@
 #include <cctype>
 #include <algorithm>
 #include <iostream>
+#include <cstring>
+#include <sys/stat.h>
 using namespace std;
 
 static inline void trimInPlace(string& s) {
@@ -93,7 +95,18 @@ bool parseCSVLine(const std::string& rawLine,
     return true;
 }
 
-size_t loadCSVIntoTree(const string& path, BPlusTreePaged& tree)
+bool describeCSV(const string& path, DataSource& out)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    memset(&out, 0, sizeof(out));
+    out.bytes = static_cast<long long>(st.st_size);
+    out.mtime = static_cast<long long>(st.st_mtime);
+    strncpy(out.name, path.c_str(), sizeof(out.name) - 1);
+    return true;
+}
+
+size_t loadCSVIntoTree(const string& path, BPlusTreePaged& tree, double fillFactor)
 {
     ifstream in(path);
     if (!in.is_open()) {
@@ -101,7 +114,8 @@ size_t loadCSVIntoTree(const string& path, BPlusTreePaged& tree)
         return 0;
     }
     string line;
-    size_t inserted = 0;
+    vector<pair<string, foodItem>> rows;
+    size_t tooLong = 0;
     // Skip header (first line)
     if (!std::getline(in, line)) {
         cerr << "ERROR: CSV file appears to be empty: " << path << "\n";
@@ -113,11 +127,20 @@ size_t loadCSVIntoTree(const string& path, BPlusTreePaged& tree)
         double cost{};
         if (!parseCSVLine(line, name, protein, calories, cost))
             continue;
+        // names are keyed whole, one too long for a key is left out rather than cut
+        if (name.size() > static_cast<size_t>(MAX_NAME_BYTES)) {
+            tooLong++;
+            continue;
+        }
         // Build an alphabetical key from the cleaned name
-        int key = alphabeticalKey32(name);
-        tree.insert(key, name, protein, calories, cost);
-        inserted++;
+        rows.emplace_back(foodKey(name), foodItem(name, protein, calories, cost));
     }
-    cout << "Loaded CSV. Inserted " << inserted << " rows.\n";
-    return inserted;
+    size_t parsed = rows.size();
+    tree.bulkLoad(rows, fillFactor);
+    // rows with the same name are stored once, the last one wins
+    size_t stored = tree.count();
+    cout << "Loaded CSV. Parsed " << parsed << " rows, " << stored << " items in the tree.\n";
+    if (tooLong > 0)
+        cerr << "WARNING: skipped " << tooLong << " rows with names longer than " << MAX_NAME_BYTES << " bytes\n";
+    return stored;
 }
@@ -3,9 +3,12 @@
 #include <vector>
 #include <algorithm>
 #include <limits>
+#include <cctype>
 #include <cstdio> 
+#include <sys/stat.h>
 #include "bPlusTree.h"
 #include "csvLoader.h"
+#include "LogManager.h"
 #include "tests.h"
 
 using namespace std;
@@ -26,34 +29,127 @@ static void printMenu() {
     cout << "Enter choice: ";
 }
 
-int main() {
+/* Opens an existing tree file (recovering it from the log if the last run
+did not shut down cleanly) and reports whether it can be served as is.
+The tree is closed again, so the caller reopens a cleanly shut down file. */
+static bool openExistingTree(const string& csvPath, DiskMode mode, WalSyncMode syncMode,
+    ReplacementType policy) {
+    struct stat st;
+    if (stat("tree_data.bin", &st) != 0 || st.st_size == 0)
+        return false;
+    FileDiskManager dm("tree_data.bin", mode);
+    LogManager wal("tree_data", &dm, syncMode);
+    wal.RestoreCheckpoint();
+    BufferPool bp(10, &dm, policy);
+    BPlusTreePaged tree(&bp, &dm);
+    if (!tree.isValid())
+        return false;
+    /* attach the log even after a clean shutdown: opening the tree rewrote the
+    header, and only a close() with the log attached resets the journal that
+    saved it, otherwise the next start restores the stale page */
+    long long replayed = tree.recoverFromLog(&wal);
+    if (!tree.wasCleanShutdown()) {
+        cout << "Previous run did not shut down cleanly, replayed "
+            << replayed << " logged operation(s).\n";
+    }
+    // a tree built from another CSV (or an older copy of this one) is stale
+    DataSource csv{};
+    bool usable = tree.getRootPageId() != -1;
+    if (describeCSV(csvPath, csv) && !tree.matchesSource(csv))
+        usable = false;
+    tree.close();
+    return usable;
+}
+
+int main(int argc, char* argv[]) {
+    // optional storage backend: --direct (O_DIRECT) or --mmap
+    // optional log durability: --sync-off or --sync-op (default is group commit)
+    // optional replacement policy: --fifo, --lru, --clock or --2q (default is LRU-K,
+    // which keeps the root and upper internal pages resident)
+    // --no-readahead turns off leaf prefetching for scans
+    // --bgwriter writes dirty pages out ahead of eviction (off by default, eviction writes them)
+    // --hugepages backs the buffer frames with huge pages when the system has them
+    // --fill=<0..1> sets how full bulk loading packs the nodes (default 0.9)
+    DiskMode mode = DiskMode::Buffered;
+    WalSyncMode syncMode = WalSyncMode::Batch;
+    ReplacementType policy = ReplacementType::LRUK;
+    bool readAhead = true;
+    bool bgWriter = false;
+    bool hugePages = false;
+    double fillFactor = DEFAULT_FILL_FACTOR;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--direct") mode = DiskMode::Direct;
+        else if (arg == "--mmap") mode = DiskMode::Mmap;
+        else if (arg == "--sync-off") syncMode = WalSyncMode::Off;
+        else if (arg == "--sync-op") syncMode = WalSyncMode::PerOp;
+        else if (arg == "--fifo") policy = ReplacementType::FIFO;
+        else if (arg == "--lru") policy = ReplacementType::LRU;
+        else if (arg == "--clock") policy = ReplacementType::CLOCK;
+        else if (arg == "--lruk") policy = ReplacementType::LRUK;
+        else if (arg == "--2q") policy = ReplacementType::TwoQ;
+        else if (arg == "--no-readahead") readAhead = false;
+        else if (arg == "--bgwriter") bgWriter = true;
+        else if (arg == "--hugepages") hugePages = true;
+        else if (arg.rfind("--fill=", 0) == 0) {
+            try { fillFactor = stod(arg.substr(7)); }
+            catch (...) {}
+        }
+    }
 
     cout << "=== CSV Demo Program ===\n";
     cout << "Enter CSV filename (in same folder as exe): ";
-    remove("tree_data.bin");
     string filename;
     getline(cin, filename);
-    // Initialize fresh disk, buffer pool, and tree
-    FileDiskManager dm("tree_data.bin");
-    BufferPool bp(10, &dm);
+    // reuse tree_data.bin when it was built from this CSV, otherwise start fresh
+    bool warmStart = openExistingTree(filename, mode, syncMode, policy);
+    if (!warmStart) {
+        remove("tree_data.bin");
+        remove("tree_data.wal");
+        remove("tree_data.jnl");
+    }
+    // Initialize disk, log, buffer pool, and tree
+    FileDiskManager dm("tree_data.bin", mode);
+    LogManager wal("tree_data", &dm, syncMode);
+    // roll back to the last checkpoint if the previous run crashed
+    wal.RestoreCheckpoint();
+    BufferPool bp(10, &dm, policy, 1, hugePages);
+    // leaf scans (range, prefix, stats, Top-N) read the next leaves ahead
+    if (readAhead)
+        bp.EnableReadAhead(&BPlusTreePaged::leafChainLink);
+    // dirty pages are written out between requests instead of inside a fetch
+    if (bgWriter)
+        bp.EnableBackgroundWriter();
     BPlusTreePaged tree(&bp, &dm);
-    // Load CSV into the tree
-    cout << "\nLoading CSV...\n";
-    size_t count = loadCSVIntoTree(filename, tree);
-    if (count == 0) {
-        cout << "\nERROR: No items loaded from CSV!\n";
-        cout << "Please check:\n";
-        cout << "  1. File exists and path is correct\n";
-        cout << "  2. CSV format is correct (name,protein,calories,cost)\n";
-        cout << "  3. File has data rows (not just header)\n";
-        return 1;
+    tree.recoverFromLog(&wal);
+    if (warmStart) {
+        cout << "\nOpened existing tree_data.bin (" << dm.GetNumPages()
+            << " pages), skipping CSV load.\n";
+    }
+    else {
+        // Load CSV into the tree
+        cout << "\nLoading CSV...\n";
+        size_t count = loadCSVIntoTree(filename, tree, fillFactor);
+        if (count == 0) {
+            cout << "\nERROR: No items loaded from CSV!\n";
+            cout << "Please check:\n";
+            cout << "  1. File exists and path is correct\n";
+            cout << "  2. CSV format is correct (name,protein,calories,cost)\n";
+            cout << "  3. File has data rows (not just header)\n";
+            return 1;
+        }
+        cout << "Successfully inserted " << count << " items.\n";
+        DataSource csv{};
+        if (describeCSV(filename, csv))
+            tree.setSource(csv);
+        tree.checkpoint();
+        // Run performance tests
+        cout << "\nRunning performance tests...\n";
+        TestElementAccessTime(tree);
+        testBloomAllLeaves(tree, 2000);
     }
-    cout << "Successfully inserted " << count << " items.\n";
-    // Run performance tests
-    cout << "\nRunning performance tests...\n";
-    TestElementAccessTime(tree);
-    testBloomAllLeaves(tree, 2000);
-    cout << "NodePage size = " << sizeof(NodePage) << "\n";
+    cout << "LeafPage capacity = " << LEAF_CAPACITY << " bytes of slots and records\n";
+    cout << "InternalPage capacity = " << INTERNAL_CAPACITY << " bytes (up to " << INTERNAL_MAX_KEYS + 1 << " children)\n";
     cout << "PAGE_SIZE = " << PAGE_SIZE << "\n";
     cout << "Tree depth = " << tree.computeTreeDepth() << "\n";
 
@@ -74,7 +170,7 @@ int main() {
             getline(cin, rawName);
 
             string cleanedName = normalizeName(rawName);
-            int key = alphabeticalKey32(cleanedName);
+            string key = foodKey(cleanedName);
 
             foodItem result{};
             if (tree.search(key, result)) {
@@ -96,30 +192,30 @@ int main() {
             string prefix;
             getline(cin, prefix);
 
-            auto results = tree.prefixSearch(prefix);
+            // only the first 50 are fetched, the total is counted without copying
+            auto results = tree.prefixSearch(prefix, 50);
             if (results.empty()) {
                 cout << "\nNo items found with that prefix.\n";
             }
             else {
-                cout << "\nFound " << results.size()
+                size_t total = results.size() < 50 ? results.size() : tree.prefixCount(prefix);
+                cout << "\nFound " << total
                     << " item(s) with prefix \"" << prefix << "\":\n";
-                size_t shown = 0;
                 for (const auto& f : results) {
                     cout << " - " << f.foodName
                         << "  (P=" << f.proteinAmt
                         << ", Cals=" << f.calorieAmt
                         << ", $" << f.cost << ")\n";
-                    if (++shown >= 50) {
-                        cout << "   ... (showing first 50)\n";
-                        break;
-                    }
                 }
+                if (total > results.size())
+                    cout << "   ... (showing first 50)\n";
             }
             break;
         }
 
         case '3': {
             cout << "\n=== Browse by First-Letter Range ===\n";
+            cout << "(a starting letter after the ending one lists the range backwards)\n";
             cout << "Enter starting letter (e.g., A): ";
             string s1, s2;
             getline(cin, s1);
@@ -137,42 +233,40 @@ int main() {
             char c1 = s1[0];
             char c2 = s2[0];
 
-            auto bucket = tree.rangeSearchByChar(c1, c2);
-            if (bucket.empty()) {
+            ScanOrder order = toupper(static_cast<unsigned char>(c1)) > toupper(static_cast<unsigned char>(c2))
+                ? ScanOrder::Descending : ScanOrder::Ascending;
+            RangeCursor bucket = tree.scanByChar(c1, c2, 50, 0, order);
+            if (!bucket.valid()) {
                 cout << "\nNo items found in that letter range.\n";
             }
             else {
                 cout << "\nItems with first letter between '"
                     << c1 << "' and '" << c2 << "':\n";
-                int shown = 0;
-                for (const auto& pair : bucket) {
-                    const foodItem& f = pair.second;
+                // the first 50 are printed, the total comes from the subtree counts
+                size_t total = tree.countByChar(c1, c2);
+                for (; bucket.valid(); bucket.next()) {
+                    const foodItem& f = bucket.item();
                     cout << " - " << f.foodName
                         << "  (P=" << f.proteinAmt
                         << ", Cals=" << f.calorieAmt
                         << ", $" << f.cost << ")\n";
-                    if (++shown >= 50) {
-                        cout << "   ... (showing first 50)\n";
-                        break;
-                    }
                 }
-                cout << "Total items in range: " << bucket.size() << "\n";
+                if (total > 50)
+                    cout << "   ... (showing first 50)\n";
+                cout << "Total items in range: " << total << "\n";
             }
             break;
         }
 
         case '4': {
             cout << "\n=== Stats ===\n";
-            auto allMap = tree.rangeSearch(0, numeric_limits<int>::max());
-            cout << "Total items in tree: " << allMap.size() << "\n";
+            size_t total = tree.count();
+            cout << "Total items in tree: " << total << "\n";
 
-            if (!allMap.empty()) {
+            if (total > 0) {
                 cout << "First 10 items:\n";
-                int shown = 0;
-                for (const auto& pair : allMap) {
-                    cout << " - " << pair.second.foodName << "\n";
-                    if (++shown >= 10) break;
-                }
+                for (RangeCursor c = tree.scan("", maxKey(), 10); c.valid(); c.next())
+                    cout << " - " << c.item().foodName << "\n";
             }
             break;
         }
@@ -208,18 +302,15 @@ int main() {
             }
             if (N <= 0) N = 10;
 
-            auto allMap = tree.rangeSearch(0, numeric_limits<int>::max());
-            if (allMap.empty()) {
+            vector<foodItem> items;
+            items.reserve(tree.count());
+            for (RangeCursor c = tree.scan("", maxKey()); c.valid(); c.next())
+                items.push_back(c.item());
+            if (items.empty()) {
                 cout << "\nNo items in tree.\n";
                 break;
             }
 
-            vector<foodItem> items;
-            items.reserve(allMap.size());
-            for (const auto& pair : allMap) {
-                items.push_back(pair.second);
-            }
-
             if (sortChoice == '2') {
                 sort(items.begin(), items.end(),
                     [](const foodItem& a, const foodItem& b) {
@@ -298,7 +389,12 @@ int main() {
             getline(cin, rawName);
 
             string cleanedName = normalizeName(rawName);
-            int key = alphabeticalKey32(cleanedName);
+            // names are keyed whole, a longer one would not fit in a key
+            if (cleanedName.size() > static_cast<size_t>(MAX_NAME_BYTES)) {
+                cout << "Name is longer than " << MAX_NAME_BYTES << " bytes.\n";
+                break;
+            }
+            string key = foodKey(cleanedName);
 
             foodItem existing{};
             bool exists = tree.search(key, existing);
@@ -368,6 +464,7 @@ int main() {
             }
 
             tree.insert(key, cleanedName, protein, calories, cost);
+            tree.commit();
 
             foodItem verify{};
             bool found = tree.search(key, verify);
@@ -385,8 +482,7 @@ int main() {
                 cout << " Cost:     $" << verify.cost << "\n";
             }
 
-            auto allMap = tree.rangeSearch(0, numeric_limits<int>::max());
-            cout << "\nTotal items now: " << allMap.size() << "\n";
+            cout << "\nTotal items now: " << tree.count() << "\n";
 
             break;
         }
@@ -398,7 +494,7 @@ int main() {
             getline(cin, rawName);
 
             string cleanedName = normalizeName(rawName);
-            int key = alphabeticalKey32(cleanedName);
+            string key = foodKey(cleanedName);
 
             foodItem existing{};
             bool found = tree.search(key, existing);
@@ -423,6 +519,7 @@ int main() {
             }
 
             bool removed = tree.remove(key);
+            tree.commit();
 
             if (removed) {
                 cout << "\nItem \"" << cleanedName << "\" was removed successfully.\n";
@@ -431,15 +528,11 @@ int main() {
                 cout << "\nRemove failed (item may have already been removed).\n";
             }
 
-            auto allMap = tree.rangeSearch(0, numeric_limits<int>::max());
-            cout << "\nTotal items now: " << allMap.size() << "\n";
+            cout << "\nTotal items now: " << tree.count() << "\n";
 
             cout << "First 5 items now:\n";
-            int shown = 0;
-            for (const auto& p : allMap) {
-                cout << " - " << p.second.foodName << "\n";
-                if (++shown >= 5) break;
-            }
+            for (RangeCursor c = tree.scan("", maxKey(), 5); c.valid(); c.next())
+                cout << " - " << c.item().foodName << "\n";
 
             break;
         }
@@ -454,6 +547,7 @@ int main() {
         }
     }
 
+    tree.close();
     cout << "\n=== Demo Complete ===\n";
     return 0;
 }
\ No newline at end of file
@@ -3,8 +3,19 @@
 #include <random>
 #include <algorithm>
 #include <vector>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <map>
+#include <cstring>
+#include <climits>
+#include <fstream>
+#include <sys/stat.h>
 #include "BufferPool.h"
 #include "bPlusTree.h"
+#include "KeySearch.h"
+#include "csvLoader.h"
 #include "tests.h"
 using namespace std;
 using namespace std::chrono;
@@ -15,7 +26,7 @@ void TestElementAccessTime(BPlusTreePaged& tree)
     using namespace std::chrono;
     cout << "\nAverage Element Access Time (Real Tree) ===\n";
     //collect all keys
-    std::vector<int> allKeys;
+    std::vector<string> allKeys;
     allKeys.reserve(20000);
     int pageId = tree.getFirstLeafPageId();
     if (pageId <= 0) {
@@ -32,14 +43,15 @@ void TestElementAccessTime(BPlusTreePaged& tree)
         visited.push_back(pageId);
 
         PageFrame* pf;
-        NodePage* leaf = tree.loadNodeForTest(pageId, pf);
-        if (!leaf || !leaf->isLeaf) {
+        NodeHeader* node = tree.loadNodeForTest(pageId, pf);
+        if (!node || !node->isLeaf) {
             tree.unpinForTest(pageId, false);
             break;
         }
+        LeafPage* leaf = static_cast<LeafPage*>(node);
         leafCount++;
         for (int i = 0; i < leaf->size; i++)
-            allKeys.push_back(leaf->keys[i]);
+            allKeys.push_back(leaf->key(i));
         int next = leaf->nextLeaf;
         tree.unpinForTest(pageId, false);
         pageId = next;
@@ -58,7 +70,7 @@ void TestElementAccessTime(BPlusTreePaged& tree)
     long long total = 0;
     for (int i = 0; i < TRIALS; i++)
     {
-        int k = allKeys[rng() % N];
+        const string& k = allKeys[rng() % N];
         auto t1 = high_resolution_clock::now();
         tree.search(k, out);
         auto t2 = high_resolution_clock::now();
@@ -87,32 +99,34 @@ void testBloomAllLeaves(BPlusTreePaged& tree, int trials)
     {
         visited.push_back(pid);
         PageFrame* pf;
-        NodePage* leaf = tree.loadNodeForTest(pid, pf);
-        if (!leaf || !leaf->isLeaf) {
+        NodeHeader* node = tree.loadNodeForTest(pid, pf);
+        if (!node || !node->isLeaf) {
             tree.unpinForTest(pid, false);
             cout << "ERROR: Non-leaf page encountered in leaf chain.\n";
             break;
         }
+        LeafPage* leaf = static_cast<LeafPage*>(node);
         leafCount++;
         // Prepare miss keys
-        vector<int> missKeys;
+        vector<string> missKeys;
         missKeys.reserve(trials);
         for (int i = 0; i < trials; i++)
-            missKeys.push_back(0x60000000 ^ (pid * 1315423911) ^ i);
+            missKeys.push_back(intKey(0x60000000 ^ (pid * 1315423911) ^ i));
         long long bloomThis = 0;
         long long scanThis = 0;
         // Bloom test
-        for (int key : missKeys) {
+        for (const string& key : missKeys) {
             auto t1 = high_resolution_clock::now();
-            leaf->bloom.possiblyContains(key);
+            leaf->bloom.possiblyContains(key.data(), static_cast<int>(key.size()));
             auto t2 = high_resolution_clock::now();
             bloomThis += duration_cast<nanoseconds>(t2 - t1).count();
         }
         // Full leaf scan
-        for (int key : missKeys) {
+        for (const string& key : missKeys) {
             auto t1 = high_resolution_clock::now();
+            KeyRef ref(key);
             for (int i = 0; i < leaf->size; i++)
-                if (leaf->keys[i] == key)
+                if (leaf->compareAt(i, ref) == 0)
                     break;
             auto t2 = high_resolution_clock::now();
             scanThis += duration_cast<nanoseconds>(t2 - t1).count();
@@ -133,3 +147,2162 @@ void testBloomAllLeaves(BPlusTreePaged& tree, int trials)
         << (totalScan / double(totalBloom)) << "x\n";
     cout << "============================================================\n\n";
 }
+// prints what when a check does not hold, returns ok
+static bool expect(bool ok, const string& what)
+{
+    if (!ok)
+        cout << "  FAIL: " << what << "\n";
+    return ok;
+}
+// prints the outcome of a check function and passes it on
+static bool finish(bool ok)
+{
+    cout << (ok ? "PASS" : "FAIL") << "\n";
+    cout << "=============================================\n";
+    return ok;
+}
+static long long fileSize(const char* path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? static_cast<long long>(st.st_size) : -1;
+}
+// A mapped file grows by extents, a truncate cuts it to the pages in use and pages added after it work
+bool TestMmapTruncate()
+{
+    cout << "\nCheck: Mapped File Length ===\n";
+    const char* path = "test_mmap.bin";
+    remove(path);
+    bool ok = true;
+    {
+        FileDiskManager dm(path, DiskMode::Mmap);
+        if (!dm.IsMapped()) {
+            cout << "mmap not available, skipped\n";
+            return finish(true);
+        }
+        char* page = FileDiskManager::AllocAlignedPage();
+        for (int i = 0; i < 10; i++) {
+            memset(page, 'a' + i, PAGE_SIZE);
+            dm.WritePage(dm.NewPageId(), page);
+        }
+        ok &= expect(fileSize(path) == EXTENT_BYTES, "file grows a whole extent at a time");
+        dm.Truncate(3);
+        ok &= expect(dm.GetNumPages() == 3 && fileSize(path) == 3LL * PAGE_SIZE, "truncate cuts the file to 3 pages");
+        dm.ReadPage(5, page);
+        ok &= expect(page[0] == 0 && page[PAGE_SIZE - 1] == 0, "a page cut off reads as zeroes");
+        int pid = dm.NewPageId();
+        memset(page, 'z', PAGE_SIZE);
+        dm.WritePage(pid, page);
+        memset(page, 0, PAGE_SIZE);
+        dm.ReadPage(pid, page);
+        ok &= expect(pid == 3 && page[0] == 'z' && fileSize(path) == EXTENT_BYTES, "the file grows back for a new page");
+        dm.ReadPage(2, page);
+        ok &= expect(page[0] == 'c', "pages below the cut keep their bytes");
+        FileDiskManager::FreeAlignedPage(page);
+    }
+    ok &= expect(fileSize(path) == 4LL * PAGE_SIZE, "close leaves the exact page count");
+    remove(path);
+    return finish(ok);
+}
+// Fetches pages in order through a one-shard pool, returns the miss count and which of pages 0..9 stay resident
+static long runPolicy(ReplacementType type, int frames, const vector<int>& pages, string& resident)
+{
+    remove("test_policy.bin");
+    FileDiskManager dm("test_policy.bin");
+    char* page = FileDiskManager::AllocAlignedPage();
+    memset(page, 0, PAGE_SIZE);
+    for (int i = 0; i < 10; i++)
+        dm.WritePage(dm.NewPageId(), page);
+    FileDiskManager::FreeAlignedPage(page);
+    BufferPool bp(frames, &dm, type);
+    for (int pid : pages) {
+        bp.FetchPage(pid);
+        bp.UnpinPage(pid, false);
+    }
+    resident.clear();
+    for (int pid = 0; pid < 10; pid++) {
+        if (bp.ShardFor(pid).pageTable.Find(pid) != nullptr)
+            resident += static_cast<char>('0' + pid);
+    }
+    long misses = bp.GetStats().misses;
+    remove("test_policy.bin");
+    return misses;
+}
+// Misses and the pages each replacement policy keeps for two short fetch sequences
+bool TestReplacementPolicies()
+{
+    cout << "\nCheck: Replacement Policies ===\n";
+    /* three frames: 0, 1 and 2 are used twice, 3 once (the second fetch is a
+    correlated reference) and 1 once more; 4 then evicts the oldest load (FIFO,
+    2Q), the least recently used page (LRU, CLOCK) or the page seen only once (LRU-K) */
+    const vector<int> reuse = { 0, 1, 2, 0, 1, 2, 3, 3, 1, 4 };
+    /* four frames: 0 is evicted by 4 and fetched again soon after, 2Q keeps it
+    in Am while the pages of the scan 5..8 go through A1in */
+    const vector<int> ghost = { 0, 1, 2, 3, 4, 0, 5, 6, 7, 8 };
+    struct Expected { ReplacementType type; const char* name; const char* reuse; const char* ghost; };
+    const Expected expected[] = {
+        { ReplacementType::FIFO, "FIFO",  "234", "5678" },
+        { ReplacementType::LRU, "LRU",   "134", "5678" },
+        { ReplacementType::CLOCK, "CLOCK", "134", "5678" },
+        { ReplacementType::LRUK, "LRU-K", "124", "5678" },
+        { ReplacementType::TwoQ, "2Q",    "234", "0678" },
+    };
+    bool ok = true;
+    for (const Expected& e : expected) {
+        string resident;
+        long misses = runPolicy(e.type, 3, reuse, resident);
+        string name = e.name;
+        ok &= expect(misses == 5 && resident == e.reuse,
+            name + " after reuse: " + to_string(misses) + " misses, pages " + resident + " resident");
+        misses = runPolicy(e.type, 4, ghost, resident);
+        ok &= expect(misses == 10 && resident == e.ghost,
+            name + " after ghost: " + to_string(misses) + " misses, pages " + resident + " resident");
+    }
+    return finish(ok);
+}
+// Threads fetch random pages through a sharded pool far smaller than the file, every page read must be its own
+bool TestConcurrentFetches()
+{
+    cout << "\nCheck: Concurrent Fetches ===\n";
+    const int PAGES = 512;
+    const int THREADS = 4;
+    const int FETCHES = 20000;
+    remove("test_shared.bin");
+    bool ok = true;
+    {
+        FileDiskManager dm("test_shared.bin");
+        char* page = FileDiskManager::AllocAlignedPage();
+        for (int i = 0; i < PAGES; i++) {
+            memset(page, i % 251, PAGE_SIZE);
+            memcpy(page, &i, sizeof(i));
+            dm.WritePage(dm.NewPageId(), page);
+        }
+        FileDiskManager::FreeAlignedPage(page);
+        BufferPool bp(64, &dm, ReplacementType::LRU, 8);
+        atomic<int> wrong{ 0 };
+        vector<thread> threads;
+        for (int t = 0; t < THREADS; t++) {
+            threads.emplace_back([&, t]() {
+                mt19937 rng(t + 1);
+                for (int i = 0; i < FETCHES; i++) {
+                    int pid = static_cast<int>(rng() % PAGES);
+                    PageFrame* f = bp.FetchPage(pid);
+                    int stored = -1;
+                    memcpy(&stored, f->data, sizeof(stored));
+                    if (stored != pid || f->data[PAGE_SIZE - 1] != static_cast<char>(pid % 251))
+                        wrong++;
+                    bp.UnpinPage(pid, false);
+                }
+            });
+        }
+        for (thread& th : threads) th.join();
+        BufferStats s = bp.GetStats();
+        ok &= expect(wrong == 0, to_string(wrong.load()) + " fetches returned another page's bytes");
+        ok &= expect(s.fetches == THREADS * FETCHES && s.hits + s.misses == s.fetches,
+            "fetches " + to_string(s.fetches) + " = hits " + to_string(s.hits) + " + misses " + to_string(s.misses));
+        ok &= expect(s.misses > s.fetches / 2, "a pool of 64 frames misses on most of 512 pages");
+        int pinned = 0;
+        for (int pid = 0; pid < PAGES; pid++) {
+            PageFrame* f = bp.ShardFor(pid).pageTable.Find(pid);
+            if (f && f->refCount != 0) pinned++;
+        }
+        ok &= expect(pinned == 0, to_string(pinned) + " pages left pinned");
+    }
+    remove("test_shared.bin");
+    return finish(ok);
+}
+// A full scan of a tree with scattered leaves returns every item whether the leaves are read ahead or not
+bool TestLeafReadAhead()
+{
+    cout << "\nCheck: Leaf Read-Ahead ===\n";
+    const int ITEMS = 20000;
+    const int FRAMES = 64;
+    remove("test_scan.bin");
+    {
+        FileDiskManager dm("test_scan.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<int> keys(ITEMS);
+        for (int i = 0; i < ITEMS; i++)
+            keys[i] = i + 1;
+        shuffle(keys.begin(), keys.end(), mt19937(3));
+        for (int k : keys)
+            tree.insert(intKey(k), "item", k, 1, 1.0);
+        tree.close();
+    }
+    bool ok = true;
+    for (int pages : { 0, READ_AHEAD_PAGES })
+    {
+        FileDiskManager dm("test_scan.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        if (pages > 0)
+            bp.EnableReadAhead(&BPlusTreePaged::leafChainLink, pages);
+        BPlusTreePaged tree(&bp, &dm);
+        unordered_map<string, foodItem> found = tree.rangeSearch(intKey(0), intKey(ITEMS));
+        int wrong = 0;
+        for (int k = 1; k <= ITEMS; k++) {
+            auto it = found.find(intKey(k));
+            if (it == found.end() || it->second.proteinAmt != k) wrong++;
+        }
+        BufferStats st = bp.GetStats();
+        string label = "read-ahead " + to_string(pages) + ": ";
+        ok &= expect(found.size() == ITEMS && wrong == 0,
+            label + to_string(found.size()) + " items, " + to_string(wrong) + " missing or wrong");
+        if (pages == 0)
+            ok &= expect(st.prefetches == 0, label + to_string(st.prefetches) + " pages prefetched");
+        else
+            ok &= expect(st.prefetches > 0 && st.prefetches < dm.GetNumPages(),
+                label + to_string(st.prefetches) + " of " + to_string(dm.GetNumPages()) + " pages prefetched");
+        tree.close();
+    }
+    remove("test_scan.bin");
+    return finish(ok);
+}
+// Internal page ids below pid, the tree's pages are left unpinned
+static void collectInternalPages(BPlusTreePaged& tree, int pid, vector<int>& out)
+{
+    PageFrame* pf;
+    NodeHeader* node = tree.loadNodeForTest(pid, pf);
+    if (node->isLeaf) {
+        tree.unpinForTest(pid, false);
+        return;
+    }
+    InternalPage* in = static_cast<InternalPage*>(node);
+    vector<int> children(in->children(), in->children() + in->size + 1);
+    tree.unpinForTest(pid, false);
+    out.push_back(pid);
+    for (int child : children)
+        collectInternalPages(tree, child, out);
+}
+/* Leaves read by forward, reverse and short scans are one-shot, the root (read
+   first by a scan here) and any inner nodes stay ordinary and resident */
+bool TestScanOneShot()
+{
+    cout << "\nCheck: Scan One-Shot Pages ===\n";
+    const int ITEMS = 20000;
+    const int FRAMES = 16;
+    remove("test_scan.bin");
+    vector<int> internal;
+    {
+        FileDiskManager dm("test_scan.bin");
+        BufferPool bp(64, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<int> keys(ITEMS);
+        for (int i = 0; i < ITEMS; i++)
+            keys[i] = i + 1;
+        shuffle(keys.begin(), keys.end(), mt19937(5));
+        for (int k : keys)
+            tree.insert(intKey(k), "item", k, 1, 1.0);
+        collectInternalPages(tree, tree.getRootPageId(), internal);
+        tree.close();
+    }
+    bool ok = true;
+    {
+        FileDiskManager dm("test_scan.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        size_t forward = tree.rangeSearch(intKey(0), intKey(ITEMS)).size();
+        size_t reverse = 0;
+        for (RangeCursor c = tree.scan(intKey(0), intKey(ITEMS), SIZE_MAX, 0, ScanOrder::Descending); c.valid(); c.next())
+            reverse++;
+        size_t shortScans = 0;
+        for (int i = 0; i < 50; i++) {
+            ScanOrder order = i % 2 ? ScanOrder::Descending : ScanOrder::Ascending;
+            for (RangeCursor c = tree.scan(intKey(1), intKey(i * (ITEMS / 50) + 1), 2, 0, order); c.valid(); c.next())
+                shortScans++;
+        }
+        ok &= expect(forward == ITEMS && reverse == ITEMS && shortScans == 99,
+            "scans returned " + to_string(forward) + ", " + to_string(reverse) + " and " + to_string(shortScans) + " items");
+        int innerMissing = 0;
+        for (int pid : internal) {
+            PageFrame* f = bp.ShardFor(pid).pageTable.Find(pid);
+            if (!f || f->oneShot) innerMissing++;
+        }
+        ok &= expect(innerMissing == 0, to_string(innerMissing) + " internal pages evicted or one-shot after the scans");
+        int ordinaryLeaves = 0;
+        for (int pid = 1; pid < dm.GetNumPages(); pid++) {
+            PageFrame* f = bp.ShardFor(pid).pageTable.Find(pid);
+            if (f && !f->oneShot && find(internal.begin(), internal.end(), pid) == internal.end())
+                ordinaryLeaves++;
+        }
+        ok &= expect(ordinaryLeaves == 0, to_string(ordinaryLeaves) + " leaves read by scans kept as ordinary pages");
+        tree.close();
+    }
+    remove("test_scan.bin");
+    return finish(ok);
+}
+/* Inserts through a small pool with the background writer on while two threads
+   search: no search sees a wrong value and every row is on disk after a reopen */
+bool TestBackgroundWriter()
+{
+    cout << "\nCheck: Background Writer ===\n";
+    const int ITEMS = 20000;
+    const int FRAMES = 16;
+    remove("test_writer.bin");
+    bool ok = true;
+    {
+        FileDiskManager dm("test_writer.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        bp.EnableBackgroundWriter(BG_CLEAN_FRAMES, 1);
+        BPlusTreePaged tree(&bp, &dm);
+        atomic<bool> stop{ false };
+        atomic<int> wrong{ 0 };
+        vector<thread> readers;
+        for (int t = 0; t < 2; t++) {
+            readers.emplace_back([&, t]() {
+                mt19937 rng(t + 11);
+                foodItem out;
+                while (!stop) {
+                    int k = static_cast<int>(rng() % ITEMS) + 1;
+                    if (tree.search(intKey(k), out) && out.proteinAmt != k)
+                        wrong++;
+                }
+            });
+        }
+        vector<int> keys(ITEMS);
+        for (int i = 0; i < ITEMS; i++)
+            keys[i] = i + 1;
+        shuffle(keys.begin(), keys.end(), mt19937(9));
+        for (int k : keys)
+            tree.insert(intKey(k), "item", k, 1, 1.0);
+        stop = true;
+        for (thread& th : readers) th.join();
+        BufferStats st = bp.GetStats();
+        ok &= expect(wrong == 0, to_string(wrong.load()) + " searches saw a wrong value");
+        ok &= expect(st.bgWrites > 0, "the background writer wrote no page");
+        tree.close();
+    }
+    {
+        FileDiskManager dm("test_writer.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        int missing = 0;
+        foodItem out;
+        for (int k = 1; k <= ITEMS; k++) {
+            if (!tree.search(intKey(k), out) || out.proteinAmt != k)
+                missing++;
+        }
+        ok &= expect(missing == 0 && tree.count() == ITEMS,
+            to_string(missing) + " rows missing or wrong after a reopen, count " + to_string(tree.count()));
+        tree.close();
+    }
+    remove("test_writer.bin");
+    return finish(ok);
+}
+/* Frame headers sit in one array and their pages in one aligned block in the
+   same order, and pages go through O_DIRECT straight into the frames, with and
+   without huge pages asked for */
+bool TestFrameArena()
+{
+    cout << "\nCheck: Frame Arena ===\n";
+    const int FRAMES = 64;
+    const int PAGES = 200;
+    bool ok = true;
+    for (bool huge : { false, true }) {
+        remove("test_arena.bin");
+        FileDiskManager dm("test_arena.bin", DiskMode::Direct);
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU, 4, huge);
+        string label = huge ? "huge pages asked for: " : "ordinary pages: ";
+        PageFrame* first = bp.GetFrameList()->Front();
+        int n = 0;
+        int misplaced = 0;
+        for (PageFrame* f = first; f; f = f->next, n++) {
+            if (f != first + n || f->data != first->data + static_cast<long long>(n) * PAGE_SIZE
+                || reinterpret_cast<uintptr_t>(f->data) % IO_ALIGNMENT != 0)
+                misplaced++;
+        }
+        ok &= expect(n == FRAMES && misplaced == 0,
+            label + to_string(misplaced) + " of " + to_string(n) + " frames out of place or unaligned");
+        for (int i = 0; i < PAGES; i++) {
+            int pid;
+            PageFrame* f = bp.NewPage(pid);
+            memset(f->data, pid % 251, PAGE_SIZE);
+            bp.UnpinPage(pid, true);
+        }
+        bp.FlushAllPages();
+        int wrong = 0;
+        for (int pid = 0; pid < PAGES; pid++) {
+            PageFrame* f = bp.FetchPage(pid);
+            if (f->data[0] != static_cast<char>(pid % 251) || f->data[PAGE_SIZE - 1] != static_cast<char>(pid % 251))
+                wrong++;
+            bp.UnpinPage(pid, false);
+        }
+        ok &= expect(wrong == 0, label + to_string(wrong) + " pages read back wrong");
+    }
+    remove("test_arena.bin");
+    return finish(ok);
+}
+// Random inserts, erases and lookups on a PageTable against an unordered_map, for one shard and for a shard of 8
+bool TestPageTable()
+{
+    cout << "\nCheck: Page Table ===\n";
+    const int ENTRIES = 64;
+    vector<PageFrame> frames(ENTRIES);
+    bool ok = true;
+    for (int stride : { 1, 8 }) {
+        PageTable table(ENTRIES, stride);
+        unordered_map<int, PageFrame*> model;
+        mt19937 rng(stride);
+        int wrong = 0;
+        for (int op = 0; op < 200000; op++) {
+            // ids of the shard with remainder 3, dense at first and then far apart
+            int pid = static_cast<int>(rng() % (op < 100000 ? 256 : 1000000)) * stride + 3 % stride;
+            auto it = model.find(pid);
+            // a table that lost an entry would take it in twice and could fill up, stop at once
+            if (table.Find(pid) != (it == model.end() ? nullptr : it->second)) {
+                wrong++;
+                break;
+            }
+            if (it != model.end()) {
+                if (rng() % 2) {
+                    table.Erase(pid);
+                    model.erase(it);
+                }
+            }
+            else if (static_cast<int>(model.size()) < ENTRIES) {
+                PageFrame* f = &frames[rng() % ENTRIES];
+                table.Insert(pid, f);
+                model[pid] = f;
+            }
+        }
+        // erase everything left, every other entry must still be found
+        vector<int> left;
+        for (auto& e : model)
+            left.push_back(e.first);
+        for (int pid : left) {
+            if (wrong > 0) break;
+            table.Erase(pid);
+            model.erase(pid);
+            for (auto& e : model) {
+                if (table.Find(e.first) != e.second)
+                    wrong++;
+            }
+        }
+        ok &= expect(wrong == 0 && table.Size() == 0,
+            "stride " + to_string(stride) + ": " + to_string(wrong) + " lookups differ, " + to_string(table.Size()) + " entries left");
+    }
+    return finish(ok);
+}
+// A CSV with a repeated name and a malformed line loads to one item per key and reports the tree's count
+bool TestCSVLoad()
+{
+    cout << "\nCheck: CSV Load Count ===\n";
+    const char* path = "test_load.csv";
+    {
+        ofstream csv(path);
+        csv << "name,protein,calories,cost\n"
+            << "Apple,1,2,0.5\n"
+            << "Banana,3,4,0.25\n"
+            << "not a row\n"
+            << "Apple,5,6,0.75\n"
+            << "\"Cherry, dried\",7,8,1.5\n";
+    }
+    remove("test_load.bin");
+    bool ok = true;
+    {
+        FileDiskManager dm("test_load.bin");
+        BufferPool bp(16, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        size_t loaded = loadCSVIntoTree(path, tree);
+        foodItem apple;
+        ok &= expect(loaded == 3 && tree.count() == 3,
+            "loader reported " + to_string(loaded) + " items, the tree holds " + to_string(tree.count()));
+        ok &= expect(tree.search(foodKey("Apple"), apple) && apple.proteinAmt == 5, "the last of two Apple rows is kept");
+        tree.close();
+    }
+    remove("test_load.bin");
+    remove(path);
+    return finish(ok);
+}
+/* Internal pages hold about a thousand children, so 300k bulk loaded items
+   make a tree of two levels and a lookup reads two pages */
+bool TestNodeLayout()
+{
+    cout << "\nCheck: Node Layout ===\n";
+    const int ITEMS = 300000;
+    remove("test_layout.bin");
+    bool ok = expect(INTERNAL_MAX_KEYS >= 1000, "internal pages hold " + to_string(INTERNAL_MAX_KEYS) + " separators");
+    {
+        FileDiskManager dm("test_layout.bin");
+        BufferPool bp(64, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<pair<string, foodItem>> rows;
+        for (int k = 1; k <= ITEMS; k++)
+            rows.push_back({ intKey(k), foodItem("item", k, 1, 1.0) });
+        tree.bulkLoad(rows);
+        int leaves = 0;
+        int badLeaves = 0;
+        for (int pid = tree.getFirstLeafPageId(); pid != -1; leaves++) {
+            PageFrame* pf;
+            LeafPage* leaf = static_cast<LeafPage*>(tree.loadNodeForTest(pid, pf));
+            if (!leaf->isLeaf || leaf->usedBytes() > LEAF_CAPACITY)
+                badLeaves++;
+            int next = leaf->nextLeaf;
+            tree.unpinForTest(pid, false);
+            pid = next;
+        }
+        PageFrame* pf;
+        InternalPage* root = static_cast<InternalPage*>(tree.loadNodeForTest(tree.getRootPageId(), pf));
+        int rootChildren = root->isLeaf ? 0 : root->size + 1;
+        bool rootFits = root->usedBytes() <= INTERNAL_CAPACITY;
+        tree.unpinForTest(tree.getRootPageId(), false);
+        ok &= expect(badLeaves == 0, to_string(badLeaves) + " pages in the leaf chain are not leaves that fit their page");
+        ok &= expect(tree.computeTreeDepth() == 2 && rootChildren == leaves && rootFits,
+            "depth " + to_string(tree.computeTreeDepth()) + ", root over " + to_string(rootChildren) + " of "
+            + to_string(leaves) + " leaves");
+        foodItem out;
+        tree.search(intKey(ITEMS / 2), out);
+        bp.ResetStats();
+        bool found = tree.search(intKey(ITEMS / 3), out) && out.proteinAmt == ITEMS / 3;
+        ok &= expect(found && bp.GetStats().fetches == 2,
+            "a lookup read " + to_string(bp.GetStats().fetches) + " pages");
+        tree.close();
+    }
+    remove("test_layout.bin");
+    return finish(ok);
+}
+// Random inserts, erases and replacements on one slotted leaf page against a sorted vector
+bool TestSlottedLeaf()
+{
+    cout << "\nCheck: Slotted Leaf ===\n";
+    char* page = FileDiskManager::AllocAlignedPage();
+    LeafPage* leaf = reinterpret_cast<LeafPage*>(page);
+    leaf->init();
+    // every key of the page starts with the prefix, only the rest is stored
+    const string prefix = "CR";
+    leaf->setPrefix(prefix.data(), static_cast<int>(prefix.size()));
+    vector<pair<string, foodItem>> model;
+    int modelBytes = 0;
+    auto bytesOf = [&](const string& key, const foodItem& item) {
+        return LeafPage::entryBytes(static_cast<int>(key.size() - prefix.size()), item);
+    };
+    mt19937 rng(17);
+    auto randomItem = [&](int n) {
+        string name(rng() % 100, ' ');
+        for (char& c : name) c = static_cast<char>('a' + rng() % 26);
+        return foodItem(name, n, static_cast<int>(name.size()), n * 0.5);
+    };
+    int wrong = 0;
+    int refused = 0;
+    int compactions = 0;
+    for (int op = 0; op < 20000 && wrong == 0; op++) {
+        int choice = static_cast<int>(rng() % 10);
+        if (choice < 5 || model.empty()) {
+            static const char keyBytes[] = { 'A', 'B', '\0', '\xff' };
+            string key = prefix;
+            for (int n = static_cast<int>(rng() % 30); n > 0; n--)
+                key += keyBytes[rng() % 4];
+            auto at = lower_bound(model.begin(), model.end(), key,
+                [](const pair<string, foodItem>& e, const string& k) { return e.first < k; });
+            int i = leaf->lowerBound(KeyRef(key));
+            if (i != at - model.begin()) wrong++;
+            if (at != model.end() && at->first == key) continue;
+            foodItem item = randomItem(op);
+            int bytes = bytesOf(key, item);
+            int length = bytes - static_cast<int>(sizeof(LeafSlot));
+            bool fits = modelBytes + bytes <= LEAF_CAPACITY;
+            // the heap has to be packed first when the record does not fit below it
+            bool packs = leaf->heapStart - length < static_cast<int>(sizeof(LeafPage) + (leaf->size + 1) * sizeof(LeafSlot));
+            if (leaf->insertAt(i, KeyRef(key), item) != fits) wrong++;
+            if (!fits) {
+                refused++;
+                continue;
+            }
+            if (packs) {
+                compactions++;
+                if (leaf->deadBytes != 0) wrong++;
+            }
+            model.insert(at, { key, item });
+            modelBytes += bytes;
+        }
+        else if (choice < 8) {
+            int i = static_cast<int>(rng() % model.size());
+            leaf->eraseAt(i);
+            modelBytes -= bytesOf(model[i].first, model[i].second);
+            model.erase(model.begin() + i);
+        }
+        else {
+            int i = static_cast<int>(rng() % model.size());
+            foodItem item = randomItem(op);
+            int bytes = modelBytes - bytesOf(model[i].first, model[i].second) + bytesOf(model[i].first, item);
+            bool fits = bytes <= LEAF_CAPACITY;
+            if (leaf->replaceAt(i, item) != fits) wrong++;
+            if (fits) {
+                model[i].second = item;
+                modelBytes = bytes;
+            }
+        }
+        if (leaf->size != static_cast<int>(model.size()) || leaf->usedBytes() != modelBytes) wrong++;
+        for (size_t i = 0; i < model.size() && op % 50 == 0; i++) {
+            foodItem item = leaf->item(static_cast<int>(i));
+            const foodItem& want = model[i].second;
+            if (leaf->key(static_cast<int>(i)) != model[i].first || strcmp(item.foodName, want.foodName) != 0
+                || item.proteinAmt != want.proteinAmt || item.calorieAmt != want.calorieAmt || item.cost != want.cost)
+                wrong++;
+        }
+    }
+    FileDiskManager::FreeAlignedPage(page);
+    bool ok = expect(wrong == 0, to_string(wrong) + " mismatches between the leaf and the model");
+    ok &= expect(refused > 0 && compactions > 0,
+        "the page filled up " + to_string(refused) + " times and was compacted " + to_string(compactions) + " times");
+    return finish(ok);
+}
+/* keyUpperBound and its scalar and binary variants against std::upper_bound for
+   every node size up to a full internal page, with repeated keys and the int limits */
+bool TestKeySearch()
+{
+    cout << "\nCheck: Key Search (" << keySearchName() << ") ===\n";
+    mt19937 rng(18);
+    int wrong = 0;
+    for (int n = 0; n <= INTERNAL_MAX_KEYS && wrong == 0; n++) {
+        vector<int> keys(n);
+        for (int& k : keys)
+            k = static_cast<int>(rng() % 64) - 32;
+        if (n > 0) keys[0] = INT_MIN;
+        if (n > 1) keys[n - 1] = INT_MAX;
+        sort(keys.begin(), keys.end());
+        vector<int> probes = { INT_MIN, INT_MAX, -40, 40 };
+        for (int i = 0; i < n; i += 1 + n / 16) {
+            probes.push_back(keys[i]);
+            if (keys[i] != INT_MIN) probes.push_back(keys[i] - 1);
+            if (keys[i] != INT_MAX) probes.push_back(keys[i] + 1);
+        }
+        for (int p : probes) {
+            int want = static_cast<int>(upper_bound(keys.begin(), keys.end(), p) - keys.begin());
+            if (keyUpperBound(keys.data(), n, p) != want || keyUpperBoundScalar(keys.data(), n, p) != want
+                || keyUpperBoundBinary(keys.data(), n, p) != want)
+                wrong++;
+        }
+    }
+    return finish(expect(wrong == 0, to_string(wrong) + " searches disagree with std::upper_bound"));
+}
+// Keys with long shared prefixes, bytes 0 and 0xff and now and then more than MAX_KEY_BYTES
+static string modelTestKey(mt19937& rng)
+{
+    static const char* const heads[] = { "CRUNCHY TACO ", "CRUNCHY TACO SUPREME ", "BIG MAC", "A", "\xff\xff" };
+    string key;
+    int h = static_cast<int>(rng() % 7);
+    if (h < 5) key = heads[h];
+    else if (h == 5) key = string("\0\0", 2);
+    int n = static_cast<int>(rng() % 12);
+    if (rng() % 20 == 0) n = 100 + static_cast<int>(rng() % 100);
+    for (int i = 0; i < n; i++)
+        key.push_back("ABC\0\xff ZQ"[rng() % 8]);
+    return key;
+}
+// Walks the subtree under pid: keys in order and inside the separators, leaf prefixes, subtree counts
+static long long walkModelTree(BPlusTreePaged& tree, int pid, const string& low, const string& high,
+    vector<string>& keys, int& errors)
+{
+    PageFrame* pf;
+    NodeHeader* node = tree.loadNodeForTest(pid, pf);
+    if (node->isLeaf) {
+        LeafPage* leaf = static_cast<LeafPage*>(node);
+        string prefix(leaf->prefix, leaf->prefixBytes());
+        if (static_cast<int>(prefix.size()) != commonPrefix(low, high) || leaf->usedBytes() > LEAF_CAPACITY)
+            errors++;
+        for (int i = 0; i < leaf->size; i++) {
+            string key = leaf->key(i);
+            if (key < low || key >= high || key.compare(0, prefix.size(), prefix) != 0)
+                errors++;
+            keys.push_back(key);
+        }
+        long long n = leaf->size;
+        tree.unpinForTest(pid, false);
+        return n;
+    }
+    InternalPage* in = static_cast<InternalPage*>(node);
+    vector<string> seps;
+    for (int i = 0; i < in->size; i++)
+        seps.push_back(in->key(i));
+    vector<int> children(in->children(), in->children() + in->size + 1);
+    vector<int> counts(in->counts(), in->counts() + in->size + 1);
+    tree.unpinForTest(pid, false);
+    long long total = 0;
+    for (size_t i = 0; i < children.size(); i++) {
+        long long n = walkModelTree(tree, children[i], i > 0 ? seps[i - 1] : low,
+            i < seps.size() ? seps[i] : high, keys, errors);
+        if (n != counts[i])
+            errors++;
+        total += n;
+    }
+    return total;
+}
+// Compares the tree with model: structure, then point, range, order statistic and cursor queries
+static int checkAgainstModel(BPlusTreePaged& tree, const map<string, int>& model, mt19937& rng)
+{
+    int errors = 0;
+    vector<string> keys;
+    for (const auto& kv : model)
+        keys.push_back(kv.first);
+    if (tree.count() != keys.size())
+        errors++;
+    if (tree.getRootPageId() > 0 && !keys.empty()) {
+        vector<string> walked;
+        walkModelTree(tree, tree.getRootPageId(), string(), maxKey(), walked, errors);
+        vector<string> scanned;
+        for (RangeCursor c = tree.scan(string(), maxKey()); c.valid(); c.next())
+            scanned.push_back(c.key());
+        if (walked != keys || scanned != keys)
+            errors++;
+    }
+    for (int q = 0; q < 300; q++) {
+        string k = modelTestKey(rng);
+        foodItem item;
+        auto it = model.find(k);
+        bool found = tree.search(k, item);
+        if (found != (it != model.end()) || (found && item.proteinAmt != it->second))
+            errors++;
+        if (tree.rank(k) != static_cast<size_t>(lower_bound(keys.begin(), keys.end(), k) - keys.begin()))
+            errors++;
+        size_t i = rng() % (keys.size() + 3);
+        string key;
+        bool selected = tree.select(i, key, item);
+        if (selected != (i < keys.size()) || (selected && (key != keys[i] || item.proteinAmt != model.at(key))))
+            errors++;
+        string a = modelTestKey(rng), b = modelTestKey(rng);
+        if (b < a) swap(a, b);
+        auto first = lower_bound(keys.begin(), keys.end(), a);
+        auto last = upper_bound(keys.begin(), keys.end(), b);
+        if (tree.countRange(a, b) != static_cast<size_t>(last - first))
+            errors++;
+        if (q % 10 != 0)
+            continue;
+        if (tree.rangeSearch(a, b).size() != static_cast<size_t>(last - first))
+            errors++;
+        size_t limit = rng() % 30, offset = rng() % 40;
+        bool desc = rng() % 2 != 0;
+        vector<string> expect(first, last);
+        if (desc) reverse(expect.begin(), expect.end());
+        expect.erase(expect.begin(), expect.begin() + min(offset, expect.size()));
+        if (expect.size() > limit) expect.resize(limit);
+        vector<string> got;
+        for (RangeCursor c = tree.scan(a, b, limit, offset, desc ? ScanOrder::Descending : ScanOrder::Ascending);
+            c.valid(); c.next())
+            got.push_back(c.key());
+        if (got != expect)
+            errors++;
+    }
+    return errors;
+}
+// Random inserts, removes, batches and a reopen checked step by step against a std::map
+bool TestTreeAgainstMap()
+{
+    cout << "\nTree Against std::map ===\n";
+    remove("test_model.bin");
+    mt19937 rng(7);
+    map<string, int> model;
+    // keys over MAX_KEY_BYTES are refused, never cut
+    auto fits = [](const string& k) { return k.size() <= static_cast<size_t>(MAX_KEY_BYTES); };
+    int errors = 0;
+    // a small pool, so pages are written out and read back in between
+    {
+        FileDiskManager dm("test_model.bin");
+        BufferPool bp(64, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<pair<string, foodItem>> rows;
+        for (int i = 0; i < 8000; i++) {
+            string k = modelTestKey(rng);
+            rows.push_back({ k, foodItem("bulk", i, 0, 0) });
+            if (fits(k)) model[k] = i;
+        }
+        tree.bulkLoad(rows);
+        errors += checkAgainstModel(tree, model, rng);
+        for (int round = 0; round < 3; round++) {
+            for (int i = 0; i < 8000; i++) {
+                string k = modelTestKey(rng);
+                if (rng() % 3 == 0) {
+                    if (tree.remove(k) != (model.erase(k) == 1))
+                        errors++;
+                }
+                else {
+                    if (tree.insert(k, string(1 + rng() % 90, 'y'), i, 0, 0) != fits(k))
+                        errors++;
+                    if (fits(k)) model[k] = i;
+                }
+            }
+            errors += checkAgainstModel(tree, model, rng);
+            // removes from the same stretch of keys, so leaves underflow and merge
+            for (int i = 0; i < 5000; i++) {
+                auto it = model.lower_bound(modelTestKey(rng));
+                if (it == model.end()) continue;
+                tree.remove(it->first);
+                model.erase(it);
+            }
+            errors += checkAgainstModel(tree, model, rng);
+            vector<pair<string, foodItem>> batch;
+            for (int i = 0; i < 6000; i++) {
+                string k = modelTestKey(rng);
+                batch.push_back({ k, foodItem(string(1 + rng() % 60, 'z'), 100000 + i, 0, 0) });
+                if (fits(k)) model[k] = 100000 + i;
+            }
+            tree.insertBatch(batch);
+            errors += checkAgainstModel(tree, model, rng);
+        }
+        tree.close();
+    }
+    // reopened from the file, then emptied
+    {
+        FileDiskManager dm("test_model.bin");
+        BufferPool bp(64, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        errors += checkAgainstModel(tree, model, rng);
+        vector<string> keys;
+        for (const auto& kv : model)
+            keys.push_back(kv.first);
+        shuffle(keys.begin(), keys.end(), rng);
+        for (size_t i = 0; i < keys.size(); i++) {
+            tree.remove(keys[i]);
+            model.erase(keys[i]);
+            if (i % 5000 == 0)
+                errors += checkAgainstModel(tree, model, rng);
+        }
+        errors += checkAgainstModel(tree, model, rng);
+        tree.close();
+    }
+    remove("test_model.bin");
+    cout << (errors == 0 ? "PASS" : "FAIL") << ": " << errors << " mismatch(es)\n";
+    cout << "=============================================\n";
+    return errors == 0;
+}
+// Readers search and scan while writers insert and remove between the
+// bulk-loaded keys; the tree must end up matching the writers' models
+static string concurrentBaseKey(int i)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "BASE ITEM NUMBER %08d", i);
+    return buf;
+}
+bool TestConcurrentTree()
+{
+    cout << "\nCheck: Concurrent Tree ===\n";
+    const int BASE = 30000;
+    const int READERS = 4;
+    const int WRITERS = 3;
+    const int OPS = 20000;
+    const size_t baseLen = concurrentBaseKey(0).size();
+    remove("test_concurrent.bin");
+    bool ok = true;
+    {
+        FileDiskManager dm("test_concurrent.bin");
+        BufferPool bp(32, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<pair<string, foodItem>> rows;
+        for (int i = 0; i < BASE; i++)
+            rows.push_back({ concurrentBaseKey(i), foodItem("base", i, 1, 1.0) });
+        tree.bulkLoad(rows);
+        atomic<bool> stop{ false };
+        atomic<int> badLookups{ 0 }, badScans{ 0 }, badRemoves{ 0 };
+        atomic<long> lookups{ 0 }, scans{ 0 };
+        vector<map<string, int>> models(WRITERS);
+        vector<thread> readers, writers;
+        for (int r = 0; r < READERS; r++) {
+            readers.emplace_back([&, r] {
+                mt19937 rng(r);
+                foodItem out;
+                while (!stop) {
+                    int i = rng() % BASE;
+                    if (!tree.search(concurrentBaseKey(i), out) || out.proteinAmt != i)
+                        badLookups++;
+                    lookups++;
+                    if (rng() % 32 != 0)
+                        continue;
+                    // the base keys in a range never change, whatever the writers do
+                    int a = rng() % (BASE - 300);
+                    ScanOrder order = rng() % 2 ? ScanOrder::Descending : ScanOrder::Ascending;
+                    int seen = 0;
+                    string prev;
+                    for (RangeCursor c = tree.scan(concurrentBaseKey(a), concurrentBaseKey(a + 300), SIZE_MAX, 0, order); c.valid(); c.next()) {
+                        if (!prev.empty() && (order == ScanOrder::Ascending ? !(prev < c.key()) : !(c.key() < prev)))
+                            badScans++;
+                        prev = c.key();
+                        if (c.key().size() != baseLen)
+                            continue;
+                        seen++;
+                        if (concurrentBaseKey(c.item().proteinAmt) != c.key())
+                            badScans++;
+                    }
+                    if (seen != 301)
+                        badScans++;
+                    scans++;
+                }
+            });
+        }
+        for (int w = 0; w < WRITERS; w++) {
+            writers.emplace_back([&, w] {
+                mt19937 rng(100 + w);
+                map<string, int>& model = models[w];
+                for (int op = 0; op < OPS; op++) {
+                    // sorts between two base keys, so their leaves split and merge
+                    string k = concurrentBaseKey(rng() % BASE) + char('a' + w) + string(rng() % 40, 'x');
+                    if (rng() % 3) {
+                        tree.insert(k, "writer", op, 2, 2.0);
+                        model[k] = op;
+                        continue;
+                    }
+                    auto it = model.lower_bound(k);
+                    if (it == model.end())
+                        continue;
+                    if (!tree.remove(it->first))
+                        badRemoves++;
+                    model.erase(it);
+                }
+            });
+        }
+        for (thread& t : writers)
+            t.join();
+        stop = true;
+        for (thread& t : readers)
+            t.join();
+        ok &= expect(badLookups == 0, to_string(badLookups.load()) + " base key lookup(s) missed during writes");
+        ok &= expect(badScans == 0, to_string(badScans.load()) + " scan(s) out of order or missing base keys");
+        ok &= expect(badRemoves == 0, to_string(badRemoves.load()) + " remove(s) of a writer's own key failed");
+        ok &= expect(lookups > 0 && scans > 0, "readers made no progress");
+        map<string, int> model;
+        for (int i = 0; i < BASE; i++)
+            model[concurrentBaseKey(i)] = i;
+        for (const auto& m : models)
+            model.insert(m.begin(), m.end());
+        // structure, count, rank and select once the writers are done
+        mt19937 rng(9);
+        int mismatches = checkAgainstModel(tree, model, rng);
+        for (const auto& kv : model) {
+            foodItem out;
+            if (!tree.search(kv.first, out) || out.proteinAmt != kv.second)
+                mismatches++;
+        }
+        ok &= expect(mismatches == 0, to_string(mismatches) + " mismatch(es) against the writers' models");
+        cout << "  " << lookups << " lookups, " << scans << " scans, " << model.size() << " keys at the end\n";
+        tree.close();
+    }
+    remove("test_concurrent.bin");
+    return finish(ok);
+}
+// The same delta put into a loaded tree by insert() and by insertBatch():
+// the trees must match and the batch must descend far less often
+bool TestInsertBatch()
+{
+    cout << "\nCheck: Insert Batch ===\n";
+    const int ITEMS = 40000;
+    const int ROWS = 20000;
+    bool ok = true;
+    mt19937 rng(12);
+    // odd keys between the loaded even ones, with repeats that the last copy wins,
+    // a few loaded keys replaced, and a dense run that splits one leaf many times
+    vector<pair<string, foodItem>> delta;
+    for (int i = 0; i < ROWS; i++)
+        delta.push_back({ intKey(2 * static_cast<int>(rng() % ITEMS) + 1), foodItem("odd", i, 2, 2.0) });
+    for (int i = 0; i < 500; i++)
+        delta.push_back({ intKey(2 * static_cast<int>(rng() % ITEMS)), foodItem("even", ROWS + i, 2, 2.0) });
+    for (int i = 0; i < 3000; i++)
+        delta.push_back({ intKey(2 * (ITEMS / 2)) + "~" + to_string(i), foodItem("run", ROWS + 500 + i, 2, 2.0) });
+    shuffle(delta.begin(), delta.end(), rng);
+    map<string, int> model;
+    for (int i = 0; i < ITEMS; i++)
+        model[intKey(2 * i)] = i;
+    map<string, int> distinct;
+    for (const auto& r : delta) {
+        model[r.first] = r.second.proteinAmt;
+        distinct[r.first]++;
+    }
+    long fetches[2] = { 0, 0 };
+    vector<string> scanned[2];
+    for (int batched = 0; batched < 2; batched++) {
+        remove("test_batch.bin");
+        {
+            FileDiskManager dm("test_batch.bin");
+            BufferPool bp(64, &dm, ReplacementType::LRU);
+            BPlusTreePaged tree(&bp, &dm);
+            vector<pair<string, foodItem>> rows;
+            for (int i = 0; i < ITEMS; i++)
+                rows.push_back({ intKey(2 * i), foodItem("item", i, 1, 1.0) });
+            tree.bulkLoad(rows);
+            bp.ResetStats();
+            if (batched) {
+                vector<pair<string, foodItem>> batch = delta;
+                size_t n = tree.insertBatch(batch);
+                ok &= expect(n == distinct.size(), "insertBatch returned " + to_string(n) + ", expected " + to_string(distinct.size()));
+            }
+            else {
+                for (const auto& r : delta)
+                    tree.insert(r.first, r.second.foodName, r.second.proteinAmt, r.second.calorieAmt, r.second.cost);
+            }
+            fetches[batched] = bp.GetStats().fetches;
+            tree.close();
+        }
+        // reopened, so the header and the counts on disk are checked too
+        {
+            FileDiskManager dm("test_batch.bin");
+            BufferPool bp(64, &dm, ReplacementType::LRU);
+            BPlusTreePaged tree(&bp, &dm);
+            int mismatches = checkAgainstModel(tree, model, rng);
+            for (const auto& kv : model) {
+                foodItem out;
+                if (!tree.search(kv.first, out) || out.proteinAmt != kv.second)
+                    mismatches++;
+            }
+            ok &= expect(mismatches == 0, string(batched ? "insertBatch" : "insert") + ": " + to_string(mismatches) + " mismatch(es) against the model");
+            for (RangeCursor c = tree.scan(string(), maxKey()); c.valid(); c.next())
+                scanned[batched].push_back(c.key());
+            tree.close();
+        }
+    }
+    ok &= expect(scanned[0] == scanned[1], "insert() and insertBatch() left different keys");
+    ok &= expect(fetches[1] * 4 < fetches[0], "insertBatch fetched " + to_string(fetches[1]) + " pages, insert() " + to_string(fetches[0]));
+    cout << "  " << delta.size() << " rows: insert() " << fetches[0] << " fetches, insertBatch " << fetches[1] << "\n";
+    // an empty tree takes the batch as a bulk load
+    remove("test_batch.bin");
+    {
+        FileDiskManager dm("test_batch.bin");
+        BufferPool bp(64, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<pair<string, foodItem>> batch = delta;
+        size_t n = tree.insertBatch(batch);
+        ok &= expect(n == distinct.size() && tree.count() == distinct.size(), "insertBatch into an empty tree loaded " + to_string(n) + " keys");
+        foodItem out;
+        ok &= expect(tree.search(delta.back().first, out), "a batched key is missing from the empty tree");
+        tree.close();
+    }
+    remove("test_batch.bin");
+    return finish(ok);
+}
+// Pages of the file held by a pin
+static int pinnedPages(BufferPool& bp, FileDiskManager& dm)
+{
+    int pinned = 0;
+    for (int pid = 0; pid < dm.GetNumPages(); pid++) {
+        PageFrame* f = bp.ShardFor(pid).pageTable.Find(pid);
+        if (f && f->refCount != 0) pinned++;
+    }
+    return pinned;
+}
+// Cursors over random ranges against a sorted vector, in both directions and
+// with limits, holding at most one leaf and stopping early
+bool TestRangeCursor()
+{
+    cout << "\nCheck: Range Cursor ===\n";
+    const int ITEMS = 20000;
+    remove("test_cursor.bin");
+    bool ok = true;
+    {
+        FileDiskManager dm("test_cursor.bin");
+        BufferPool bp(64, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        mt19937 rng(21);
+        vector<int> order(ITEMS);
+        for (int i = 0; i < ITEMS; i++)
+            order[i] = 3 * i;
+        shuffle(order.begin(), order.end(), rng);
+        for (int k : order)
+            tree.insert(intKey(k), "item", k, 1, 1.0);
+        vector<string> keys;
+        for (int i = 0; i < ITEMS; i++)
+            keys.push_back(intKey(3 * i));
+        int wrong = 0;
+        for (int q = 0; q < 300; q++) {
+            // bounds on and between the keys, sometimes the wrong way round
+            string k1 = intKey(rng() % (3 * ITEMS + 6));
+            string k2 = intKey(rng() % (3 * ITEMS + 6));
+            size_t limit = rng() % 3 ? rng() % 200 : SIZE_MAX;
+            ScanOrder dir = rng() % 2 ? ScanOrder::Descending : ScanOrder::Ascending;
+            vector<string> expected;
+            if (k1 <= k2)
+                expected.assign(lower_bound(keys.begin(), keys.end(), k1), upper_bound(keys.begin(), keys.end(), k2));
+            if (dir == ScanOrder::Descending)
+                reverse(expected.begin(), expected.end());
+            if (expected.size() > limit)
+                expected.resize(limit);
+            vector<string> got;
+            for (RangeCursor c = tree.scan(k1, k2, limit, 0, dir); c.valid(); c.next()) {
+                got.push_back(c.key());
+                if (intKey(c.item().proteinAmt) != c.key())
+                    wrong++;
+            }
+            if (got != expected)
+                wrong++;
+        }
+        ok &= expect(wrong == 0, to_string(wrong) + " of 300 ranges differ from the sorted keys");
+        ok &= expect(pinnedPages(bp, dm) == 0, "finished cursors left pages pinned");
+        // one leaf pinned while the cursor walks the chain, none once closed
+        int maxPinned = 0;
+        size_t seen = 0;
+        {
+            RangeCursor c = tree.scan(string(), maxKey());
+            for (; c.valid() && seen < keys.size() / 2; c.next(), seen++)
+                if (seen % 97 == 0)
+                    maxPinned = max(maxPinned, pinnedPages(bp, dm));
+            c.close();
+            ok &= expect(pinnedPages(bp, dm) == 0, "a closed cursor still holds its leaf");
+        }
+        ok &= expect(maxPinned == 1, "an open cursor held " + to_string(maxPinned) + " pages");
+        // stopping after the first 50 reads the path and a leaf, not the whole range
+        bp.ResetStats();
+        size_t firstFifty = 0;
+        for (RangeCursor c = tree.scan(string(), maxKey(), 50); c.valid(); c.next())
+            firstFifty++;
+        long limitedFetches = bp.GetStats().fetches;
+        bp.ResetStats();
+        size_t all = 0;
+        for (RangeCursor c = tree.scan(string(), maxKey()); c.valid(); c.next())
+            all++;
+        long fullFetches = bp.GetStats().fetches;
+        ok &= expect(firstFifty == 50 && all == keys.size(), "limited and full scans returned " + to_string(firstFifty) + " and " + to_string(all));
+        ok &= expect(limitedFetches <= 4 && fullFetches > 20 * limitedFetches,
+            "limit 50 fetched " + to_string(limitedFetches) + " pages, the full scan " + to_string(fullFetches));
+        cout << "  limit 50: " << limitedFetches << " fetches, full scan: " << fullFetches << "\n";
+        // inserts while a cursor is open: keys stay in order and none of the old ones is skipped
+        vector<string> walked;
+        for (RangeCursor c = tree.scan(string(), maxKey()); c.valid(); c.next()) {
+            walked.push_back(c.key());
+            if (walked.size() % 50 == 0) {
+                int k = c.item().proteinAmt;
+                tree.insert(intKey(k - 1), "item", -1, 1, 1.0);
+                tree.insert(intKey(k + 1) + string(40, 'x'), "item", -1, 1, 1.0);
+            }
+        }
+        bool sorted = adjacent_find(walked.begin(), walked.end(), greater_equal<string>()) == walked.end();
+        vector<string> old;
+        for (const string& k : walked)
+            if (binary_search(keys.begin(), keys.end(), k))
+                old.push_back(k);
+        ok &= expect(sorted && old == keys, "a cursor over a changing tree lost its order or skipped keys");
+        tree.close();
+    }
+    remove("test_cursor.bin");
+    return finish(ok);
+}
+// Letter ranges in either case and either order, paged with limit and offset,
+// against names sorted the way the keys are
+bool TestLetterRange()
+{
+    cout << "\nCheck: Letter Range ===\n";
+    remove("test_letters.bin");
+    bool ok = true;
+    {
+        FileDiskManager dm("test_letters.bin");
+        BufferPool bp(64, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        mt19937 rng(22);
+        const string first = "aBcCdDeZz";
+        map<string, string> model;  // key -> name
+        for (int i = 0; i < 3000; i++) {
+            string name = string(1, first[rng() % first.size()]) + "ood item " + to_string(i);
+            tree.insert(foodKey(name), name, i, 1, 1.0);
+            model[foodKey(name)] = name;
+        }
+        auto upper = [](char ch) { return static_cast<char>(toupper(static_cast<unsigned char>(ch))); };
+        const pair<char, char> ranges[] = { { 'c', 'D' }, { 'D', 'c' }, { 'C', 'D' }, { 'd', 'c' }, { 'a', 'z' }, { 'Z', 'a' }, { 'e', 'e' } };
+        for (const auto& r : ranges) {
+            char lo = min(upper(r.first), upper(r.second));
+            char hi = max(upper(r.first), upper(r.second));
+            vector<string> expected;
+            for (const auto& kv : model)
+                if (upper(kv.second[0]) >= lo && upper(kv.second[0]) <= hi)
+                    expected.push_back(kv.second);
+            string label = string("('") + r.first + "', '" + r.second + "')";
+            ok &= expect(!expected.empty(), label + " has no names to check");
+            ok &= expect(tree.countByChar(r.first, r.second) == expected.size(), label + " count");
+            for (ScanOrder dir : { ScanOrder::Ascending, ScanOrder::Descending }) {
+                vector<string> want = expected;
+                if (dir == ScanOrder::Descending)
+                    reverse(want.begin(), want.end());
+                vector<string> got;
+                for (RangeCursor c = tree.scanByChar(r.first, r.second, SIZE_MAX, 0, dir); c.valid(); c.next())
+                    got.push_back(c.item().foodName);
+                ok &= expect(got == want, label + (dir == ScanOrder::Descending ? " descending" : " ascending"));
+                // pages of 37 rows put back together give the whole range
+                const size_t PAGE = 37;
+                vector<string> paged;
+                bool shortPage = false;
+                for (size_t offset = 0; offset < want.size() + PAGE; offset += PAGE) {
+                    size_t rows = 0;
+                    for (RangeCursor c = tree.scanByChar(r.first, r.second, PAGE, offset, dir); c.valid(); c.next(), rows++)
+                        paged.push_back(c.item().foodName);
+                    if (rows != min(PAGE, want.size() - min(offset, want.size())))
+                        shortPage = true;
+                }
+                ok &= expect(paged == want && !shortPage, label + " paged with limit and offset");
+            }
+        }
+        tree.close();
+    }
+    remove("test_letters.bin");
+    return finish(ok);
+}
+// count, rank, select and countRange after splits and merges, against a
+// sorted vector, each in a few page reads and kept across a reopen
+bool TestOrderStatistics()
+{
+    cout << "\nCheck: Order Statistics ===\n";
+    const int ITEMS = 100000;
+    remove("test_stats.bin");
+    bool ok = true;
+    mt19937 rng(23);
+    vector<string> keys;
+    vector<int> order(ITEMS);
+    {
+        FileDiskManager dm("test_stats.bin");
+        BufferPool bp(256, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        for (int i = 0; i < ITEMS; i++)
+            order[i] = 2 * i;
+        shuffle(order.begin(), order.end(), rng);
+        for (int k : order)
+            tree.insert(intKey(k), "item", k, 1, 1.0);
+        // a third removed again, so leaves merge and the counts shrink
+        for (int i = 0; i < ITEMS / 3; i++)
+            tree.remove(intKey(order[i]));
+        for (int i = ITEMS / 3; i < ITEMS; i++)
+            keys.push_back(intKey(order[i]));
+        sort(keys.begin(), keys.end());
+        size_t n = keys.size();
+        int depth = tree.computeTreeDepth();
+        ok &= expect(depth >= 2, "the root is a leaf, there are no counts to read");
+        bp.ResetStats();
+        size_t counted = tree.count();
+        ok &= expect(counted == n, "count() is " + to_string(counted) + ", expected " + to_string(n));
+        ok &= expect(bp.GetStats().fetches == 1, "count() read more than the root");
+        int wrong = 0;
+        long fetches = 0, calls = 0;
+        for (size_t i = 0; i < n; i += 53) {
+            string key;
+            foodItem item;
+            bp.ResetStats();
+            if (!tree.select(i, key, item) || key != keys[i] || intKey(item.proteinAmt) != key)
+                wrong++;
+            if (tree.rank(keys[i]) != i || tree.rank(keys[i] + '\x01') != i + 1)
+                wrong++;
+            // two random bounds, one of them between keys
+            size_t a = rng() % n, b = rng() % n;
+            size_t expected = a <= b ? b - a + 1 : 0;
+            if (tree.countRange(keys[a], keys[b]) != expected || tree.countRange(keys[a] + '\x01', keys[a]) != 0)
+                wrong++;
+            fetches += bp.GetStats().fetches;
+            calls += 5;
+        }
+        string key;
+        foodItem item;
+        if (tree.select(n, key, item) || tree.rank(maxKey()) != n || tree.countRange(string(), maxKey()) != n)
+            wrong++;
+        ok &= expect(wrong == 0, to_string(wrong) + " answers differ from the sorted keys");
+        double perCall = fetches / double(calls);
+        ok &= expect(perCall <= 2 * depth, to_string(perCall) + " fetches per call in a tree " + to_string(depth) + " deep");
+        cout << "  " << n << " keys, depth " << depth << ", " << perCall << " fetches per rank/select/countRange\n";
+        tree.close();
+    }
+    // the counts are on disk with the nodes
+    {
+        FileDiskManager dm("test_stats.bin");
+        BufferPool bp(256, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        map<string, int> model;
+        for (int i = ITEMS / 3; i < ITEMS; i++)
+            model[intKey(order[i])] = order[i];
+        int mismatches = checkAgainstModel(tree, model, rng);
+        ok &= expect(mismatches == 0, to_string(mismatches) + " mismatch(es) after reopening");
+        tree.close();
+    }
+    remove("test_stats.bin");
+    return finish(ok);
+}
+// Names that only differ in case, or past what used to be kept of a key, are
+// records of their own; names too long for a key are refused, never cut
+bool TestNameKeys()
+{
+    cout << "\nCheck: Name Keys ===\n";
+    const string longName(MAX_NAME_BYTES, 'L');
+    const vector<string> names = { "Crunchy Taco", "crunchy taco", "CRUNCHY TACO", "Crunchy taco",
+        "Crunchy Tacos", "crunchy Taco Supreme", "Crunchy", "Apple", "apple", "Zucchini",
+        longName, longName.substr(0, MAX_NAME_BYTES - 1) + "l", longName.substr(0, MAX_NAME_BYTES - 1) };
+    const string tooLong = longName + "L";
+    remove("test_names.bin");
+    bool ok = true;
+    {
+        FileDiskManager dm("test_names.bin");
+        BufferPool bp(16, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        for (size_t i = 0; i < names.size(); i++)
+            ok &= expect(tree.insert(foodKey(names[i]), names[i], static_cast<int>(i), 1, 1.0), "\"" + names[i] + "\" was refused");
+        ok &= expect(!tree.insert(foodKey(tooLong), tooLong, -1, 1, 1.0), "a name over MAX_NAME_BYTES was stored");
+        ok &= expect(tree.count() == names.size(), to_string(tree.count()) + " records for " + to_string(names.size()) + " names");
+        foodItem out;
+        for (size_t i = 0; i < names.size(); i++)
+            ok &= expect(tree.search(foodKey(names[i]), out) && out.proteinAmt == static_cast<int>(i)
+                && names[i].compare(0, sizeof(out.foodName) - 1, out.foodName) == 0, "\"" + names[i] + "\" found another record");
+        ok &= expect(!tree.search(foodKey(tooLong), out) && !tree.search(foodKey("CRUNCHY TACOS"), out),
+            "a name that was never stored was found");
+        // keys sort the names regardless of case
+        string prev;
+        for (RangeCursor c = tree.scan(string(), maxKey()); c.valid(); c.next()) {
+            string folded = foodKeyPrefix(c.item().foodName);
+            ok &= expect(prev <= folded, "\"" + string(c.item().foodName) + "\" sorts before \"" + prev + "\"");
+            prev = folded;
+        }
+        // a prefix in any case finds every variant, and only those
+        vector<foodItem> tacos = tree.prefixSearch("cRuNcHy T");
+        ok &= expect(tacos.size() == 6 && tree.prefixCount("CRUNCHY T") == 6,
+            "prefix search found " + to_string(tacos.size()) + " of 6 names");
+        ok &= expect(tree.countByChar('a', 'A') == 2, "letter a holds " + to_string(tree.countByChar('a', 'A')) + " names");
+        // a batch drops the name it cannot key and keeps the case variants apart
+        vector<pair<string, foodItem>> batch = { { foodKey("zucchini"), foodItem("zucchini", 100, 1, 1.0) },
+            { foodKey(tooLong), foodItem(tooLong, 101, 1, 1.0) }, { foodKey("ZUCCHINI"), foodItem("ZUCCHINI", 102, 1, 1.0) } };
+        ok &= expect(tree.insertBatch(batch) == 2 && tree.count() == names.size() + 2, "insertBatch kept a name it cannot key");
+        tree.close();
+    }
+    remove("test_names.bin");
+    // the loader skips the long row and keeps the others apart
+    const char* path = "test_names.csv";
+    {
+        ofstream csv(path);
+        csv << "name,protein,calories,cost\n" << "Apple,1,2,0.5\n" << "apple,3,4,0.25\n"
+            << tooLong << ",5,6,0.75\n" << longName << ",7,8,1.5\n";
+    }
+    {
+        FileDiskManager dm("test_names.bin");
+        BufferPool bp(16, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        size_t loaded = loadCSVIntoTree(path, tree);
+        foodItem out;
+        ok &= expect(loaded == 3 && tree.search(foodKey(longName), out) && out.proteinAmt == 7 && !tree.search(foodKey(tooLong), out),
+            "loaded " + to_string(loaded) + " of the 3 names that fit");
+        tree.close();
+    }
+    remove("test_names.bin");
+    remove(path);
+    return finish(ok);
+}
+// What the prefix compression check counts while walking a tree
+struct CompressionCounts {
+    int leaves = 0;
+    long long prefixBytes = 0;  // shared key bytes the leaves keep once
+    int notShortest = 0;        // separators longer than the shortest key between their children
+};
+// Smallest and largest key under pid, counting its leaves and separators on the way
+static void separatorSpan(BPlusTreePaged& tree, int pid, string& lo, string& hi, CompressionCounts& counts)
+{
+    PageFrame* pf;
+    NodeHeader* node = tree.loadNodeForTest(pid, pf);
+    if (node->isLeaf) {
+        LeafPage* leaf = static_cast<LeafPage*>(node);
+        lo = leaf->key(0);
+        hi = leaf->key(leaf->size - 1);
+        counts.leaves++;
+        counts.prefixBytes += leaf->prefixBytes();
+        tree.unpinForTest(pid, false);
+        return;
+    }
+    InternalPage* in = static_cast<InternalPage*>(node);
+    vector<string> seps;
+    for (int i = 0; i < in->size; i++)
+        seps.push_back(in->key(i));
+    vector<int> children(in->children(), in->children() + in->size + 1);
+    tree.unpinForTest(pid, false);
+    string prevHi;
+    for (size_t i = 0; i < children.size(); i++) {
+        string childLo, childHi;
+        separatorSpan(tree, children[i], childLo, childHi, counts);
+        if (i == 0) lo = childLo;
+        else if (seps[i - 1] != shortestSeparator(prevHi, childLo)) counts.notShortest++;
+        prevHi = childHi;
+    }
+    hi = prevHi;
+}
+// Names that share long prefixes against names of the same length that do
+// not: leaves store the shared bytes once and separators are cut short
+bool TestPrefixCompression()
+{
+    cout << "\nCheck: Prefix Compression ===\n";
+    const int ITEMS = 60000;
+    mt19937 rng(25);
+    long long bytes[2] = { 0, 0 };
+    int leaves[2] = { 0, 0 };
+    bool ok = true;
+    for (int shared = 0; shared < 2; shared++) {
+        remove("test_prefix.bin");
+        vector<pair<string, foodItem>> rows;
+        map<string, int> model;
+        for (int i = 0; i < ITEMS; i++) {
+            char num[16];
+            snprintf(num, sizeof(num), " %08d", i);
+            string name = "Crunchy Taco Supreme (Taco Bell)";
+            if (!shared)
+                for (char& ch : name) ch = static_cast<char>('A' + rng() % 26);
+            name += num;
+            rows.push_back({ foodKey(name), foodItem("x", i, 1, 1.0) });
+            model[foodKey(name)] = i;
+        }
+        {
+            FileDiskManager dm("test_prefix.bin");
+            BufferPool bp(64, &dm, ReplacementType::LRU);
+            BPlusTreePaged tree(&bp, &dm);
+            tree.bulkLoad(rows);
+            CompressionCounts counts;
+            string lo, hi;
+            separatorSpan(tree, tree.getRootPageId(), lo, hi, counts);
+            leaves[shared] = counts.leaves;
+            ok &= expect(counts.notShortest == 0, to_string(counts.notShortest) + " bulk loaded separators are longer than they need to be");
+            if (shared)
+                ok &= expect(counts.prefixBytes >= 30LL * counts.leaves, "leaves keep " + to_string(counts.prefixBytes / counts.leaves) + " prefix bytes each");
+            // rows added after the load go through splits, which cut separators too
+            for (int i = 0; i < ITEMS / 4; i++) {
+                string k = rows[rng() % rows.size()].first + "2";
+                tree.insert(k, "y", -i, 1, 1.0);
+                model[k] = -i;
+            }
+            int mismatches = checkAgainstModel(tree, model, rng);
+            ok &= expect(mismatches == 0, to_string(mismatches) + " mismatch(es) against the model");
+            tree.close();
+        }
+        bytes[shared] = fileSize("test_prefix.bin");
+    }
+    remove("test_prefix.bin");
+    ok &= expect(2 * leaves[1] < leaves[0], to_string(leaves[1]) + " leaves with shared prefixes, " + to_string(leaves[0]) + " without");
+    ok &= expect(bytes[1] < bytes[0] * 3 / 4, to_string(bytes[1]) + " bytes on disk with shared prefixes, " + to_string(bytes[0]) + " without");
+    cout << "  " << ITEMS << " bulk loaded names: " << leaves[1] << " leaves shared, " << leaves[0] << " not; file "
+        << bytes[1] / 1024 << " KiB against " << bytes[0] / 1024 << " KiB after more inserts\n";
+    return finish(ok);
+}
+// Average cost of a buffer pool miss as the pool grows
+void BenchBufferPoolMisses()
+{
+    cout << "\nBuffer Pool Miss Cost by Pool Size ===\n";
+    const int MISSES = 100000;
+    const int sizes[] = { 10, 100, 1000, 10000, 100000 };
+    const ReplacementType policies[] = { ReplacementType::FIFO, ReplacementType::LRU,
+        ReplacementType::CLOCK, ReplacementType::LRUK, ReplacementType::TwoQ };
+    for (ReplacementType type : policies)
+    {
+        for (int frames : sizes)
+        {
+            /* in mmap mode a miss only points the frame into the mapping, so no
+            page data is copied and just the pool's own bookkeeping is timed
+            (the pages are never dereferenced, the file can stay empty) */
+            remove("bench_pool.bin");
+            FileDiskManager dm("bench_pool.bin", DiskMode::Mmap);
+            BufferPool bp(frames, &dm, type);
+            // fill every frame
+            for (int pid = 0; pid < frames; pid++)
+            {
+                bp.FetchPage(pid);
+                bp.UnpinPage(pid, false);
+            }
+            bp.ResetStats();
+            // every fetch is a new page, so each one evicts
+            auto t1 = high_resolution_clock::now();
+            for (int i = 0; i < MISSES; i++)
+            {
+                int pid = frames + i;
+                bp.FetchPage(pid);
+                bp.UnpinPage(pid, false);
+            }
+            auto t2 = high_resolution_clock::now();
+            double avg = duration_cast<nanoseconds>(t2 - t1).count() / double(MISSES);
+            cout << bp.GetPolicyName() << "\t" << frames << " frames:\t"
+                << avg << " ns/miss (" << bp.GetStats().evictions << " evictions)\n";
+        }
+    }
+    remove("bench_pool.bin");
+    cout << "=============================================\n";
+}
+// Buffer pool hit throughput as threads are added, once with one shard and once sharded
+void BenchConcurrentFetches()
+{
+    cout << "\nConcurrent Buffer Pool Fetches ===\n";
+    const int PAGES = 1024;
+    const int FETCHES_PER_THREAD = 1000000;
+    const int SHARD_COUNT = 64;
+    int maxThreads = static_cast<int>(std::thread::hardware_concurrency());
+    if (maxThreads < 1) maxThreads = 1;
+    for (int shardCount : { 1, SHARD_COUNT })
+    {
+        remove("bench_pool.bin");
+        FileDiskManager dm("bench_pool.bin", DiskMode::Mmap);
+        // every page fits, so after warm up each fetch is a hit
+        BufferPool bp(PAGES, &dm, ReplacementType::LRU, shardCount);
+        for (int pid = 0; pid < PAGES; pid++)
+        {
+            bp.FetchPage(pid);
+            bp.UnpinPage(pid, false);
+        }
+        for (int threads = 1; threads <= maxThreads; threads *= 2)
+        {
+            bp.ResetStats();
+            vector<std::thread> workers;
+            auto t1 = high_resolution_clock::now();
+            for (int t = 0; t < threads; t++)
+            {
+                workers.emplace_back([&bp, t]() {
+                    mt19937 rng(t + 1);
+                    for (int i = 0; i < FETCHES_PER_THREAD; i++)
+                    {
+                        int pid = static_cast<int>(rng() % PAGES);
+                        bp.FetchPage(pid);
+                        bp.UnpinPage(pid, false);
+                    }
+                });
+            }
+            for (auto& w : workers)
+                w.join();
+            auto t2 = high_resolution_clock::now();
+            double secs = duration_cast<nanoseconds>(t2 - t1).count() / 1e9;
+            cout << shardCount << " shard(s)\t" << threads << " thread(s):\t"
+                << (bp.GetStats().fetches / secs / 1e6) << " M fetches/s\n";
+        }
+    }
+    remove("bench_pool.bin");
+    cout << "=============================================\n";
+}
+// Full leaf-chain scan from a cold pool, with and without read-ahead
+void BenchLeafScanReadAhead()
+{
+    cout << "\nLeaf Scan Read-Ahead ===\n";
+    const int ITEMS = 200000;
+    const int FRAMES = 64;
+    remove("bench_scan.bin");
+    {
+        // keys go in shuffled, so consecutive leaves end up scattered over the file
+        FileDiskManager dm("bench_scan.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<int> keys(ITEMS);
+        for (int i = 0; i < ITEMS; i++)
+            keys[i] = i + 1;
+        shuffle(keys.begin(), keys.end(), mt19937(7));
+        for (int k : keys)
+            tree.insert(intKey(k), "item", 1, 1, 1.0);
+        tree.close();
+    }
+    for (int pages : { 0, READ_AHEAD_PAGES })
+    {
+        // direct I/O keeps the OS page cache from hiding the per-page latency
+        FileDiskManager dm("bench_scan.bin", DiskMode::Direct);
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        if (pages > 0)
+            bp.EnableReadAhead(&BPlusTreePaged::leafChainLink, pages);
+        BPlusTreePaged tree(&bp, &dm);
+        auto t1 = high_resolution_clock::now();
+        size_t found = tree.rangeSearch(intKey(0), intKey(ITEMS)).size();
+        auto t2 = high_resolution_clock::now();
+        BufferStats st = bp.GetStats();
+        cout << "read-ahead " << bp.GetReadAheadPages() << ":\t" << found << " items in "
+            << duration_cast<milliseconds>(t2 - t1).count() << " ms ("
+            << st.misses << " misses, " << st.prefetches << " prefetched)\n";
+        tree.close();
+    }
+    remove("bench_scan.bin");
+    cout << "=============================================\n";
+}
+// Point lookup hit rate right after a full scan, for a plain leaf walk and for rangeSearch
+void BenchScanResistance()
+{
+    cout << "\nPoint Lookups After a Full Scan ===\n";
+    const int ITEMS = 20000;
+    const int FRAMES = 10;
+    const int LOOKUPS = 20;
+    // keys on different leaves, they and the root fit the pool together
+    const int HOT = 4;
+    const ReplacementType policies[] = { ReplacementType::FIFO, ReplacementType::LRU,
+        ReplacementType::CLOCK, ReplacementType::LRUK, ReplacementType::TwoQ };
+    remove("bench_scan.bin");
+    {
+        FileDiskManager dm("bench_scan.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<int> keys(ITEMS);
+        for (int i = 0; i < ITEMS; i++)
+            keys[i] = i + 1;
+        shuffle(keys.begin(), keys.end(), mt19937(7));
+        for (int k : keys)
+            tree.insert(intKey(k), "item", 1, 1, 1.0);
+        tree.close();
+    }
+    for (ReplacementType type : policies)
+    {
+        FileDiskManager dm("bench_scan.bin");
+        BufferPool bp(FRAMES, &dm, type);
+        BPlusTreePaged tree(&bp, &dm);
+        foodItem out{};
+        // hit rate of a batch of lookups of the hot keys, 100% while their pages stay resident
+        auto lookups = [&]() {
+            bp.ResetStats();
+            for (int i = 0; i < LOOKUPS; i++)
+                tree.search(intKey((i % HOT) * (ITEMS / HOT) + 1), out);
+            BufferStats st = bp.GetStats();
+            return 100.0 * st.hits / st.fetches;
+        };
+        lookups();
+        double warm = lookups();
+        // every leaf through ordinary fetches
+        for (int pid = tree.getFirstLeafPageId(); pid != -1;)
+        {
+            PageFrame* pf;
+            int next = static_cast<LeafPage*>(tree.loadNodeForTest(pid, pf))->nextLeaf;
+            tree.unpinForTest(pid, false);
+            pid = next;
+        }
+        // each batch finds the hot pages loaded again by the one before
+        double afterWalk = lookups();
+        tree.rangeSearch(intKey(0), intKey(ITEMS));
+        double afterScan = lookups();
+        // a reverse scan finds each leaf from the root, short scans each start at a leaf of their own
+        for (RangeCursor c = tree.scan(intKey(0), intKey(ITEMS), SIZE_MAX, 0, ScanOrder::Descending); c.valid(); c.next()) {}
+        for (int i = 0; i < 100; i++)
+            for (RangeCursor c = tree.scan(intKey(i * (ITEMS / 100) + 1), intKey(ITEMS), 3); c.valid(); c.next()) {}
+        double afterCursors = lookups();
+        cout << bp.GetPolicyName() << "\thit rate warm " << warm << "%, after leaf walk "
+            << afterWalk << "%, after rangeSearch " << afterScan << "%, after reverse and short scans "
+            << afterCursors << "%\n";
+        tree.close();
+    }
+    remove("bench_scan.bin");
+    cout << "=============================================\n";
+}
+// search() latency percentiles under mixed inserts and lookups, background writer off and on
+void BenchSearchTailLatency()
+{
+    cout << "\nSearch Latency Under Mixed Load ===\n";
+    const int ITEMS = 50000;
+    const int OPS = 20000;
+    const int FRAMES = 64;
+    for (bool bg : { false, true })
+    {
+        remove("bench_mixed.bin");
+        // direct I/O so a dirty victim costs a real write
+        FileDiskManager dm("bench_mixed.bin", DiskMode::Direct);
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        mt19937 rng(11);
+        for (int i = 0; i < ITEMS; i++)
+            tree.insert(intKey(static_cast<int>(rng() % (ITEMS * 4)) + 1), "item", 1, 1, 1.0);
+        tree.checkpoint();
+        if (bg)
+            bp.EnableBackgroundWriter(FRAMES / 4);
+        bp.ResetStats();
+        vector<long long> lat;
+        lat.reserve(OPS / 2);
+        foodItem out{};
+        for (int i = 0; i < OPS; i++)
+        {
+            string key = intKey(static_cast<int>(rng() % (ITEMS * 4)) + 1);
+            if (i % 2 == 0)
+            {
+                tree.insert(key, "item", 1, 1, 1.0);
+                continue;
+            }
+            auto t1 = high_resolution_clock::now();
+            tree.search(key, out);
+            auto t2 = high_resolution_clock::now();
+            lat.push_back(duration_cast<nanoseconds>(t2 - t1).count());
+        }
+        sort(lat.begin(), lat.end());
+        BufferStats st = bp.GetStats();
+        cout << "background writer " << (bg ? "on: " : "off:")
+            << " p50 " << lat[lat.size() / 2] / 1000.0
+            << " us, p99 " << lat[lat.size() * 99 / 100] / 1000.0
+            << " us, p99.9 " << lat[lat.size() * 999 / 1000] / 1000.0
+            << " us (" << st.writes << " foreground / " << st.bgWrites << " background writes)\n";
+        bp.DisableBackgroundWriter();
+    }
+    remove("bench_mixed.bin");
+    cout << "=============================================\n";
+}
+// Cost of a buffer pool hit that reads its frame, frames on normal pages and on huge pages
+void BenchFrameArena()
+{
+    cout << "\nBuffer Pool Hits Over a Large Frame Arena ===\n";
+    const int FRAMES = 16384; // 256 MB of frames
+    const int HITS = 2000000;
+    for (bool huge : { false, true })
+    {
+        remove("bench_arena.bin");
+        FileDiskManager dm("bench_arena.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU, 1, huge);
+        // pages past the end of the file read as zeroes, this touches every frame
+        for (int pid = 0; pid < FRAMES; pid++)
+        {
+            bp.FetchPage(pid);
+            bp.UnpinPage(pid, false);
+        }
+        mt19937 rng(3);
+        volatile char sink = 0;
+        auto t1 = high_resolution_clock::now();
+        for (int i = 0; i < HITS; i++)
+        {
+            int pid = static_cast<int>(rng() % FRAMES);
+            PageFrame* f = bp.FetchPage(pid);
+            sink = sink ^ f->data[rng() % PAGE_SIZE];
+            bp.UnpinPage(pid, false);
+        }
+        auto t2 = high_resolution_clock::now();
+        double avg = duration_cast<nanoseconds>(t2 - t1).count() / double(HITS);
+        cout << (huge ? "huge pages" : "4K pages  ") << (bp.UsesHugePages() ? " (reserved)" : huge ? " (transparent)" : "")
+            << ":\t" << avg << " ns/hit\n";
+    }
+    remove("bench_arena.bin");
+    cout << "=============================================\n";
+}
+// Page table lookup cost on hits: node based unordered_map against the flat PageTable
+void BenchPageTableLookup()
+{
+    cout << "\nPage Table Hit Lookup ===\n";
+    const int LOOKUPS = 10000000;
+    const int sizes[] = { 10, 1000, 100000 };
+    for (int entries : sizes)
+    {
+        // resident pages are a random tenth of a file ten times the pool
+        vector<PageFrame> frames(entries);
+        vector<int> resident(entries * 10);
+        for (int i = 0; i < entries * 10; i++)
+            resident[i] = i;
+        mt19937 rng(5);
+        shuffle(resident.begin(), resident.end(), rng);
+        resident.resize(entries);
+        unordered_map<int, PageFrame*> map;
+        PageTable table(entries);
+        for (int i = 0; i < entries; i++)
+        {
+            map[resident[i]] = &frames[i];
+            table.Insert(resident[i], &frames[i]);
+        }
+        // same random hits for both
+        vector<int> ids(1 << 16);
+        for (int& id : ids)
+            id = resident[rng() % entries];
+        // sum the frame ids found so neither loop can be optimized away
+        long long mapSum = 0, tableSum = 0;
+        auto t1 = high_resolution_clock::now();
+        for (int i = 0; i < LOOKUPS; i++)
+            mapSum += map.find(ids[i & 0xFFFF])->second - frames.data();
+        auto t2 = high_resolution_clock::now();
+        for (int i = 0; i < LOOKUPS; i++)
+            tableSum += table.Find(ids[i & 0xFFFF]) - frames.data();
+        auto t3 = high_resolution_clock::now();
+        if (mapSum != tableSum) cout << "ERROR: lookups disagree\n";
+        cout << entries << " pages:\tunordered_map "
+            << duration_cast<nanoseconds>(t2 - t1).count() / double(LOOKUPS) << " ns, PageTable "
+            << duration_cast<nanoseconds>(t3 - t2).count() / double(LOOKUPS) << " ns\n";
+    }
+    cout << "=============================================\n";
+}
+// Build time and size of a tree loaded with insert() against bulkLoad()
+void BenchBulkLoad()
+{
+    cout << "\nBulk Load Against Row Inserts ===\n";
+    const int FRAMES = 64;
+    for (int items : { 200000, 1000000 })
+    {
+        // one pass per loader, insert() only for the smaller size
+        for (bool bulk : { false, true })
+        {
+            if (!bulk && items > 200000) continue;
+            remove("bench_bulk.bin");
+            FileDiskManager dm("bench_bulk.bin");
+            BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+            BPlusTreePaged tree(&bp, &dm);
+            vector<pair<string, foodItem>> rows(items);
+            for (int i = 0; i < items; i++)
+                rows[i] = { intKey(i + 1), foodItem("item", 1, 1, 1.0) };
+            shuffle(rows.begin(), rows.end(), mt19937(7));
+            auto t1 = high_resolution_clock::now();
+            if (bulk)
+                tree.bulkLoad(rows);
+            else
+                for (const auto& r : rows)
+                    tree.insert(r.first, r.second.foodName, 1, 1, 1.0);
+            tree.checkpoint();
+            auto t2 = high_resolution_clock::now();
+            // every key has to come back from the finished tree
+            size_t found = tree.rangeSearch(intKey(0), intKey(items)).size();
+            foodItem out{};
+            bp.ResetStats();
+            int lookups = 0;
+            for (int k = 1; k <= items; k += 997, lookups++)
+                if (!tree.search(intKey(k), out)) found = 0;
+            double fetches = bp.GetStats().fetches / double(lookups);
+            if (found != static_cast<size_t>(items)) cout << "ERROR: bulk loaded tree is missing keys\n";
+            cout << (bulk ? "bulkLoad" : "insert  ") << "\t" << items << " items:\t"
+                << duration_cast<milliseconds>(t2 - t1).count() << " ms, "
+                << dm.GetNumPages() << " pages, depth " << tree.computeTreeDepth()
+                << ", " << fetches << " fetches/lookup\n";
+            tree.close();
+        }
+    }
+    remove("bench_bulk.bin");
+    cout << "=============================================\n";
+}
+// Rows added to a loaded tree one insert() at a time and through insertBatch()
+void BenchInsertBatch()
+{
+    cout << "\nBatched Inserts Into a Loaded Tree ===\n";
+    const int ITEMS = 200000;
+    const int ROWS = 100000;
+    const int FRAMES = 256;
+    for (int batchSize : { 1, 1000, ROWS })
+    {
+        remove("bench_batch.bin");
+        FileDiskManager dm("bench_batch.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        vector<pair<string, foodItem>> rows(ITEMS);
+        for (int i = 0; i < ITEMS; i++)
+            rows[i] = { intKey(2 * i), foodItem("item", 1, 1, 1.0) };
+        tree.bulkLoad(rows);
+        // odd keys in random order, the delta a second CSV would bring
+        vector<pair<string, foodItem>> delta(ROWS);
+        mt19937 rng(5);
+        for (int i = 0; i < ROWS; i++)
+            delta[i] = { intKey(2 * static_cast<int>(rng() % ITEMS) + 1), foodItem("new item", 2, 2, 2.0) };
+        bp.ResetStats();
+        auto t1 = high_resolution_clock::now();
+        for (int from = 0; from < ROWS; from += batchSize)
+        {
+            if (batchSize == 1)
+            {
+                const foodItem& r = delta[from].second;
+                tree.insert(delta[from].first, r.foodName, r.proteinAmt, r.calorieAmt, r.cost);
+                continue;
+            }
+            vector<pair<string, foodItem>> batch(delta.begin() + from, delta.begin() + min(from + batchSize, ROWS));
+            tree.insertBatch(batch);
+        }
+        auto t2 = high_resolution_clock::now();
+        double fetches = bp.GetStats().fetches / double(ROWS);
+        sort(delta.begin(), delta.end(),
+            [](const pair<string, foodItem>& a, const pair<string, foodItem>& b) { return a.first < b.first; });
+        size_t distinct = unique(delta.begin(), delta.end(),
+            [](const pair<string, foodItem>& a, const pair<string, foodItem>& b) { return a.first == b.first; }) - delta.begin();
+        if (tree.rangeSearch(intKey(0), intKey(2 * ITEMS)).size() != ITEMS + distinct) cout << "ERROR: batched rows are missing\n";
+        cout << (batchSize == 1 ? string("insert()") : "batches of " + to_string(batchSize)) << ":\t"
+            << duration_cast<milliseconds>(t2 - t1).count() << " ms, " << fetches << " fetches/row\n";
+        tree.close();
+    }
+    remove("bench_batch.bin");
+    cout << "=============================================\n";
+}
+// Child lookup in one internal node: the old linear loop, binary search and keyUpperBound
+void BenchKeySearch()
+{
+    cout << "\nKey Search Inside a Node (" << keySearchName() << ") ===\n";
+    const int LOOKUPS = 5000000;
+    for (int n : { 16, 128, INTERNAL_MAX_KEYS })
+    {
+        // sorted distinct keys with gaps, searched for both hits and misses
+        vector<int> keys(n);
+        mt19937 rng(11);
+        for (int i = 0; i < n; i++)
+            keys[i] = i * 8 + static_cast<int>(rng() % 8);
+        vector<int> probes(1 << 16);
+        for (int& p : probes)
+            p = static_cast<int>(rng() % (n * 8 + 16)) - 8;
+        for (int p : probes)
+        {
+            int expect = keyUpperBoundScalar(keys.data(), n, p);
+            if (keyUpperBoundBinary(keys.data(), n, p) != expect || keyUpperBound(keys.data(), n, p) != expect)
+            {
+                cout << "ERROR: key search variants disagree\n";
+                break;
+            }
+        }
+        auto time = [&](int (*fn)(const int*, int, int)) {
+            // sum the results so the searches cannot be optimized away
+            long long sum = 0;
+            auto t1 = high_resolution_clock::now();
+            for (int i = 0; i < LOOKUPS; i++)
+                sum += fn(keys.data(), n, probes[i & 0xFFFF]);
+            auto t2 = high_resolution_clock::now();
+            if (sum < 0) cout << sum;
+            return duration_cast<nanoseconds>(t2 - t1).count() / double(LOOKUPS);
+        };
+        double scalar = time(keyUpperBoundScalar);
+        double binary = time(keyUpperBoundBinary);
+        double dispatched = time(keyUpperBound);
+        cout << n << " keys:\tlinear " << scalar << " ns, binary " << binary
+            << " ns, " << keySearchName() << " " << dispatched << " ns\n";
+    }
+    cout << "=============================================\n";
+}
+// Full count and a first page of 50 rows, through rangeSearch() and through a RangeCursor
+void BenchRangeCursor()
+{
+    cout << "\nRange Scans: Hash Map Against Cursor ===\n";
+    const int ITEMS = 1000000;
+    const int FRAMES = 1024;
+    remove("bench_cursor.bin");
+    FileDiskManager dm("bench_cursor.bin");
+    BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+    BPlusTreePaged tree(&bp, &dm);
+    vector<pair<string, foodItem>> rows(ITEMS);
+    for (int i = 0; i < ITEMS; i++)
+        rows[i] = { intKey(i), foodItem("item", 1, 1, 1.0) };
+    tree.bulkLoad(rows);
+    auto time = [](auto fn) {
+        auto t1 = high_resolution_clock::now();
+        size_t n = fn();
+        auto t2 = high_resolution_clock::now();
+        return make_pair(n, duration_cast<microseconds>(t2 - t1).count() / 1000.0);
+    };
+    auto mapCount = time([&]() { return tree.rangeSearch(intKey(0), intKey(ITEMS)).size(); });
+    auto cursorCount = time([&]() {
+        size_t n = 0;
+        for (RangeCursor c = tree.scan(intKey(0), intKey(ITEMS)); c.valid(); c.next())
+            n++;
+        return n;
+    });
+    // the map has to hold the whole range before the first row can be shown
+    auto mapFirst = time([&]() {
+        auto all = tree.rangeSearch(intKey(0), intKey(ITEMS));
+        size_t n = 0;
+        for (auto it = all.begin(); it != all.end() && n < 50; ++it)
+            n++;
+        return n;
+    });
+    auto cursorFirst = time([&]() {
+        size_t n = 0;
+        for (RangeCursor c = tree.scan(intKey(0), intKey(ITEMS)); c.valid() && n < 50; c.next())
+            n++;
+        return n;
+    });
+    /* the last rows and a page deep into the range: the map is unordered, so its
+       keys have to be sorted before either can be picked out */
+    auto sortedKeys = [&]() {
+        auto all = tree.rangeSearch(intKey(0), intKey(ITEMS));
+        vector<string> keys;
+        keys.reserve(all.size());
+        for (const auto& kv : all)
+            keys.push_back(kv.first);
+        sort(keys.begin(), keys.end());
+        return keys;
+    };
+    auto mapLast = time([&]() {
+        auto keys = sortedKeys();
+        return min<size_t>(50, keys.size());
+    });
+    auto cursorLast = time([&]() {
+        size_t n = 0;
+        for (RangeCursor c = tree.scan(intKey(0), intKey(ITEMS), 50, 0, ScanOrder::Descending); c.valid(); c.next())
+            n++;
+        return n;
+    });
+    auto mapPage = time([&]() {
+        auto keys = sortedKeys();
+        return keys.size() > static_cast<size_t>(ITEMS / 2) ? min<size_t>(50, keys.size() - ITEMS / 2) : 0;
+    });
+    auto cursorPage = time([&]() {
+        size_t n = 0;
+        for (RangeCursor c = tree.scan(intKey(0), intKey(ITEMS), 50, ITEMS / 2); c.valid(); c.next())
+            n++;
+        return n;
+    });
+    if (mapCount.first != static_cast<size_t>(ITEMS) || cursorCount.first != static_cast<size_t>(ITEMS))
+        cout << "ERROR: scans did not return every item\n";
+    if (cursorLast.first != 50 || cursorPage.first != 50)
+        cout << "ERROR: limited scans did not return 50 items\n";
+    cout << "count " << ITEMS << ":\trangeSearch " << mapCount.second << " ms, cursor " << cursorCount.second << " ms\n";
+    cout << "first 50:\trangeSearch " << mapFirst.second << " ms, cursor " << cursorFirst.second << " ms\n";
+    cout << "last 50:\trangeSearch " << mapLast.second << " ms, cursor " << cursorLast.second << " ms\n";
+    cout << "50 at " << ITEMS / 2 << ":\trangeSearch " << mapPage.second << " ms, cursor " << cursorPage.second << " ms\n";
+    tree.close();
+    remove("bench_cursor.bin");
+    cout << "=============================================\n";
+}
+// count, countRange, rank and select off the subtree counts against counting with a cursor
+void BenchOrderStatistics()
+{
+    cout << "\nCounts: Cursor Walk Against Subtree Counts ===\n";
+    const int ITEMS = 1000000;
+    const int QUERIES = 10000;
+    const int FRAMES = 1024;
+    remove("bench_ostat.bin");
+    FileDiskManager dm("bench_ostat.bin");
+    BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+    BPlusTreePaged tree(&bp, &dm);
+    vector<pair<string, foodItem>> rows(ITEMS);
+    for (int i = 0; i < ITEMS; i++)
+        rows[i] = { intKey(2 * i), foodItem("item", i, 1, 1.0) };
+    tree.bulkLoad(rows);
+    // time in ms and page fetches of one run of fn, which returns a checksum
+    auto measure = [&](const char* label, int runs, auto fn) {
+        bp.ResetStats();
+        auto t1 = high_resolution_clock::now();
+        size_t sum = 0;
+        for (int r = 0; r < runs; r++)
+            sum += fn(r);
+        auto t2 = high_resolution_clock::now();
+        double ms = duration_cast<microseconds>(t2 - t1).count() / 1000.0 / runs;
+        cout << label << ":\t" << ms << " ms, " << bp.GetStats().fetches / double(runs) << " fetches"
+            << " (checksum " << sum << ")\n";
+    };
+    measure("count, cursor", 1, [&](int) {
+        size_t n = 0;
+        for (RangeCursor c = tree.scan(intKey(0), intKey(2 * ITEMS)); c.valid(); c.next())
+            n++;
+        return n;
+    });
+    measure("count()", QUERIES, [&](int) { return tree.count(); });
+    mt19937 rng(11);
+    measure("countRange()", QUERIES, [&](int) {
+        int a = static_cast<int>(rng() % (2 * ITEMS));
+        return tree.countRange(intKey(a), intKey(a + ITEMS));
+    });
+    measure("rank()", QUERIES, [&](int) { return tree.rank(intKey(static_cast<int>(rng() % (2 * ITEMS)))); });
+    measure("select()", QUERIES, [&](int) {
+        string key;
+        foodItem item;
+        tree.select(rng() % ITEMS, key, item);
+        return static_cast<size_t>(item.proteinAmt);
+    });
+    if (tree.count() != static_cast<size_t>(ITEMS) || tree.rank(intKey(ITEMS)) != static_cast<size_t>(ITEMS / 2))
+        cout << "ERROR: counts do not match the tree\n";
+    tree.close();
+    remove("bench_ostat.bin");
+    cout << "=============================================\n";
+}
+// search() throughput of reader threads on their own and while a writer inserts
+void BenchConcurrentTree()
+{
+    cout << "\nLookups Alongside Inserts ===\n";
+    const int ITEMS = 200000;
+    const int LOOKUPS_PER_THREAD = 500000;
+    const int FRAMES = 4096;
+    int readers = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+    if (readers < 1) readers = 1;
+    remove("bench_olc.bin");
+    FileDiskManager dm("bench_olc.bin");
+    BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+    BPlusTreePaged tree(&bp, &dm);
+    // even keys are loaded up front, the writer adds odd ones and splits leaves
+    vector<pair<string, foodItem>> rows(ITEMS);
+    for (int i = 0; i < ITEMS; i++)
+        rows[i] = { intKey(2 * i), foodItem("item", i, 1, 1.0) };
+    tree.bulkLoad(rows);
+    for (bool writing : { false, true })
+    {
+        atomic<bool> stop(false);
+        atomic<long long> misses(0);
+        long long inserts = 0;
+        std::thread writer;
+        if (writing)
+        {
+            writer = std::thread([&]() {
+                mt19937 rng(3);
+                while (!stop)
+                {
+                    tree.insert(intKey(2 * static_cast<int>(rng() % ITEMS) + 1), "inserted item", 1, 1, 1.0);
+                    inserts++;
+                }
+            });
+        }
+        vector<std::thread> workers;
+        auto t1 = high_resolution_clock::now();
+        for (int t = 0; t < readers; t++)
+        {
+            workers.emplace_back([&, t]() {
+                mt19937 rng(t + 1);
+                foodItem out{};
+                // every loaded key has to be found whatever the writer is splitting
+                for (int i = 0; i < LOOKUPS_PER_THREAD; i++)
+                {
+                    int k = static_cast<int>(rng() % ITEMS);
+                    if (!tree.search(intKey(2 * k), out) || out.proteinAmt != k)
+                        misses++;
+                }
+            });
+        }
+        for (auto& w : workers)
+            w.join();
+        auto t2 = high_resolution_clock::now();
+        stop = true;
+        if (writer.joinable())
+            writer.join();
+        double secs = duration_cast<nanoseconds>(t2 - t1).count() / 1e9;
+        if (misses > 0) cout << "ERROR: " << misses << " loaded keys were not found\n";
+        cout << readers << " reader(s)" << (writing ? " + 1 writer:\t" : ":\t\t")
+            << (readers * static_cast<double>(LOOKUPS_PER_THREAD) / secs / 1e6) << " M lookups/s";
+        if (writing)
+            cout << ", " << (inserts / secs / 1e3) << " k inserts/s";
+        cout << "\n";
+    }
+    tree.close();
+    remove("bench_olc.bin");
+    cout << "=============================================\n";
+}
+// Pages, key bytes and cold scan cost of a tree of food names that share long prefixes
+void BenchKeyCompression()
+{
+    cout << "\nPrefix Compressed Leaves and Short Separators ===\n";
+    const int ITEMS = 1000000;
+    const int FRAMES = 256;
+    static const char* dishes[] = { "Crunchy Taco", "Crunchy Taco Supreme", "Cheesy Gordita Crunch",
+        "Chicken Quesadilla", "Big Mac", "Quarter Pounder with Cheese", "Chicken McNuggets", "Whopper",
+        "Whopper Jr.", "Spicy Chicken Sandwich" };
+    static const char* sizes[] = { "", " Small", " Medium", " Large", " Family Size" };
+    static const char* places[] = { " (Taco Bell)", " (McDonald's)", " (Burger King)", " (Wendy's)" };
+    remove("bench_names.bin");
+    long long keyBytes = 0;
+    {
+        FileDiskManager dm("bench_names.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        mt19937 rng(11);
+        vector<pair<string, foodItem>> rows(ITEMS);
+        for (int i = 0; i < ITEMS; i++)
+        {
+            string name = string(dishes[rng() % 10]) + sizes[rng() % 5] + " #" + to_string(i) + places[rng() % 4];
+            rows[i] = { foodKey(name), foodItem(name, 1, 1, 1.0) };
+            keyBytes += rows[i].first.size();
+        }
+        auto t1 = high_resolution_clock::now();
+        tree.bulkLoad(rows);
+        auto t2 = high_resolution_clock::now();
+        // walk the tree a level at a time for the bytes the keys take in it
+        long long leaves = 0, prefixBytes = 0, internals = 0, separators = 0, separatorBytes = 0;
+        vector<int> level{ tree.getRootPageId() };
+        while (!level.empty())
+        {
+            vector<int> below;
+            for (int pid : level)
+            {
+                PageFrame* pf;
+                NodeHeader* node = tree.loadNodeForTest(pid, pf);
+                if (node->isLeaf)
+                {
+                    leaves++;
+                    prefixBytes += static_cast<LeafPage*>(node)->prefixBytes();
+                }
+                else
+                {
+                    InternalPage* in = static_cast<InternalPage*>(node);
+                    internals++;
+                    for (int i = 0; i < in->size; i++)
+                        separatorBytes += in->key(i).size();
+                    separators += in->size;
+                    below.insert(below.end(), in->children(), in->children() + in->size + 1);
+                }
+                tree.unpinForTest(pid, false);
+            }
+            level.swap(below);
+        }
+        cout << "bulkLoad " << ITEMS << " names: " << duration_cast<milliseconds>(t2 - t1).count() << " ms, "
+            << dm.GetNumPages() << " pages, depth " << tree.computeTreeDepth() << "\n"
+            << "leaves:\t\t" << leaves << ", " << ITEMS / double(leaves) << " records each, prefix "
+            << prefixBytes / double(leaves) << " of " << keyBytes / double(ITEMS) << " key bytes\n"
+            << "internal nodes:\t" << internals << ", " << (separators + internals) / double(internals)
+            << " children each, separators " << separatorBytes / double(separators) << " bytes\n";
+        tree.close();
+    }
+    {
+        FileDiskManager dm("bench_names.bin");
+        BufferPool bp(FRAMES, &dm, ReplacementType::LRU);
+        BPlusTreePaged tree(&bp, &dm);
+        auto t1 = high_resolution_clock::now();
+        size_t found = 0;
+        for (RangeCursor c = tree.scan("", maxKey()); c.valid(); c.next())
+            found++;
+        auto t2 = high_resolution_clock::now();
+        if (found != static_cast<size_t>(ITEMS)) cout << "ERROR: scan missed names\n";
+        cout << "cold full scan:\t" << duration_cast<milliseconds>(t2 - t1).count() << " ms, "
+            << bp.GetStats().misses << " misses\n";
+        tree.close();
+    }
+    remove("bench_names.bin");
+    cout << "=============================================\n";
+}